@@ -0,0 +1,167 @@
+#ifndef CPU_CHECKERBOARD_H
+#define CPU_CHECKERBOARD_H
+
+// cpu reference for checkerboard rendering: ps_main traces half the pixels
+// each frame and reconstruct_ps_main fills in the rest from the traced
+// neighbours and the value traced for that pixel last frame. the normal, depth
+// and material of a skipped pixel are last frame's too, so it takes those of
+// the traced neighbour whose color is closest to the reconstructed one
+
+#include <stdbool.h>
+
+#include "scene.h"
+
+// values match the constants in shaders.hlsl
+typedef enum
+{
+    CHECKERBOARD_OFF,
+    CHECKERBOARD_CHECKER,
+    CHECKERBOARD_ROWS,
+} CheckerboardPattern;
+
+typedef enum
+{
+    RECONSTRUCT_SPATIAL,
+    RECONSTRUCT_TEMPORAL_CLAMP,
+} ReconstructFilter;
+
+// what to do on frames without a usable previous frame
+typedef enum
+{
+    FALLBACK_SPATIAL,
+    FALLBACK_FULL_FRAME,
+} CheckerboardFallback;
+
+typedef struct
+{
+    CheckerboardPattern pattern;
+    ReconstructFilter filter;
+    CheckerboardFallback fallback;
+} CheckerboardSettings;
+
+static inline CheckerboardPattern checkerboard_frame_pattern(CheckerboardSettings const *const settings,
+                                                             bool const history_valid)
+{
+    if (!history_valid && settings->fallback == FALLBACK_FULL_FRAME)
+    {
+        return CHECKERBOARD_OFF;
+    }
+
+    return settings->pattern;
+}
+
+static inline bool checkerboard_is_traced(CheckerboardPattern const pattern,
+                                          int const x, int const y,
+                                          uint32_t const frame_index)
+{
+    switch (pattern)
+    {
+        case CHECKERBOARD_CHECKER: return (((uint32_t)(x + y) + frame_index) & 1) == 0;
+        case CHECKERBOARD_ROWS: return (((uint32_t)y + frame_index) & 1) == 0;
+        default: return true;
+    }
+}
+
+// traces this frame's pixels into history, the rest keep last frame's value,
+// returns the number of pixels traced
+static int checkerboard_trace_frame(CheckerboardSettings const *const settings,
+                                    SceneConstants const *const constants,
+                                    int const width, int const height,
+                                    uint32_t const frame_index, bool const history_valid,
+                                    GBufferTexel *const history)
+{
+    CheckerboardPattern const pattern = checkerboard_frame_pattern(settings, history_valid);
+
+    int traced = 0;
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            if (!checkerboard_is_traced(pattern, x, y, frame_index)) continue;
+
+            history[(size_t)y * width + x] =
+                scene_trace_pixel(constants, scene_pixel_coords(x, y, width, height));
+            ++traced;
+        }
+    }
+
+    return traced;
+}
+
+static void checkerboard_reconstruct(CheckerboardSettings const *const settings,
+                                     int const width, int const height,
+                                     uint32_t const frame_index, bool const history_valid,
+                                     GBufferTexel const *const history,
+                                     GBufferTexel *const output)
+{
+    CheckerboardPattern const pattern = checkerboard_frame_pattern(settings, history_valid);
+
+    // rows only have their vertical neighbours traced
+    int const neighbour_count = pattern == CHECKERBOARD_ROWS ? 2 : 4;
+    int const offsets[4][2] = {{0, -1}, {0, 1}, {-1, 0}, {1, 0}};
+
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            GBufferTexel const *const texel = history + (size_t)y * width + x;
+            GBufferTexel *const result = output + (size_t)y * width + x;
+
+            *result = *texel;
+            if (checkerboard_is_traced(pattern, x, y, frame_index)) continue;
+
+            GBufferTexel const *neighbours[4];
+            float3 spatial = f3s(0.0f);
+            float3 neighbour_min = f3s(INFINITY);
+            float3 neighbour_max = f3s(-INFINITY);
+
+            for (int i = 0; i < neighbour_count; ++i)
+            {
+                neighbours[i] = gbuffer_fetch(history, width, height,
+                                              x + offsets[i][0], y + offsets[i][1]);
+                float3 const color = neighbours[i]->color;
+
+                spatial = add3(spatial, color);
+                neighbour_min = f3(fminf(neighbour_min.x, color.x),
+                                   fminf(neighbour_min.y, color.y),
+                                   fminf(neighbour_min.z, color.z));
+                neighbour_max = f3(fmaxf(neighbour_max.x, color.x),
+                                   fmaxf(neighbour_max.y, color.y),
+                                   fmaxf(neighbour_max.z, color.z));
+            }
+
+            if (settings->filter == RECONSTRUCT_TEMPORAL_CLAMP && history_valid)
+            {
+                result->color = f3(fminf(fmaxf(texel->color.x, neighbour_min.x), neighbour_max.x),
+                                   fminf(fmaxf(texel->color.y, neighbour_min.y), neighbour_max.y),
+                                   fminf(fmaxf(texel->color.z, neighbour_min.z), neighbour_max.z));
+            }
+            else
+            {
+                result->color = scale3(spatial, 1.0f / (float)neighbour_count);
+            }
+
+            // the reconstructed color target is R11G11B10_FLOAT as well
+            result->color = decode_r11g11b10(encode_r11g11b10(result->color));
+
+            int closest = 0;
+            float closest_distance = INFINITY;
+            for (int i = 0; i < neighbour_count; ++i)
+            {
+                float3 const difference = sub3(neighbours[i]->color, result->color);
+                float const distance = dot3(difference, difference);
+                if (distance < closest_distance)
+                {
+                    closest = i;
+                    closest_distance = distance;
+                }
+            }
+
+            result->normal = neighbours[closest]->normal;
+            result->depth = neighbours[closest]->depth;
+            result->material = neighbours[closest]->material;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,3011 @@
+// headless cpu port of the screensaver, used to benchmark and check
+// rendering changes on machines without direct3d
+//
+// usage: cpu_render <mode> [options]
+//   -render <file.ppm>   render one frame with ps_main + post_ps_main
+//   -bench-sdf           compare the sdf program interpreter with distance_function
+//   -bench-kernels       time each sdf function, hash and the post pass on inputs
+//                        captured from camera rays, writes json to -output
+//   -wavefront           compare the wavefront tracer with the per pixel megakernel
+//   -gbuffer             report the round trip error of the g-buffer encoding
+//   -pacing              simulate the frame pacing policy and report frame time jitter
+//   -pipeline            render a sequence with trace, denoise, tonemap and output
+//                        running as concurrent stages, compares pipeline depths
+//   -still <file>        render one frame tile by tile straight into a .tif or .ppm
+//   -bench-still         compare peak memory and throughput of -still at several sizes
+//   -scanline            compare streaming the g-buffer through a rolling window of
+//                        rows into the post filter with the two pass full frame render
+//   -distributed         render a sequence with a coordinator and forked worker
+//                        processes over loopback, compares worker counts
+//   -worker <port>       run a worker for a coordinator listening on the port
+//   -window-state        stress the window state handoff with a writer and a reader
+//                        thread, fails on a torn or out of order snapshot
+//   -shader-cache        run the shader reload logic against a stand-in compiler and
+//                        check the compiles, cache hits and reloads of each step
+//   -runtime             check the freestanding memset, memcpy, arena and clock
+//   -bench-runtime       compare the runtime memset and memcpy with a byte loop and
+//                        libc, and arena allocation with malloc
+//   -check-tuner         check the quality tuner search against every level on a
+//                        simulated gpu and the quality cache against bad records
+//   -tune                pick the quality level that renders -size within -target-ms,
+//                        or read it from the cache at -output
+//   -checkerboard <ptf>  compare checkerboard rendering with full frames, the digits
+//                        pick the pattern, reconstruction filter and fallback
+//   -frame-generation    trace every other frame of a sequence and warp the rest along
+//                        the analytic motion, compares them and the traced frames
+//                        with a many sample reference
+//   -bench-lod           compare the level of detail march with full detail, steps,
+//                        trace time and the error of the final image
+//
+// options:
+//   -size <width>x<height>   frame size, default 320x180
+//   -timer <seconds>         value of the timer constant, default 1.5
+//   -frames <count>          frames of 1/30 s apart for sequence modes, default 8
+//   -depth <count>           frames in flight for -pipeline, by default 1 to 4 are compared
+//   -tile <pixels>           tile size for -still and -distributed, default 64
+//   -workers <count>         worker processes for -distributed, by default 1 to 4
+//   -threads <count>         trace threads for -scanline, default the online cpus
+//   -target-ms <ms>          frame time -tune has to stay within, default 250
+//   -output <file>           where -pipeline and -distributed append their frames, by default they are
+//                            dropped, where -bench-kernels writes its json and -tune its cache
+//   -lod                     march -render, -bench-kernels and -wavefront with the level
+//                            of detail, by default at full detail
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "scene.h"
+#include "sdf_program.h"
+#include "wavefront.h"
+#include "checkerboard.h"
+#include "frame_generation.h"
+#include "pipeline.h"
+#include "distributed.h"
+#include "still.h"
+#include "scanline.h"
+#include "microbench.h"
+#include "../frame_pacing.h"
+#include "../shader_cache.h"
+#include "../window_state.h"
+#include "../runtime.h"
+#include "../quality_tuner.h"
+
+typedef enum
+{
+    NOTHING_MODE,
+    RENDER_MODE,
+    BENCH_SDF_MODE,
+    BENCH_KERNELS_MODE,
+    WAVEFRONT_MODE,
+    CHECKERBOARD_MODE,
+    FRAME_GENERATION_MODE,
+    GBUFFER_MODE,
+    PACING_MODE,
+    SHADER_CACHE_MODE,
+    WINDOW_STATE_MODE,
+    PIPELINE_MODE,
+    DISTRIBUTED_MODE,
+    WORKER_MODE,
+    STILL_MODE,
+    BENCH_STILL_MODE,
+    SCANLINE_MODE,
+    RUNTIME_MODE,
+    BENCH_RUNTIME_MODE,
+    CHECK_TUNER_MODE,
+    TUNE_MODE,
+    BENCH_LOD_MODE,
+} ModeType;
+
+typedef struct
+{
+    ModeType mode;
+    char const *output_path;
+    int width;
+    int height;
+    float timer;
+    int frame_count;
+    int pipeline_depth;     // 0 compares several depths
+    int worker_count;       // 0 compares several worker counts
+    int port;
+    int tile_size;
+    int thread_count;       // 0 uses every online cpu
+    double target_ms;
+    bool lod;               // the level of detail cone for -render, -bench-kernels and -wavefront
+    CheckerboardSettings checkerboard;
+} Options;
+
+#define SEQUENCE_FRAME_TIME (1.0f / 30.0f)
+
+// counts the failed checks of -runtime and the other modes that check something
+typedef struct
+{
+    int checks;
+    int failures;
+} RuntimeTest;
+
+static void runtime_check(RuntimeTest *const test, bool const condition, char const *const what)
+{
+    ++test->checks;
+    if (condition) return;
+
+    if (test->failures++ < 10) printf("failed: %s\n", what);
+}
+
+// the exit code of a checking mode
+static int runtime_report(RuntimeTest const *const test)
+{
+    printf("%d checks, %d failed\n", test->checks, test->failures);
+    printf("%s\n", test->failures == 0 ? "passed" : "FAILED");
+    return test->failures == 0 ? 0 : 1;
+}
+
+static unsigned char to_byte(float const value)
+{
+    return (unsigned char)(saturate(value) * 255.0f + 0.5f);
+}
+
+static bool write_ppm(char const *const path, float3 const *const pixels,
+                      int const width, int const height)
+{
+    FILE *const file = fopen(path, "wb");
+    if (file == NULL) return false;
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (size_t i = 0; i < (size_t)width * height; ++i)
+    {
+        unsigned char const rgb[3] = {
+            to_byte(pixels[i].x), to_byte(pixels[i].y), to_byte(pixels[i].z),
+        };
+        fwrite(rgb, 1, sizeof rgb, file);
+    }
+
+    return fclose(file) == 0;
+}
+
+static void post_process_frame(GBufferTexel const *const gbuffer,
+                               int const width, int const height,
+                               float3 *const output)
+{
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            output[(size_t)y * width + x] = scene_post_pixel(gbuffer, width, height, x, y);
+        }
+    }
+}
+
+static int run_render(Options const *const options)
+{
+    int const width = options->width;
+    int const height = options->height;
+    SceneConstants constants = scene_constants(width, height, options->timer);
+    if (options->lod) constants.lod_cone = scene_lod_cone(height);
+
+    GBufferTexel *const gbuffer = malloc((size_t)width * height * sizeof *gbuffer);
+    float3 *const output = malloc((size_t)width * height * sizeof *output);
+    if (gbuffer == NULL || output == NULL) return 1;
+
+    double const start = runtime_clock_now();
+    scene_trace_rows(&constants, width, height, 0, height, gbuffer);
+    double const traced = runtime_clock_now();
+    post_process_frame(gbuffer, width, height, output);
+    double const done = runtime_clock_now();
+
+    printf("trace %.3f s, post %.3f s\n", traced - start, done - traced);
+
+    bool const written = write_ppm(options->output_path, output, width, height);
+    free(gbuffer);
+    free(output);
+
+    if (!written)
+    {
+        fprintf(stderr, "error: could not write %s\n", options->output_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+typedef struct
+{
+    float *x;
+    float *y;
+    float *z;
+    size_t count;
+    size_t capacity;
+} PointSet;
+
+static void point_set_add(PointSet *const this, float3 const point)
+{
+    if (this->count == this->capacity) return;
+
+    this->x[this->count] = point.x;
+    this->y[this->count] = point.y;
+    this->z[this->count] = point.z;
+    ++this->count;
+}
+
+// records every point ray_march evaluates for the camera rays of a frame, so
+// the benchmark sees the same mix of near, far and missed points the shader does
+static void capture_march_points(SceneConstants const *const constants,
+                                 int const width, int const height,
+                                 PointSet *const points)
+{
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            Ray const ray = look_at_ray(constants, scene_camera_position(),
+                                        scene_camera_look_at(), to_radians(60.0f),
+                                        scene_pixel_coords(x, y, width, height));
+
+            float distance_traveled = 0.0f;
+            for (int i = 0; i < SCENE_MAX_STEPS; ++i)
+            {
+                float3 const position = add3(ray.pos, scale3(ray.dir, distance_traveled));
+                point_set_add(points, position);
+
+                float const distance = distance_function(position, constants->timer).distance;
+                if (fabsf(distance) < SCENE_MIN_DISTANCE || distance > SCENE_MAX_DISTANCE)
+                {
+                    break;
+                }
+
+                distance_traveled += distance;
+            }
+        }
+    }
+}
+
+// times distance_function against the sdf program on the captured points,
+// distance and material take the program's results, the hand ones the
+// distance_function's
+static int bench_sdf_points(Options const *const options, PointSet *const points,
+                            float *const distance, float *const material,
+                            float *const hand_distance, float *const hand_material)
+{
+    SceneConstants const constants =
+        scene_constants(options->width, options->height, options->timer);
+
+    static SdfProgram program;
+    if (!sdf_program_build_scene(&program))
+    {
+        fprintf(stderr, "error: scene program is invalid\n");
+        return 1;
+    }
+
+    capture_march_points(&constants, options->width, options->height, points);
+    if (points->count == 0) return 1;
+
+    int const repeats = 5;
+    float checksum = 0.0f;
+
+    double const hand_start = runtime_clock_now();
+    for (int r = 0; r < repeats; ++r)
+    {
+        for (size_t i = 0; i < points->count; ++i)
+        {
+            DistanceInfo const info =
+                distance_function(f3(points->x[i], points->y[i], points->z[i]), options->timer);
+            hand_distance[i] = info.distance;
+            hand_material[i] = info.material;
+        }
+        checksum += hand_distance[(size_t)r % points->count];
+    }
+    double const hand_time = runtime_clock_now() - hand_start;
+
+    double const program_start = runtime_clock_now();
+    for (int r = 0; r < repeats; ++r)
+    {
+        sdf_program_bind(&program, options->timer);
+        sdf_program_evaluate(&program, points->count, points->x, points->y, points->z,
+                             distance, material);
+        checksum += distance[(size_t)r % points->count];
+    }
+    double const program_time = runtime_clock_now() - program_start;
+
+    float max_error = 0.0f;
+    size_t material_mismatches = 0;
+    for (size_t i = 0; i < points->count; ++i)
+    {
+        max_error = fmaxf(max_error, fabsf(distance[i] - hand_distance[i]));
+        material_mismatches += material[i] != hand_material[i];
+    }
+
+    double const evaluations = (double)points->count * repeats;
+    printf("points: %zu captured from %dx%d camera rays, checksum %g\n",
+           points->count, options->width, options->height, checksum);
+    printf("distance_function: %8.2f Mpoints/s\n", evaluations / hand_time * 1e-6);
+    printf("sdf program:       %8.2f Mpoints/s (%.2fx)\n",
+           evaluations / program_time * 1e-6, hand_time / program_time);
+    printf("max distance error %g, material mismatches %zu\n", max_error, material_mismatches);
+
+    return 0;
+}
+
+static int run_bench_sdf(Options const *const options)
+{
+    size_t const capacity = (size_t)options->width * (size_t)options->height * SCENE_MAX_STEPS;
+    PointSet points = {
+        .x = malloc(capacity * sizeof(float)),
+        .y = malloc(capacity * sizeof(float)),
+        .z = malloc(capacity * sizeof(float)),
+        .capacity = capacity,
+    };
+
+    float *const distance = malloc(capacity * sizeof(float));
+    float *const material = malloc(capacity * sizeof(float));
+    float *const hand_distance = malloc(capacity * sizeof(float));
+    float *const hand_material = malloc(capacity * sizeof(float));
+
+    int result = 1;
+    if (points.x == NULL || points.y == NULL || points.z == NULL || distance == NULL ||
+        material == NULL || hand_distance == NULL || hand_material == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+    }
+    else
+    {
+        result = bench_sdf_points(options, &points, distance, material,
+                                  hand_distance, hand_material);
+    }
+
+    free(points.x);
+    free(points.y);
+    free(points.z);
+    free(distance);
+    free(material);
+    free(hand_distance);
+    free(hand_material);
+
+    return result;
+}
+
+static float gbuffer_max_difference(GBufferTexel const *const a,
+                                    GBufferTexel const *const b, size_t const count)
+{
+    float max_difference = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+    {
+        float3 const color = abs3(sub3(a[i].color, b[i].color));
+        float3 const normal = abs3(sub3(a[i].normal, b[i].normal));
+        max_difference = fmaxf(max_difference, fmaxf(fmaxf(color.x, color.y), color.z));
+        max_difference = fmaxf(max_difference, fmaxf(fmaxf(normal.x, normal.y), normal.z));
+        max_difference = fmaxf(max_difference, fabsf(a[i].depth - b[i].depth));
+        max_difference = fmaxf(max_difference, fabsf(a[i].material - b[i].material));
+    }
+
+    return max_difference;
+}
+
+static void print_wavefront_stats(char const *const name, WavefrontStats const *const stats,
+                                  double const seconds)
+{
+    printf("%-22s %8.3f s %8.3f Mrays/s  march lanes %5.1f%%  materials/packet %.2f\n",
+           name, seconds, (double)stats->rays / seconds * 1e-6,
+           100.0 * (double)stats->march_evaluations / (double)stats->march_lane_slots,
+           (double)stats->shade_material_runs / (double)stats->shade_packets);
+}
+
+// the capture grid is a quarter of the frame size in each direction, with -lod
+// its rays march with the level of detail cone of the full frame
+static int run_bench_kernels(Options const *const options)
+{
+    int const width = options->width / 4 > 0 ? options->width / 4 : 1;
+    int const height = options->height / 4 > 0 ? options->height / 4 : 1;
+    float const cone = options->lod ? scene_lod_cone(options->height) : 0.0f;
+
+    static MicrobenchInputs inputs;
+    int mismatches = 0;
+    if (!microbench_capture(&inputs, width, height, options->timer, cone, &mismatches))
+    {
+        fprintf(stderr, "error: out of memory\n");
+        return 1;
+    }
+
+    printf("inputs from %dx%d camera rays: %d march points, %d hits, %d pixels\n",
+           width, height, inputs.point_count, inputs.hit_count, inputs.pixel_count);
+
+    if (mismatches != 0)
+    {
+        printf("the captured inputs do not reproduce distance_function at %d points\n",
+               mismatches);
+        microbench_inputs_free(&inputs);
+        return 1;
+    }
+
+    MicrobenchResult results[MICROBENCH_FUNCTION_COUNT];
+    microbench_run_all(&inputs, results);
+
+    printf("%d warm-up and %d timed batches, outliers past %.0f mads left out of the mean\n",
+           MICROBENCH_WARMUP_BATCHES, MICROBENCH_BATCHES, MICROBENCH_OUTLIER_MADS);
+    printf("%-22s %8s %10s %9s %8s %9s %8s %9s\n", "function", "calls", "ns/call",
+           "min ns", "mad ns", "mean ns", "outliers", "mcalls/s");
+
+    for (int i = 0; i < MICROBENCH_FUNCTION_COUNT; ++i)
+    {
+        MicrobenchResult const *const result = results + i;
+        printf("%-22s %8d %10.2f %9.2f %8.2f %9.2f %8d %9.2f\n", result->name, result->calls,
+               result->median_ns, result->min_ns, result->mad_ns, result->mean_ns,
+               result->outliers, 1e3 / result->median_ns);
+    }
+
+    bool const written = options->output_path == NULL ||
+                         microbench_write_json(options->output_path, &inputs, results);
+    if (!written)
+    {
+        fprintf(stderr, "error: could not write %s\n", options->output_path);
+    }
+
+    microbench_inputs_free(&inputs);
+    return written ? 0 : 1;
+}
+
+static int run_wavefront(Options const *const options)
+{
+    int const width = options->width;
+    int const height = options->height;
+    size_t const pixel_count = (size_t)width * height;
+    SceneConstants constants = scene_constants(width, height, options->timer);
+    if (options->lod) constants.lod_cone = scene_lod_cone(height);
+
+    GBufferTexel *const reference = malloc(pixel_count * sizeof *reference);
+    GBufferTexel *const gbuffer = malloc(pixel_count * sizeof *gbuffer);
+
+    Wavefront wavefront;
+    if (reference == NULL || gbuffer == NULL || !wavefront_create(&wavefront, width, height))
+    {
+        return 1;
+    }
+
+    double const megakernel_start = runtime_clock_now();
+    scene_trace_rows(&constants, width, height, 0, height, reference);
+    double const megakernel_time = runtime_clock_now() - megakernel_start;
+
+    double const unsorted_start = runtime_clock_now();
+    wavefront_trace_frame(&wavefront, &constants, false, gbuffer);
+    double const unsorted_time = runtime_clock_now() - unsorted_start;
+
+    WavefrontStats const unsorted_stats = wavefront.stats;
+    WavefrontStats const megakernel_stats = wavefront_megakernel_stats(&wavefront);
+    float const unsorted_difference = gbuffer_max_difference(reference, gbuffer, pixel_count);
+
+    wavefront.stats = (WavefrontStats) {0};
+    double const sorted_start = runtime_clock_now();
+    wavefront_trace_frame(&wavefront, &constants, true, gbuffer);
+    double const sorted_time = runtime_clock_now() - sorted_start;
+
+    float const sorted_difference = gbuffer_max_difference(reference, gbuffer, pixel_count);
+
+    printf("%dx%d, %d wide simd packets\n", width, height, WAVEFRONT_SIMD_WIDTH);
+    print_wavefront_stats("megakernel", &megakernel_stats, megakernel_time);
+    print_wavefront_stats("wavefront", &unsorted_stats, unsorted_time);
+    print_wavefront_stats("wavefront sorted", &wavefront.stats, sorted_time);
+    printf("max difference from megakernel: %g unsorted, %g sorted\n",
+           unsorted_difference, sorted_difference);
+
+    wavefront_destroy(&wavefront);
+    free(reference);
+    free(gbuffer);
+
+    return 0;
+}
+
+static double image_rmse(float3 const *const a, float3 const *const b, size_t const count)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        float3 const difference = sub3(a[i], b[i]);
+        sum += dot3(difference, difference);
+    }
+
+    return sqrt(sum / (3.0 * (double)count));
+}
+
+static double psnr_from_rmse(double const rmse)
+{
+    return rmse > 0.0 ? 20.0 * log10(1.0 / rmse) : INFINITY;
+}
+
+static int run_checkerboard(Options const *const options)
+{
+    int const width = options->width;
+    int const height = options->height;
+    size_t const pixel_count = (size_t)width * height;
+
+    GBufferTexel *const reference = malloc(pixel_count * sizeof *reference);
+    GBufferTexel *const history = calloc(pixel_count, sizeof *history);
+    GBufferTexel *const reconstructed = malloc(pixel_count * sizeof *reconstructed);
+    float3 *const reference_output = malloc(pixel_count * sizeof *reference_output);
+    float3 *const output = malloc(pixel_count * sizeof *output);
+
+    if (reference == NULL || history == NULL || reconstructed == NULL ||
+        reference_output == NULL || output == NULL)
+    {
+        return 1;
+    }
+
+    printf("pattern %d, filter %d, fallback %d, %dx%d\n",
+           options->checkerboard.pattern, options->checkerboard.filter,
+           options->checkerboard.fallback, width, height);
+    printf("frame    timer  traced   full ms  checker ms    rmse    psnr\n");
+
+    // only frames that were checkerboarded count, not a full frame fallback
+    double total_full_time = 0.0;
+    double total_checker_time = 0.0;
+    double total_rmse = 0.0;
+    int checkerboard_count = 0;
+    bool history_valid = false;
+
+    for (int frame = 0; frame < options->frame_count; ++frame)
+    {
+        float const timer = options->timer + (float)frame * SEQUENCE_FRAME_TIME;
+        SceneConstants const constants = scene_constants(width, height, timer);
+
+        double const full_start = runtime_clock_now();
+        scene_trace_rows(&constants, width, height, 0, height, reference);
+        post_process_frame(reference, width, height, reference_output);
+        double const full_time = runtime_clock_now() - full_start;
+
+        bool const checkerboarded =
+            checkerboard_frame_pattern(&options->checkerboard, history_valid) != CHECKERBOARD_OFF;
+
+        double const checker_start = runtime_clock_now();
+        int const traced = checkerboard_trace_frame(&options->checkerboard, &constants,
+                                                    width, height, (uint32_t)frame,
+                                                    history_valid, history);
+        checkerboard_reconstruct(&options->checkerboard, width, height, (uint32_t)frame,
+                                 history_valid, history, reconstructed);
+        post_process_frame(reconstructed, width, height, output);
+        double const checker_time = runtime_clock_now() - checker_start;
+
+        history_valid = true;
+
+        double const rmse = image_rmse(reference_output, output, pixel_count);
+        printf("%5d %8.3f %6.1f%% %9.1f %11.1f %7.4f %7.2f\n",
+               frame, timer, 100.0 * traced / (double)pixel_count,
+               full_time * 1e3, checker_time * 1e3, rmse, psnr_from_rmse(rmse));
+
+        if (!checkerboarded) continue;
+
+        total_full_time += full_time;
+        total_checker_time += checker_time;
+        total_rmse += rmse;
+        ++checkerboard_count;
+    }
+
+    if (checkerboard_count > 0)
+    {
+        double const mean_rmse = total_rmse / checkerboard_count;
+        printf("%d checkerboarded frames: mean rmse %.4f (psnr %.2f), "
+               "checkerboard takes %.1f%% of the full frame time\n",
+               checkerboard_count, mean_rmse, psnr_from_rmse(mean_rmse),
+               100.0 * total_checker_time / total_full_time);
+    }
+
+    free(reference);
+    free(history);
+    free(reconstructed);
+    free(reference_output);
+    free(output);
+
+    return 0;
+}
+
+static float degrees_between(float3 const a, float3 const b)
+{
+    return acosf(fminf(fmaxf(dot3(a, b), -1.0f), 1.0f)) * 57.29578f;
+}
+
+// how far the points a frame hit are from the surface at a later time when
+// carried along the analytic motion, and when left where they were
+static void check_scene_motion(SceneConstants const *const constants, GBufferTexel const *const gbuffer,
+                               int const width, int const height, float const to_timer)
+{
+    double moved_error = 0.0;
+    double static_error = 0.0;
+    float moved_max = 0.0f;
+    int hits = 0;
+
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            GBufferTexel const *const texel = gbuffer + (size_t)y * width + x;
+            if (texel->material == GBUFFER_MATERIAL_MISS) continue;
+
+            Ray const ray = look_at_ray(constants, scene_camera_position(),
+                                        scene_camera_look_at(), to_radians(60.0f),
+                                        scene_pixel_coords(x, y, width, height));
+
+            float3 const hit = add3(ray.pos, scale3(ray.dir, texel->depth));
+            float3 const moved = scene_motion(hit, (int)texel->material, constants->timer, to_timer);
+
+            float const error = fabsf(distance_function(moved, to_timer).distance);
+            moved_error += error;
+            moved_max = fmaxf(moved_max, error);
+            static_error += fabsf(distance_function(hit, to_timer).distance);
+            ++hits;
+        }
+    }
+
+    // a frame without hits has no surface to measure
+    if (hits == 0) return;
+
+    printf("surface distance after %.3f s: moved %.5f mean %.5f max, not moved %.5f mean\n",
+           to_timer - constants->timer, moved_error / hits, moved_max, static_error / hits);
+}
+
+// the error of the means of block x block pixel blocks, the path tracer's
+// noise is tied to the pixel and averages out, what is left is the image
+static double image_block_rmse(float3 const *const a, float3 const *const b,
+                               int const width, int const height, int const block)
+{
+    double sum = 0.0;
+    int count = 0;
+
+    for (int y = 0; y + block <= height; y += block)
+    {
+        for (int x = 0; x + block <= width; x += block)
+        {
+            float3 difference = f3s(0.0f);
+            for (int dy = 0; dy < block; ++dy)
+            {
+                for (int dx = 0; dx < block; ++dx)
+                {
+                    size_t const i = (size_t)(y + dy) * width + x + dx;
+                    difference = add3(difference, sub3(saturate3(a[i]), saturate3(b[i])));
+                }
+            }
+
+            difference = scale3(difference, 1.0f / (float)(block * block));
+            sum += dot3(difference, difference);
+            ++count;
+        }
+    }
+
+    return sqrt(sum / (3.0 * (double)count));
+}
+
+// samples of the reference frames the image errors are measured against
+#define CONVERGED_SAMPLES 32
+
+// the colors of a trace with many samples under the normals, depths and
+// materials of gbuffer, so the post filter weights the same as for the traced
+// frame and the difference to it is the sample noise of the traced frame
+static void trace_converged_colors(SceneConstants const *const constants,
+                                   int const width, int const height,
+                                   GBufferTexel const *const gbuffer,
+                                   GBufferTexel *const converged)
+{
+    SceneConstants many_samples = *constants;
+    many_samples.total_samples = CONVERGED_SAMPLES;
+    scene_trace_rows(&many_samples, width, height, 0, height, converged);
+
+    for (size_t i = 0; i < (size_t)width * height; ++i)
+    {
+        converged[i] = (GBufferTexel) {
+            converged[i].color, gbuffer[i].normal, gbuffer[i].depth, gbuffer[i].material,
+        };
+    }
+}
+
+static int run_frame_generation(Options const *const options)
+{
+    int const width = options->width;
+    int const height = options->height;
+    size_t const pixel_count = (size_t)width * height;
+
+    GBufferTexel *const reference = malloc(pixel_count * sizeof *reference);
+    GBufferTexel *const traced[2] = {
+        malloc(pixel_count * sizeof(GBufferTexel)), malloc(pixel_count * sizeof(GBufferTexel)),
+    };
+    GBufferTexel *const generated = malloc(pixel_count * sizeof *generated);
+    GBufferTexel *const converged = malloc(pixel_count * sizeof *converged);
+    float3 *const reference_output = malloc(pixel_count * sizeof *reference_output);
+    float3 *const converged_output = malloc(pixel_count * sizeof *converged_output);
+    float3 *const previous_output = malloc(pixel_count * sizeof *previous_output);
+    float3 *const output = malloc(pixel_count * sizeof *output);
+
+    FrameGenerationSource sources[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        sources[i] = (FrameGenerationSource) {
+            .gbuffer = traced[i],
+            .motion = malloc(pixel_count * sizeof(float2)),
+            .depth = malloc(pixel_count * sizeof(float)),
+        };
+
+        if (traced[i] == NULL || sources[i].motion == NULL || sources[i].depth == NULL) return 1;
+    }
+
+    if (reference == NULL || generated == NULL || converged == NULL ||
+        reference_output == NULL || converged_output == NULL || previous_output == NULL ||
+        output == NULL)
+    {
+        return 1;
+    }
+
+    printf("%d frames of %dx%d, every other one traced\n", options->frame_count, width, height);
+    printf("psnr against a %d sample reference, the traced frame's is its sample noise\n",
+           CONVERGED_SAMPLES);
+    printf("frame    timer  traced ms  generated ms    psnr  traced psnr  repeat psnr   newer   older  filled\n");
+
+    double total_trace_time = 0.0;
+    double total_generate_time = 0.0;
+    double total_rmse = 0.0;
+    double total_traced_rmse = 0.0;
+    double total_repeat_rmse = 0.0;
+    int generated_count = 0;
+
+    for (int frame = 0; frame < options->frame_count; ++frame)
+    {
+        float const timer = options->timer + (float)frame * SEQUENCE_FRAME_TIME;
+        SceneConstants const constants = scene_constants(width, height, timer);
+
+        // every frame is traced for reference, the even ones are what the generator gets
+        double const trace_start = runtime_clock_now();
+        scene_trace_rows(&constants, width, height, 0, height, reference);
+        double const trace_time = runtime_clock_now() - trace_start;
+        total_trace_time += trace_time;
+
+        post_process_frame(reference, width, height, reference_output);
+
+        if (frame % 2 == 0)
+        {
+            int const newest = (frame / 2) % 2;
+            memcpy(traced[newest], reference, pixel_count * sizeof *reference);
+            sources[newest].timer = timer;
+
+            memcpy(previous_output, reference_output, pixel_count * sizeof *reference_output);
+            printf("%5d %8.3f %10.1f\n", frame, timer, trace_time * 1e3);
+
+            if (frame == 0)
+            {
+                check_scene_motion(&constants, reference, width, height,
+                                   timer + SEQUENCE_FRAME_TIME);
+            }
+            continue;
+        }
+
+        int const newer = ((frame - 1) / 2) % 2;
+        FrameGenerationStats stats = {0};
+
+        double const generate_start = runtime_clock_now();
+        frame_generation_generate(&constants, width, height, sources + newer,
+                                  frame >= 3 ? sources + (newer ^ 1) : NULL, generated, &stats);
+        double const generate_time = runtime_clock_now() - generate_start;
+
+        post_process_frame(generated, width, height, output);
+
+        trace_converged_colors(&constants, width, height, reference, converged);
+        post_process_frame(converged, width, height, converged_output);
+
+        double const rmse = image_rmse(converged_output, output, pixel_count);
+        double const traced_rmse = image_rmse(converged_output, reference_output, pixel_count);
+        double const repeat_rmse = image_rmse(converged_output, previous_output, pixel_count);
+
+        printf("%5d %8.3f %10.1f %13.1f %7.2f %12.2f %12.2f %6.2f%% %6.2f%% %6.2f%%\n",
+               frame, timer, trace_time * 1e3, generate_time * 1e3,
+               psnr_from_rmse(rmse), psnr_from_rmse(traced_rmse), psnr_from_rmse(repeat_rmse),
+               100.0 * stats.from_newer / (double)pixel_count,
+               100.0 * stats.from_older / (double)pixel_count,
+               100.0 * stats.filled / (double)pixel_count);
+
+        total_generate_time += generate_time;
+        total_rmse += rmse;
+        total_traced_rmse += traced_rmse;
+        total_repeat_rmse += repeat_rmse;
+        ++generated_count;
+    }
+
+    if (generated_count > 0)
+    {
+        double const trace_time = total_trace_time / options->frame_count;
+        double const generate_time = total_generate_time / generated_count;
+
+        printf("mean psnr: generated %.2f, traced %.2f, repeating the last traced frame %.2f\n",
+               psnr_from_rmse(total_rmse / generated_count),
+               psnr_from_rmse(total_traced_rmse / generated_count),
+               psnr_from_rmse(total_repeat_rmse / generated_count));
+        printf("a generated frame takes %.2f%% of a traced one, two displayed frames %.1f%%\n",
+               100.0 * generate_time / trace_time,
+               100.0 * (trace_time + generate_time) / (2.0 * trace_time));
+    }
+
+    free(reference);
+    free(generated);
+    free(converged);
+    free(reference_output);
+    free(converged_output);
+    free(previous_output);
+    free(output);
+    for (int i = 0; i < 2; ++i)
+    {
+        free(traced[i]);
+        free(sources[i].motion);
+        free(sources[i].depth);
+    }
+
+    return 0;
+}
+
+// march steps of the primary rays and of the bounces of the last wavefront frame
+typedef struct
+{
+    uint64_t steps[2];
+    uint64_t rays[2];
+} LodSteps;
+
+static LodSteps lod_steps(Wavefront const *const wavefront)
+{
+    LodSteps result = {0};
+    for (int sample = 0; sample < SCENE_TOTAL_SAMPLES; ++sample)
+    {
+        for (int bounce = 0; bounce < SCENE_MAX_BOUNCES; ++bounce)
+        {
+            size_t const base = wavefront_log_index(wavefront, sample, bounce, 0);
+            for (int pixel = 0; pixel < wavefront->pixel_count; ++pixel)
+            {
+                int const steps = wavefront->step_log[base + pixel];
+                if (steps < 0) continue;
+
+                result.steps[bounce > 0] += (uint64_t)steps;
+                ++result.rays[bounce > 0];
+            }
+        }
+    }
+
+    return result;
+}
+
+static double lod_trace_frame(SceneConstants const *const constants, Wavefront *const wavefront,
+                              GBufferTexel *const gbuffer, LodSteps *const steps)
+{
+    int const width = wavefront->width;
+    int const height = wavefront->height;
+
+    double const start = runtime_clock_now();
+    scene_trace_rows(constants, width, height, 0, height, gbuffer);
+    double const time = runtime_clock_now() - start;
+
+    // the wavefront tracer matches the megakernel and logs the steps of every ray
+    wavefront_trace_frame(wavefront, constants, false, gbuffer);
+    *steps = lod_steps(wavefront);
+
+    return time;
+}
+
+#define LOD_BLOCK 4
+
+static int run_bench_lod(Options const *const options)
+{
+    int const width = options->width;
+    int const height = options->height;
+    size_t const pixel_count = (size_t)width * height;
+
+    GBufferTexel *const full = malloc(pixel_count * sizeof *full);
+    GBufferTexel *const lod = malloc(pixel_count * sizeof *lod);
+    float3 *const full_output = malloc(pixel_count * sizeof *full_output);
+    float3 *const lod_output = malloc(pixel_count * sizeof *lod_output);
+
+    // wavefront_destroy frees whatever a failed wavefront_create got
+    Wavefront wavefront;
+    bool const created = wavefront_create(&wavefront, width, height);
+    if (full == NULL || lod == NULL || full_output == NULL || lod_output == NULL || !created)
+    {
+        wavefront_destroy(&wavefront);
+        free(full);
+        free(lod);
+        free(full_output);
+        free(lod_output);
+        return 1;
+    }
+
+    // the distances at which the epsilon leaves SCENE_MIN_DISTANCE
+    float const cone = scene_lod_cone(height);
+    float const primary_epsilon = cone * SCENE_MAX_DISTANCE;
+    float const bounce_epsilon = primary_epsilon * SCENE_LOD_BOUNCE_SCALE;
+
+    printf("%d frames of %dx%d, cone %.6f per unit, bounces x%.0f\n", options->frame_count,
+           width, height, cone, SCENE_LOD_BOUNCE_SCALE);
+    printf("epsilon at %.0f units: primary %.5f, bounce %.5f (min distance %.3f)\n",
+           SCENE_MAX_DISTANCE, primary_epsilon, bounce_epsilon, SCENE_MIN_DISTANCE);
+    printf("it loosens past %.2f units on primary rays and %.2f on bounces\n",
+           SCENE_MIN_DISTANCE / cone, SCENE_MIN_DISTANCE / (cone * SCENE_LOD_BOUNCE_SCALE));
+    printf("steps per ray, psnr per pixel and of %dx%d block means, against full detail\n",
+           LOD_BLOCK, LOD_BLOCK);
+    printf("frame    timer  full ms   lod ms  primary   lod  bounce   lod    psnr   block  material\n");
+
+    double total_time[2] = {0.0, 0.0};
+    LodSteps total_steps[2] = {0};
+    double total_rmse = 0.0;
+    double total_block_rmse = 0.0;
+
+    for (int frame = 0; frame < options->frame_count; ++frame)
+    {
+        float const timer = options->timer + (float)frame * SEQUENCE_FRAME_TIME;
+        SceneConstants constants = scene_constants(width, height, timer);
+
+        LodSteps steps[2];
+        constants.lod_cone = cone;
+        double const lod_time = lod_trace_frame(&constants, &wavefront, lod, steps + 1);
+        constants.lod_cone = 0.0f;
+        double const full_time = lod_trace_frame(&constants, &wavefront, full, steps + 0);
+
+        post_process_frame(full, width, height, full_output);
+        post_process_frame(lod, width, height, lod_output);
+
+        double const rmse = image_rmse(full_output, lod_output, pixel_count);
+        double const block_rmse = image_block_rmse(full_output, lod_output, width, height,
+                                                   LOD_BLOCK);
+
+        // pixels whose first hit changed object, where the bounds or the epsilon moved a silhouette
+        size_t material_changes = 0;
+        for (size_t i = 0; i < pixel_count; ++i)
+        {
+            material_changes += full[i].material != lod[i].material;
+        }
+
+        printf("%5d %8.3f %8.1f %8.1f %8.2f %5.2f %7.2f %5.2f %7.2f %7.2f %8.3f%%\n",
+               frame, timer, full_time * 1e3, lod_time * 1e3,
+               (double)steps[0].steps[0] / (double)steps[0].rays[0],
+               (double)steps[1].steps[0] / (double)steps[1].rays[0],
+               (double)steps[0].steps[1] / (double)steps[0].rays[1],
+               (double)steps[1].steps[1] / (double)steps[1].rays[1],
+               psnr_from_rmse(rmse), psnr_from_rmse(block_rmse),
+               100.0 * (double)material_changes / (double)pixel_count);
+
+        for (int i = 0; i < 2; ++i)
+        {
+            total_time[i] += i == 0 ? full_time : lod_time;
+            for (int bounce = 0; bounce < 2; ++bounce)
+            {
+                total_steps[i].steps[bounce] += steps[i].steps[bounce];
+                total_steps[i].rays[bounce] += steps[i].rays[bounce];
+            }
+        }
+
+        total_rmse += rmse;
+        total_block_rmse += block_rmse;
+    }
+
+    uint64_t const full_steps = total_steps[0].steps[0] + total_steps[0].steps[1];
+    uint64_t const lod_steps_total = total_steps[1].steps[0] + total_steps[1].steps[1];
+
+    printf("steps saved: %.1f%% primary, %.1f%% bounce, %.1f%% total\n",
+           100.0 - 100.0 * (double)total_steps[1].steps[0] / (double)total_steps[0].steps[0],
+           100.0 - 100.0 * (double)total_steps[1].steps[1] / (double)total_steps[0].steps[1],
+           100.0 - 100.0 * (double)lod_steps_total / (double)full_steps);
+    printf("trace time saved: %.1f%%, mean psnr %.2f (blocks %.2f)\n",
+           100.0 - 100.0 * total_time[1] / total_time[0],
+           psnr_from_rmse(total_rmse / options->frame_count),
+           psnr_from_rmse(total_block_rmse / options->frame_count));
+
+    wavefront_destroy(&wavefront);
+    free(full);
+    free(lod);
+    free(full_output);
+    free(lod_output);
+
+    return 0;
+}
+
+// the limits -gbuffer checks the round trip against: half a step of the 8 bit
+// octahedral grid, half a depth step and half a step of the 5 bit mantissa of
+// the blue channel
+#define GBUFFER_MAX_NORMAL_DEGREES 1.0f
+#define GBUFFER_MAX_DEPTH_ERROR (GBUFFER_MAX_DEPTH / (float)((1 << GBUFFER_DEPTH_BITS) - 1) * 0.5f + 1e-5f)
+#define GBUFFER_MAX_COLOR_ERROR (1.0f / 64.0f + 1e-5f)
+
+// post_ps_main before the compact g-buffer as near as it can be rebuilt: the
+// normal target held the normal clamped to [0, 1] and divided by the sample
+// count, a miss stored 0 and there was no depth weight
+static float3 legacy_post_normal(GBufferTexel const *const texel)
+{
+    if (texel->material == GBUFFER_MATERIAL_MISS) return f3s(0.0f);
+    return scale3(saturate3(texel->normal), 1.0f / (float)SCENE_TOTAL_SAMPLES);
+}
+
+static float3 legacy_post_pixel(GBufferTexel const *const gbuffer,
+                                int const width, int const height, int const x, int const y)
+{
+    GBufferTexel const *const center = gbuffer_fetch(gbuffer, width, height, x, y);
+    float3 const center_normal = legacy_post_normal(center);
+
+    float3 sum = f3s(0.0f);
+    float total_weight = 0.0f;
+
+    for (int dy = -SCENE_POST_RADIUS; dy <= SCENE_POST_RADIUS; ++dy)
+    {
+        for (int dx = -SCENE_POST_RADIUS; dx <= SCENE_POST_RADIUS; ++dx)
+        {
+            GBufferTexel const *const sample = gbuffer_fetch(gbuffer, width, height,
+                                                             x + dx, y + dy);
+
+            float3 const color_difference = sub3(center->color, sample->color);
+            float3 const normal_difference = sub3(center_normal, legacy_post_normal(sample));
+            float const weight =
+                fminf(expf(-dot3(color_difference, color_difference)), 1.0f) *
+                fminf(expf(-dot3(normal_difference, normal_difference) * 2.0f), 1.0f) *
+                scene_post_kernel[dx + SCENE_POST_RADIUS] *
+                scene_post_kernel[dy + SCENE_POST_RADIUS];
+
+            sum = add3(sum, scale3(sample->color, weight));
+            total_weight += weight;
+        }
+    }
+
+    return scene_tonemap(scale3(sum, 1.0f / total_weight));
+}
+
+// the psnr of the filtered frame and of the legacy filter against the
+// tonemapped colors of a converged trace, the signed normal and depth must
+// stop at edges at least as well as the clamped normal did
+static void check_post_filter(RuntimeTest *const test, SceneConstants const *const constants,
+                              int const width, int const height,
+                              GBufferTexel const *const gbuffer)
+{
+    size_t const pixel_count = (size_t)width * height;
+    GBufferTexel *const converged = malloc(pixel_count * sizeof *converged);
+    float3 *const reference = malloc(pixel_count * sizeof *reference);
+    float3 *const filtered = malloc(pixel_count * sizeof *filtered);
+    float3 *const legacy = malloc(pixel_count * sizeof *legacy);
+
+    if (converged == NULL || reference == NULL || filtered == NULL || legacy == NULL)
+    {
+        runtime_check(test, false, "post filter buffers");
+    }
+    else
+    {
+        trace_converged_colors(constants, width, height, gbuffer, converged);
+        post_process_frame(gbuffer, width, height, filtered);
+
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                size_t const i = (size_t)y * width + x;
+                reference[i] = scene_tonemap(converged[i].color);
+                legacy[i] = legacy_post_pixel(gbuffer, width, height, x, y);
+            }
+        }
+
+        double const filtered_psnr = psnr_from_rmse(image_rmse(reference, filtered, pixel_count));
+        double const legacy_psnr = psnr_from_rmse(image_rmse(reference, legacy, pixel_count));
+
+        printf("post filter against %d samples: psnr %.2f, clamped normal filter %.2f\n",
+               CONVERGED_SAMPLES, filtered_psnr, legacy_psnr);
+        runtime_check(test, filtered_psnr >= legacy_psnr, "post filter worse than the clamped one");
+    }
+
+    free(converged);
+    free(reference);
+    free(filtered);
+    free(legacy);
+}
+
+static int run_gbuffer(Options const *const options)
+{
+    // normals spread evenly over the sphere with a fibonacci spiral
+    int const normal_count = 1 << 20;
+    double angle_sum = 0.0;
+    float angle_max = 0.0f;
+
+    for (int i = 0; i < normal_count; ++i)
+    {
+        float const z = 1.0f - 2.0f * ((float)i + 0.5f) / (float)normal_count;
+        float const radius = sqrtf(1.0f - z * z);
+        float const phi = (float)i * 2.39996323f;
+        float3 const normal = f3(radius * cosf(phi), radius * sinf(phi), z);
+
+        float const angle = degrees_between(normal, decode_octahedral_normal(
+                                                        encode_octahedral_normal(normal)));
+        angle_sum += angle;
+        angle_max = fmaxf(angle_max, angle);
+    }
+
+    float depth_max = 0.0f;
+    int material_errors = 0;
+    for (int i = 0; i <= 100000; ++i)
+    {
+        float const depth = GBUFFER_MAX_DEPTH * (float)i / 100000.0f;
+        int const material = i % (GBUFFER_MATERIAL_MISS + 1);
+
+        float3 normal;
+        float decoded_depth;
+        int decoded_material;
+        unpack_gbuffer(pack_gbuffer(f3(0, 1, 0), depth, material),
+                       &normal, &decoded_depth, &decoded_material);
+
+        depth_max = fmaxf(depth_max, fabsf(decoded_depth - depth));
+        material_errors += decoded_material != material;
+    }
+
+    // colors over the range the scene produces and well past it
+    double relative_sum = 0.0;
+    float relative_max = 0.0f;
+    int color_count = 0;
+    for (float value = 1.0f / 1024.0f; value < 64.0f; value *= 1.001f, ++color_count)
+    {
+        float3 const decoded = decode_r11g11b10(encode_r11g11b10(f3s(value)));
+        float const relative = fmaxf(fmaxf(fabsf(decoded.x - value), fabsf(decoded.y - value)),
+                                     fabsf(decoded.z - value)) / value;
+        relative_sum += relative;
+        relative_max = fmaxf(relative_max, relative);
+    }
+
+    printf("normal: %d directions, mean %.3f deg, max %.3f deg\n",
+           normal_count, angle_sum / normal_count, angle_max);
+    printf("depth:  max error %.5f over [0, %g]\n", depth_max, GBUFFER_MAX_DEPTH);
+    printf("material: %d round trip errors\n", material_errors);
+    printf("color:  %d values, mean relative error %.4f%%, max %.4f%%\n",
+           color_count, 100.0 * relative_sum / color_count, 100.0 * relative_max);
+
+    // how the traced frame changes when stored in the compact layout
+    int const width = options->width;
+    int const height = options->height;
+    size_t const pixel_count = (size_t)width * height;
+    SceneConstants const constants = scene_constants(width, height, options->timer);
+
+    GBufferTexel *const gbuffer = malloc(pixel_count * sizeof *gbuffer);
+    if (gbuffer == NULL) return 1;
+
+    scene_trace_rows(&constants, width, height, 0, height, gbuffer);
+
+    double frame_angle_sum = 0.0;
+    float frame_angle_max = 0.0f;
+    for (size_t i = 0; i < pixel_count; ++i)
+    {
+        float const angle = degrees_between(gbuffer[i].normal,
+                                            gbuffer_quantize(gbuffer[i]).normal);
+        frame_angle_sum += angle;
+        frame_angle_max = fmaxf(frame_angle_max, angle);
+    }
+
+    printf("frame %dx%d: %zu bytes per texel, normal re-encode mean %.3f deg, max %.3f deg\n",
+           width, height, sizeof(CompactTexel), frame_angle_sum / pixel_count, frame_angle_max);
+
+    RuntimeTest test = {0};
+    runtime_check(&test, angle_max <= GBUFFER_MAX_NORMAL_DEGREES, "normal round trip error");
+    runtime_check(&test, frame_angle_max <= GBUFFER_MAX_NORMAL_DEGREES, "frame normal error");
+    runtime_check(&test, depth_max <= GBUFFER_MAX_DEPTH_ERROR, "depth round trip error");
+    runtime_check(&test, material_errors == 0, "material round trip");
+    runtime_check(&test, relative_max <= GBUFFER_MAX_COLOR_ERROR, "color round trip error");
+    check_post_filter(&test, &constants, width, height, gbuffer);
+
+    free(gbuffer);
+    return runtime_report(&test);
+}
+
+static uint32_t xorshift32(uint32_t *const state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int64_t random_ticks(uint32_t *const state, int64_t const min, int64_t const max)
+{
+    return min + (int64_t)(xorshift32(state) % (uint32_t)(max - min + 1));
+}
+
+typedef struct
+{
+    char const *name;
+    FramePacingSettings settings;
+    bool is_preview;
+    bool on_battery;
+    int64_t render_min;     // microseconds of gpu/cpu work per frame
+    int64_t render_max;
+    int64_t wake_latency;   // worst case lateness of a timer wake up
+    uint32_t cap_fps;       // the rate the settings should hold it to, 0 for none
+} PacingScenario;
+
+// achieved fps may miss the cap by this much, from timer wake up lateness
+#define PACING_FPS_TOLERANCE 0.015
+
+// runs the policy against a simulated microsecond clock for ten seconds
+static void simulate_pacing(PacingScenario const *const scenario, RuntimeTest *const test)
+{
+    int64_t const ticks_per_second = 1000000;
+    int64_t const refresh_interval = ticks_per_second / 60;
+    int64_t const duration = 10 * ticks_per_second;
+
+    FramePacer pacer;
+    frame_pacer_init(&pacer, scenario->settings, ticks_per_second, scenario->is_preview, 0);
+
+    uint32_t random_state = 0x9e3779b9;
+    int64_t now = 0;
+    int64_t busy = 0;
+
+    while (now < duration)
+    {
+        if (frame_pacer_should_poll_power(&pacer, now))
+        {
+            frame_pacer_set_power_source(&pacer, scenario->on_battery ?
+                                                 POWER_SOURCE_BATTERY : POWER_SOURCE_AC);
+        }
+
+        int64_t const wait = frame_pacer_wait_ticks(&pacer, now);
+        if (wait > 0)
+        {
+            now += wait + random_ticks(&random_state, 0, scenario->wake_latency);
+        }
+
+        frame_pacer_frame_started(&pacer, now);
+
+        int64_t const render = random_ticks(&random_state, scenario->render_min,
+                                            scenario->render_max);
+        now += render;
+        busy += render;
+
+        // with vsync Present holds the thread until the next vertical blank
+        if (frame_pacer_sync_interval(&pacer) != 0)
+        {
+            now = (now + refresh_interval - 1) / refresh_interval * refresh_interval;
+        }
+    }
+
+    FramePacingStats const stats = frame_pacer_stats(&pacer);
+    double const fps = (double)stats.interval_count * ticks_per_second / (double)now;
+    printf("%-26s %7.1f %9lld %9lld %7.1f%%\n", scenario->name, fps,
+           (long long)stats.mean_jitter, (long long)stats.max_jitter,
+           100.0 * (double)busy / (double)now);
+
+    // frames slower than the cap can only run as fast as they render
+    double const render_fps = (double)ticks_per_second / (double)scenario->render_max;
+    double const floor_fps = scenario->cap_fps == 0 ? render_fps :
+                             fmin((double)scenario->cap_fps, render_fps);
+
+    char what[96];
+    snprintf(what, sizeof what, "%s: %.1f fps is below %.1f", scenario->name, fps, floor_fps);
+    runtime_check(test, fps >= floor_fps * (1.0 - PACING_FPS_TOLERANCE), what);
+
+    if (scenario->cap_fps != 0)
+    {
+        snprintf(what, sizeof what, "%s: %.1f fps is over the %u fps cap",
+                 scenario->name, fps, scenario->cap_fps);
+        runtime_check(test, fps <= (double)scenario->cap_fps * (1.0 + PACING_FPS_TOLERANCE), what);
+    }
+    else
+    {
+        // render times vary, nothing evens the intervals out
+        snprintf(what, sizeof what, "%s: no jitter without a cap", scenario->name);
+        runtime_check(test, stats.mean_jitter > 0, what);
+    }
+}
+
+static int run_pacing(void)
+{
+    FramePacingSettings const defaults = {
+        .target_fps = 60, .preview_fps = 15, .battery_fps = 10, .vsync = true,
+    };
+
+    FramePacingSettings no_vsync = defaults;
+    no_vsync.vsync = false;
+
+    FramePacingSettings uncapped = no_vsync;
+    uncapped.target_fps = 0;
+
+    FramePacingSettings capped_30 = no_vsync;
+    capped_30.target_fps = 30;
+
+    PacingScenario const scenarios[] = {
+        {"uncapped, no vsync", uncapped, false, false, 3000, 6000, 0, 0},
+        {"60 fps + vsync", defaults, false, false, 3000, 6000, 500, 60},
+        {"60 fps, no vsync", no_vsync, false, false, 3000, 6000, 500, 60},
+        {"30 fps, no vsync", capped_30, false, false, 3000, 6000, 500, 30},
+        {"30 fps, coarse timer", capped_30, false, false, 3000, 6000, 15600, 30},
+        {"preview", defaults, true, false, 500, 1000, 500, 15},
+        {"battery", defaults, false, true, 3000, 6000, 500, 10},
+        {"60 fps, slow frames", no_vsync, false, false, 12000, 24000, 500, 60},
+    };
+
+    RuntimeTest test = {0};
+
+    printf("%-26s %7s %9s %9s %8s\n", "scenario", "fps", "jitter us", "max us", "busy");
+    for (size_t i = 0; i < sizeof scenarios / sizeof *scenarios; ++i)
+    {
+        simulate_pacing(scenarios + i, &test);
+    }
+
+    return runtime_report(&test);
+}
+
+static int run_pipeline(Options const *const options)
+{
+    FILE *output = NULL;
+    if (options->output_path != NULL)
+    {
+        output = fopen(options->output_path, "wb");
+        if (output == NULL)
+        {
+            fprintf(stderr, "error: could not open %s\n", options->output_path);
+            return 1;
+        }
+    }
+
+    int const first_depth = options->pipeline_depth != 0 ? options->pipeline_depth : 1;
+    int const last_depth = options->pipeline_depth != 0 ? options->pipeline_depth : 4;
+
+    printf("%d frames of %dx%d\n", options->frame_count, options->width, options->height);
+    printf("%5s %7s %10s %10s", "depth", "fps", "latency ms", "max ms");
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; ++i)
+    {
+        printf(" %8s", pipeline_stage_names[i]);
+    }
+    printf(" %16s\n", "checksum");
+
+    for (int depth = first_depth; depth <= last_depth; ++depth)
+    {
+        // only the first run writes the frames
+        PipelineStats stats;
+        if (!pipeline_run(options->width, options->height, depth, options->frame_count,
+                          SEQUENCE_FRAME_TIME, depth == first_depth ? output : NULL, &stats))
+        {
+            fprintf(stderr, "error: out of memory\n");
+            return 1;
+        }
+
+        printf("%5d %7.2f %10.1f %10.1f", depth,
+               (double)stats.frame_count / stats.seconds,
+               stats.mean_latency * 1000.0, stats.max_latency * 1000.0);
+
+        // utilization: the share of the run a stage spent working
+        for (int i = 0; i < PIPELINE_STAGE_COUNT; ++i)
+        {
+            printf(" %7.1f%%", 100.0 * stats.stages[i].busy / stats.seconds);
+        }
+
+        printf(" %016llx\n", (unsigned long long)stats.checksum);
+    }
+
+    if (output != NULL && fclose(output) != 0)
+    {
+        fprintf(stderr, "error: could not write %s\n", options->output_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+static StillFormat still_format_from_path(char const *const path)
+{
+    char const *const extension = strrchr(path, '.');
+    bool const is_tiff = extension != NULL &&
+                         (strcmp(extension, ".tif") == 0 || strcmp(extension, ".tiff") == 0);
+
+    return is_tiff ? STILL_FORMAT_TIFF : STILL_FORMAT_PPM;
+}
+
+static double peak_rss_megabytes(struct rusage const *const usage)
+{
+    // kilobytes on linux
+    return (double)usage->ru_maxrss / 1024.0;
+}
+
+// what -render keeps in memory: the g-buffer, the filtered frame and the output bytes
+static double full_frame_megabytes(int const width, int const height)
+{
+    return (double)width * height * (sizeof(GBufferTexel) + sizeof(float3) + 3) /
+           (1024.0 * 1024.0);
+}
+
+static int run_still(Options const *const options)
+{
+    StillStats stats;
+    if (!still_render(options->output_path, still_format_from_path(options->output_path),
+                      options->width, options->height, options->timer,
+                      options->tile_size, &stats))
+    {
+        return 1;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%dx%d in %d tiles: %.2f s, %.3f mpixel/s, %.1f mb written, "
+           "peak rss %.1f mb (full frame buffers %.1f mb)\n",
+           options->width, options->height, stats.tile_count, stats.seconds,
+           (double)options->width * options->height / stats.seconds * 1e-6,
+           (double)stats.file_size / (1024.0 * 1024.0),
+           peak_rss_megabytes(&usage), full_frame_megabytes(options->width, options->height));
+
+    return 0;
+}
+
+// each size renders in its own process so its peak rss can be measured alone
+static int run_bench_still(Options const *const options)
+{
+    int const sizes[][2] = {{320, 180}, {640, 360}, {1280, 720}};
+    char const *const path = "/tmp/cpu_render_still.tif";
+
+    printf("tiles of %dx%d, tiff output\n", options->tile_size, options->tile_size);
+    printf("%-10s %6s %8s %9s %8s %11s %14s\n", "size", "tiles", "seconds", "mpixel/s",
+           "mb/s", "peak rss mb", "full frame mb");
+
+    for (size_t i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+    {
+        int const width = sizes[i][0];
+        int const height = sizes[i][1];
+
+        // the child would print whatever is still buffered again
+        fflush(stdout);
+
+        pid_t const pid = fork();
+        if (pid == 0)
+        {
+            StillStats stats;
+            bool const success = still_render(path, STILL_FORMAT_TIFF, width, height,
+                                              options->timer, options->tile_size, &stats);
+
+            printf("%4dx%-5d %6d %8.2f %9.3f %8.3f", width, height, stats.tile_count,
+                   stats.seconds, (double)width * height / stats.seconds * 1e-6,
+                   (double)stats.file_size / stats.seconds / (1024.0 * 1024.0));
+            fflush(stdout);
+            _exit(success ? 0 : 1);
+        }
+
+        int status;
+        struct rusage usage;
+        if (pid < 0 || wait4(pid, &status, 0, &usage) != pid ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "\nerror: rendering %dx%d failed\n", width, height);
+            return 1;
+        }
+
+        printf(" %11.1f %14.1f\n", peak_rss_megabytes(&usage),
+               full_frame_megabytes(width, height));
+    }
+
+    remove(path);
+    return 0;
+}
+
+typedef bool (*ScanlineRenderer)(int width, int height, float timer, int thread_count,
+                                 unsigned char *rgb);
+
+#define CACHE_LINE_BYTES 64
+
+// counts the last level cache misses of this process and of the threads it
+// starts from now on, -1 when the kernel or the machine doesn't allow it
+static int llc_miss_counter_open(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attributes = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof attributes,
+        .config = PERF_COUNT_HW_CACHE_MISSES,
+        .disabled = 1,
+        .inherit = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+
+    int const counter = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+    if (counter >= 0) ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    return counter;
+#else
+    return -1;
+#endif
+}
+
+// stops the counter and returns the misses, threads count once they are joined
+static uint64_t llc_miss_counter_close(int const counter)
+{
+    uint64_t misses = 0;
+#ifdef __linux__
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter, &misses, sizeof misses) != sizeof misses) misses = 0;
+#endif
+    close(counter);
+    return misses;
+}
+
+// renders frame_count frames with render, returns the seconds per frame or a
+// negative value on failure. the checksum covers every frame, misses_per_frame
+// is -1 when there is no llc miss counter
+static double time_scanline_renderer(Options const *const options, ScanlineRenderer const render,
+                                     int const thread_count, unsigned char *const rgb,
+                                     uint64_t *const checksum, double *const misses_per_frame)
+{
+    size_t const frame_bytes = (size_t)options->width * options->height * 3;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    int const counter = llc_miss_counter_open();
+    double const start = runtime_clock_now();
+    for (int frame = 0; frame < options->frame_count; ++frame)
+    {
+        if (!render(options->width, options->height, (float)frame * SEQUENCE_FRAME_TIME,
+                    thread_count, rgb))
+        {
+            if (counter >= 0) close(counter);
+            return -1.0;
+        }
+
+        for (size_t i = 0; i < frame_bytes; ++i)
+        {
+            hash = (hash ^ rgb[i]) * 0x100000001b3ULL;
+        }
+    }
+
+    double const seconds = runtime_clock_now() - start;
+    *checksum = hash;
+    *misses_per_frame = counter < 0 ? -1.0 :
+                        (double)llc_miss_counter_close(counter) / (double)options->frame_count;
+
+    return seconds / (double)options->frame_count;
+}
+
+// without a miss counter the traffic is modelled from the g-buffer working
+// set: one that fits in the l2 cache of the filter thread is assumed to cost
+// nothing past it, a larger one is written out by the tracer and read back
+// once by the filter. this is a model, not a measurement
+static double modelled_traffic_megabytes(size_t const working_set, long const cache_size)
+{
+    if (cache_size > 0 && working_set <= (size_t)cache_size) return 0.0;
+    return 2.0 * (double)working_set / (1024.0 * 1024.0);
+}
+
+static double traffic_megabytes(double const misses_per_frame, size_t const working_set,
+                                long const cache_size)
+{
+    if (misses_per_frame < 0.0) return modelled_traffic_megabytes(working_set, cache_size);
+    return misses_per_frame * CACHE_LINE_BYTES / (1024.0 * 1024.0);
+}
+
+static int run_scanline(Options const *const options)
+{
+    long const online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count = options->thread_count != 0 ? options->thread_count :
+                       online_cpus > 0 ? (int)online_cpus : 1;
+    if (thread_count > SCANLINE_MAX_THREADS) thread_count = SCANLINE_MAX_THREADS;
+
+    long cache_size = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+
+    size_t const row_bytes = (size_t)options->width * sizeof(GBufferTexel);
+    size_t const full_bytes = row_bytes * (size_t)options->height;
+    size_t const ring_bytes = row_bytes * (size_t)scanline_ring_rows(thread_count);
+
+    unsigned char *const full_rgb = malloc((size_t)options->width * options->height * 3);
+    unsigned char *const streaming_rgb = malloc((size_t)options->width * options->height * 3);
+    if (full_rgb == NULL || streaming_rgb == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        free(full_rgb);
+        free(streaming_rgb);
+        return 1;
+    }
+
+    uint64_t full_checksum = 0;
+    uint64_t streaming_checksum = 0;
+    double full_misses = -1.0;
+    double streaming_misses = -1.0;
+    double const full_seconds = time_scanline_renderer(options, &scanline_render_full,
+                                                       thread_count, full_rgb, &full_checksum,
+                                                       &full_misses);
+    double const streaming_seconds = time_scanline_renderer(options, &scanline_render_streaming,
+                                                            thread_count, streaming_rgb,
+                                                            &streaming_checksum,
+                                                            &streaming_misses);
+
+    free(full_rgb);
+    free(streaming_rgb);
+
+    if (full_seconds < 0.0 || streaming_seconds < 0.0)
+    {
+        fprintf(stderr, "error: could not allocate the g-buffer or start the trace threads\n");
+        return 1;
+    }
+
+    printf("%d frames of %dx%d, %d trace threads, l2 cache %.1f mb\n",
+           options->frame_count, options->width, options->height, thread_count,
+           (double)cache_size / (1024.0 * 1024.0));
+    // both runs either have the counter or not
+    bool const measured = full_misses >= 0.0 && streaming_misses >= 0.0;
+    if (!measured) full_misses = streaming_misses = -1.0;
+
+    printf("%-10s %9s %13s %21s %16s\n", "render", "ms/frame", "g-buffer kb",
+           measured ? "llc miss mb/frame" : "model mb/frame > l2", "checksum");
+    printf("%-10s %9.1f %13.1f %21.2f %016llx\n", "two pass", full_seconds * 1000.0,
+           (double)full_bytes / 1024.0, traffic_megabytes(full_misses, full_bytes, cache_size),
+           (unsigned long long)full_checksum);
+    printf("%-10s %9.1f %13.1f %21.2f %016llx\n", "streaming", streaming_seconds * 1000.0,
+           (double)ring_bytes / 1024.0,
+           traffic_megabytes(streaming_misses, ring_bytes, cache_size),
+           (unsigned long long)streaming_checksum);
+
+    if (!measured)
+    {
+        printf("no llc miss counter (perf_event_open), the traffic column is modelled "
+               "from the g-buffer size\n");
+    }
+
+    if (full_checksum != streaming_checksum)
+    {
+        printf("the streaming frames differ from the two pass frames\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+// renders the sequence with worker_count forked workers, fail_after > 0
+// makes the first worker die after that many jobs
+static bool render_distributed(Options const *const options, int const worker_count,
+                               int const fail_after, FILE *const output,
+                               DistributedStats *const stats)
+{
+    int port = 0;
+    int const listener = distributed_listen(&port);
+    if (listener < 0)
+    {
+        fprintf(stderr, "error: could not listen on the loopback interface\n");
+        return false;
+    }
+
+    pid_t workers[DISTRIBUTED_MAX_WORKERS];
+    int spawned = 0;
+    for (; spawned < worker_count; ++spawned)
+    {
+        workers[spawned] = distributed_spawn_worker(port, spawned == 0 ? fail_after : 0);
+        if (workers[spawned] < 0) break;
+    }
+
+    DistributedSettings const settings = {
+        .width = options->width,
+        .height = options->height,
+        .frame_count = options->frame_count,
+        .frame_time = SEQUENCE_FRAME_TIME,
+        .tile_size = options->tile_size,
+        .output = output,
+    };
+
+    bool const success = distributed_render(&settings, listener, spawned, stats);
+    close(listener);
+
+    for (int i = 0; i < spawned; ++i)
+    {
+        waitpid(workers[i], NULL, 0);
+    }
+
+    return success;
+}
+
+static int run_distributed(Options const *const options)
+{
+    if (options->tile_size > DISTRIBUTED_MAX_TILE_SIZE)
+    {
+        fprintf(stderr, "error: -distributed tiles can be at most %d pixels\n",
+                DISTRIBUTED_MAX_TILE_SIZE);
+        return 1;
+    }
+
+    FILE *output = NULL;
+    if (options->output_path != NULL)
+    {
+        output = fopen(options->output_path, "wb");
+        if (output == NULL)
+        {
+            fprintf(stderr, "error: could not open %s\n", options->output_path);
+            return 1;
+        }
+    }
+
+    int const last_count = options->worker_count != 0 ? options->worker_count : 4;
+
+    printf("%d frames of %dx%d in %dx%d tiles\n", options->frame_count,
+           options->width, options->height, options->tile_size, options->tile_size);
+    printf("%-20s %8s %7s %10s %8s %5s %16s\n", "workers", "seconds", "fps",
+           "efficiency", "requeued", "lost", "checksum");
+
+    RuntimeTest test = {0};
+    double single_worker_seconds = 0.0;
+    uint64_t healthy_checksum = 0;
+
+    // with more than one worker a last run loses a worker part way through
+    int const run_count = last_count > 1 ? last_count + 1 : last_count;
+
+    // one worker always runs first as the baseline of the efficiency, an
+    // explicit worker count then runs on its own
+    for (int count = 1; count <= run_count; ++count)
+    {
+        if (count > 1 && count < last_count && options->worker_count != 0) continue;
+
+        bool const with_failure = count > last_count;
+        int const worker_count = with_failure ? last_count : count;
+
+        DistributedStats stats;
+        if (!render_distributed(options, worker_count, with_failure ? 2 : 0,
+                                count == 1 ? output : NULL, &stats))
+        {
+            if (output != NULL) fclose(output);
+            return 1;
+        }
+
+        if (count == 1) single_worker_seconds = stats.seconds;
+
+        // efficiency: speed up over one worker divided by the worker count
+        char name[32];
+        snprintf(name, sizeof name, with_failure ? "%d, one dies" : "%d", worker_count);
+
+        printf("%-20s %8.2f %7.2f %9.1f%% %8d %5d %016llx\n", name, stats.seconds,
+               (double)options->frame_count / stats.seconds,
+               100.0 * single_worker_seconds / stats.seconds / worker_count,
+               stats.requeued, stats.workers_lost, (unsigned long long)stats.checksum);
+
+        // every run has to produce the frames of the first one
+        if (count == 1) healthy_checksum = stats.checksum;
+        runtime_check(&test, stats.checksum == healthy_checksum, "frames differ between runs");
+
+        if (with_failure)
+        {
+            runtime_check(&test, stats.workers_lost == 1, "the failing worker was not lost");
+            runtime_check(&test, stats.requeued > 0, "no job was handed out again");
+        }
+        else
+        {
+            runtime_check(&test, stats.workers_lost == 0 && stats.requeued == 0,
+                          "a healthy run lost a worker");
+        }
+    }
+
+    if (output != NULL && fclose(output) != 0)
+    {
+        fprintf(stderr, "error: could not write %s\n", options->output_path);
+        return 1;
+    }
+
+    return runtime_report(&test);
+}
+
+#define WINDOW_STATE_SECONDS 1.0
+#define WINDOW_STATE_MAX_STEPS (1 << 28)
+
+// every snapshot can be checked against the sequence it was published with:
+// each step publishes a new size, then flips the visibility, so step i ends
+// at sequence 4 * i. the height is derived from the width
+static int32_t window_state_test_height(int32_t const width)
+{
+    return (int32_t)(((uint32_t)width * 2654435761U) >> 1);
+}
+
+static bool window_state_snapshot_valid(WindowSnapshot const *const snapshot,
+                                        uint32_t const sequence, int32_t const last_step)
+{
+    int32_t const step = (int32_t)((sequence + 2) / 4);
+    bool const visible_flipped = sequence % 4 == 0;
+
+    // the quit request is published on its own after the last step
+    if (snapshot->quit_requested)
+    {
+        return sequence == (uint32_t)last_step * 4 + 2 &&
+               snapshot->width == last_step &&
+               snapshot->height == window_state_test_height(last_step) &&
+               snapshot->visible == ((last_step & 1) != 0);
+    }
+
+    return snapshot->width == step &&
+           snapshot->height == window_state_test_height(step) &&
+           snapshot->visible == (((visible_flipped ? step : step - 1) & 1) != 0);
+}
+
+typedef struct
+{
+    WindowStateChannel channel;
+    _Atomic int32_t last_step;
+} WindowStateTest;
+
+static void *window_state_writer(void *const context)
+{
+    WindowStateTest *const test = context;
+    double const start = runtime_clock_now();
+
+    int32_t step = 1;
+    for (;; ++step)
+    {
+        window_state_set_size(&test->channel, step, window_state_test_height(step));
+        window_state_set_visible(&test->channel, (step & 1) != 0);
+
+        if (step == WINDOW_STATE_MAX_STEPS ||
+            ((step & 0xfff) == 0 && runtime_clock_now() - start > WINDOW_STATE_SECONDS))
+        {
+            break;
+        }
+    }
+
+    atomic_store(&test->last_step, step);
+    window_state_request_quit(&test->channel);
+    return NULL;
+}
+
+static int run_window_state(void)
+{
+    static WindowStateTest test;
+
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, &window_state_writer, &test) != 0)
+    {
+        fprintf(stderr, "could not start the writer thread\n");
+        return 1;
+    }
+
+    uint32_t sequence = 0;
+    uint32_t last_sequence = 0;
+    WindowSnapshot snapshot = {0};
+    uint64_t polls = 0;
+    uint64_t changes = 0;
+    uint64_t invalid = 0;
+    uint64_t out_of_order = 0;
+
+    double const start = runtime_clock_now();
+    while (!snapshot.quit_requested)
+    {
+        ++polls;
+        if (!window_state_poll(&test.channel, &sequence, &snapshot)) continue;
+
+        ++changes;
+        if (!window_state_snapshot_valid(&snapshot, sequence, atomic_load(&test.last_step)))
+        {
+            ++invalid;
+        }
+
+        if (sequence <= last_sequence) ++out_of_order;
+        last_sequence = sequence;
+    }
+
+    double const seconds = runtime_clock_now() - start;
+    pthread_join(writer, NULL);
+
+    // nothing is published after the quit request, so polling again finds no change
+    bool const stale_change = window_state_poll(&test.channel, &sequence, &snapshot);
+
+    printf("%u snapshots published in %.3f s, %llu polls (%.1f ns each) saw %llu of them\n",
+           last_sequence / 2, seconds, (unsigned long long)polls,
+           seconds * 1e9 / (double)polls, (unsigned long long)changes);
+    printf("invalid snapshots %llu, out of order %llu\n",
+           (unsigned long long)invalid, (unsigned long long)out_of_order);
+
+    bool const passed = invalid == 0 && out_of_order == 0 && !stale_change;
+
+    printf("%s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
+
+// stands in for D3DCompile so the cache and reload logic can run without it
+#define STAND_IN_COMPILE_NANOSECONDS 20000000L
+#define STAND_IN_BLOB_SIZE 4096
+#define SHADER_CACHE_MAX_FILES 16
+
+typedef struct
+{
+    char directory[64];
+    char file_paths[SHADER_CACHE_MAX_FILES][128];
+    int file_count;
+    int compiles;
+    int cache_hits;
+    uint8_t file_data[sizeof(ShaderCacheHeader) + STAND_IN_BLOB_SIZE];
+    uint8_t compiled[STAND_IN_BLOB_SIZE];
+} ShaderCacheBench;
+
+static char const *const stand_in_entry_points[] = {
+    "ps_main", "post_ps_main", "reconstruct_ps_main", "generate_ps_main", "upscale_ps_main",
+};
+
+static bool stand_in_compile(void *const context, void const *const source,
+                             size_t const source_size, char const *const entry_point,
+                             char const *const target, uint32_t const flags,
+                             void const **const blob, size_t *const blob_size)
+{
+    ShaderCacheBench *const bench = context;
+
+    struct timespec const delay = {0, STAND_IN_COMPILE_NANOSECONDS};
+    nanosleep(&delay, NULL);
+
+    uint64_t const key = shader_cache_key(source, source_size, entry_point, target, flags);
+    uint32_t state = (uint32_t)(key ^ (key >> 32)) | 1;
+    for (int i = 0; i < STAND_IN_BLOB_SIZE; ++i)
+    {
+        bench->compiled[i] = (uint8_t)xorshift32(&state);
+    }
+
+    *blob = bench->compiled;
+    *blob_size = STAND_IN_BLOB_SIZE;
+    return true;
+}
+
+static void shader_cache_bench_path(ShaderCacheBench const *const bench, uint64_t const key,
+                                    char path[128])
+{
+    char name[SHADER_CACHE_NAME_LENGTH];
+    shader_cache_file_name(key, name);
+    snprintf(path, 128, "%s/%s", bench->directory, name);
+}
+
+static bool bench_read_cache_file(void *const context, uint64_t const key,
+                                  void const **const file_data, size_t *const file_size)
+{
+    ShaderCacheBench *const bench = context;
+
+    char path[128];
+    shader_cache_bench_path(bench, key, path);
+
+    FILE *const file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    *file_size = fread(bench->file_data, 1, sizeof bench->file_data, file);
+    *file_data = bench->file_data;
+    fclose(file);
+    return true;
+}
+
+static void bench_write_cache_file(void *const context, uint64_t const key,
+                                   ShaderCacheHeader const *const header,
+                                   void const *const blob, size_t const blob_size)
+{
+    ShaderCacheBench *const bench = context;
+
+    char path[128];
+    shader_cache_bench_path(bench, key, path);
+
+    FILE *const file = fopen(path, "wb");
+    if (file == NULL) return;
+
+    fwrite(header, 1, sizeof *header, file);
+    fwrite(blob, 1, blob_size, file);
+    fclose(file);
+
+    bool known = false;
+    for (int i = 0; i < bench->file_count; ++i)
+    {
+        known |= strcmp(bench->file_paths[i], path) == 0;
+    }
+
+    if (!known && bench->file_count < SHADER_CACHE_MAX_FILES)
+    {
+        strcpy(bench->file_paths[bench->file_count++], path);
+    }
+}
+
+// the shader_cache_compile that main.c uses, with stdio for the file access
+static void bench_compile_cached(ShaderCacheBench *const bench, char const *const source,
+                                 char const *const entry_point)
+{
+    ShaderCacheIo const io = {
+        .context = bench,
+        .read = bench_read_cache_file,
+        .compile = stand_in_compile,
+        .write = bench_write_cache_file,
+    };
+
+    void const *blob;
+    size_t blob_size;
+    switch (shader_cache_compile(&io, source, strlen(source), entry_point, "ps_5_0", 0,
+                                 &blob, &blob_size))
+    {
+        case SHADER_CACHE_FAILED: break;
+        case SHADER_CACHE_HIT: ++bench->cache_hits; break;
+        case SHADER_CACHE_COMPILED: ++bench->compiles; break;
+    }
+}
+
+static void bench_compile_all(ShaderCacheBench *const bench, char const *const source)
+{
+    size_t const count = sizeof stand_in_entry_points / sizeof *stand_in_entry_points;
+    for (size_t i = 0; i < count; ++i)
+    {
+        bench_compile_cached(bench, source, stand_in_entry_points[i]);
+    }
+}
+
+static void print_shader_cache_row(char const *const name, ShaderCacheBench const *const bench,
+                                   int const compiles, int const cache_hits,
+                                   int const notifications, int const reads,
+                                   int const failed_reads, int const reloads,
+                                   int64_t const latency, double const seconds)
+{
+    printf("%-26s %6d %6d %6d %6d %8d %6d %8lld %8.1f\n", name,
+           notifications, reads, failed_reads, reloads,
+           bench->compiles - compiles, bench->cache_hits - cache_hits,
+           (long long)latency, seconds * 1000.0);
+}
+
+static void check_shader_cache_count(RuntimeTest *const test, char const *const step,
+                                     char const *const what, int const count,
+                                     int const expected)
+{
+    char message[96];
+    snprintf(message, sizeof message, "%s: %d %s, expected %d", step, count, what, expected);
+    runtime_check(test, count == expected, message);
+}
+
+// checks and prints a step that compiled every entry point once
+static void check_shader_cache_startup(RuntimeTest *const test, char const *const name,
+                                       ShaderCacheBench const *const bench,
+                                       int const compiles, int const cache_hits,
+                                       double const start,
+                                       int const expected_compiles, int const expected_hits)
+{
+    print_shader_cache_row(name, bench, compiles, cache_hits, 0, 1, 0, 0, 0,
+                           runtime_clock_now() - start);
+
+    check_shader_cache_count(test, name, "compiles", bench->compiles - compiles,
+                             expected_compiles);
+    check_shader_cache_count(test, name, "hits", bench->cache_hits - cache_hits,
+                             expected_hits);
+}
+
+typedef struct
+{
+    char const *name;
+    char const *source;           // contents of shaders.hlsl after the save
+    int notification_count;       // editors often write a file in several steps
+    int64_t notification_spacing; // milliseconds
+    int64_t locked_for;           // milliseconds the editor keeps the file locked
+    int expected_failed_reads;
+    int expected_reloads;
+    int expected_compiles;
+    int expected_hits;
+} SaveScenario;
+
+// delivers the notifications of one save to the watch on a simulated
+// millisecond clock, the compiles themselves run for real
+static void simulate_save(ShaderCacheBench *const bench, ShaderWatch *const watch,
+                          SaveScenario const *const scenario, RuntimeTest *const test)
+{
+    int const compiles = bench->compiles;
+    int const cache_hits = bench->cache_hits;
+    double const start = runtime_clock_now();
+
+    int64_t now = 0;
+    int notifications = 0;
+    int reads = 0;
+    int failed_reads = 0;
+    int reloads = 0;
+
+    for (;;)
+    {
+        int64_t const next_notification = notifications < scenario->notification_count ?
+                                          notifications * scenario->notification_spacing : -1;
+        int64_t const timeout = shader_watch_timeout(watch, now);
+
+        if (next_notification < 0 && timeout < 0) break;
+
+        if (next_notification >= 0 && (timeout < 0 || next_notification <= now + timeout))
+        {
+            now = next_notification;
+            shader_watch_notify(watch, now);
+            ++notifications;
+            continue;
+        }
+
+        now += timeout;
+        if (!shader_watch_should_read(watch, now)) continue;
+
+        ++reads;
+        if (now < scenario->locked_for)
+        {
+            ++failed_reads;
+            shader_watch_read_failed(watch, now);
+            continue;
+        }
+
+        uint64_t const source_hash = shader_cache_hash(SHADER_CACHE_HASH_SEED, scenario->source,
+                                                       strlen(scenario->source));
+
+        if (shader_watch_source_read(watch, source_hash))
+        {
+            bench_compile_all(bench, scenario->source);
+            ++reloads;
+        }
+    }
+
+    print_shader_cache_row(scenario->name, bench, compiles, cache_hits,
+                           notifications, reads, failed_reads, reloads,
+                           now, runtime_clock_now() - start);
+
+    check_shader_cache_count(test, scenario->name, "failed reads", failed_reads,
+                             scenario->expected_failed_reads);
+    check_shader_cache_count(test, scenario->name, "reloads", reloads,
+                             scenario->expected_reloads);
+    check_shader_cache_count(test, scenario->name, "compiles", bench->compiles - compiles,
+                             scenario->expected_compiles);
+    check_shader_cache_count(test, scenario->name, "hits", bench->cache_hits - cache_hits,
+                             scenario->expected_hits);
+}
+
+static int run_shader_cache(void)
+{
+    char const *const first_source = "float4 ps_main() : SV_Target { return 0; }\n";
+    char const *const second_source = "float4 ps_main() : SV_Target { return 1; }\n";
+    char const *const third_source = "float4 ps_main() : SV_Target { return 2; }\n";
+
+    RuntimeTest test = {0};
+    ShaderCacheBench bench = {.directory = "/tmp/shader_cache_XXXXXX"};
+    if (mkdtemp(bench.directory) == NULL)
+    {
+        fprintf(stderr, "could not create %s\n", bench.directory);
+        return 1;
+    }
+
+    printf("%-26s %6s %6s %6s %6s %8s %6s %8s %8s\n", "step", "events", "reads", "locked",
+           "reload", "compiles", "hits", "sim ms", "real ms");
+
+    // startup compiles every entry point, or takes it from the cache. the
+    // expected counts are per entry point of stand_in_entry_points
+    int compiles = bench.compiles;
+    int cache_hits = bench.cache_hits;
+    double start = runtime_clock_now();
+    bench_compile_all(&bench, first_source);
+    check_shader_cache_startup(&test, "first start", &bench, compiles, cache_hits, start, 5, 0);
+
+    compiles = bench.compiles;
+    cache_hits = bench.cache_hits;
+    start = runtime_clock_now();
+    bench_compile_all(&bench, first_source);
+    check_shader_cache_startup(&test, "second start", &bench, compiles, cache_hits, start, 0, 5);
+
+    // a truncated entry is rejected and compiled again
+    runtime_check(&test, truncate(bench.file_paths[0], sizeof(ShaderCacheHeader) + 16) == 0,
+                  "truncating a cache entry");
+
+    compiles = bench.compiles;
+    cache_hits = bench.cache_hits;
+    start = runtime_clock_now();
+    bench_compile_all(&bench, first_source);
+    check_shader_cache_startup(&test, "start, truncated entry", &bench, compiles, cache_hits, start, 1, 4);
+
+    // settle time of 100 milliseconds like main.c
+    ShaderWatch watch;
+    shader_watch_init(&watch, shader_cache_hash(SHADER_CACHE_HASH_SEED, first_source,
+                                                strlen(first_source)), 100);
+
+    SaveScenario const scenarios[] = {
+        {"save in three writes", second_source, 3, 5, 0, 0, 1, 5, 0},
+        {"touch, same content", second_source, 1, 0, 0, 0, 0, 0, 0},
+        {"save, locked 250 ms", third_source, 2, 5, 250, 2, 1, 5, 0},
+        {"revert to first source", first_source, 1, 0, 0, 0, 1, 0, 5},
+    };
+
+    for (size_t i = 0; i < sizeof scenarios / sizeof *scenarios; ++i)
+    {
+        simulate_save(&bench, &watch, scenarios + i, &test);
+    }
+
+    for (int i = 0; i < bench.file_count; ++i)
+    {
+        remove(bench.file_paths[i]);
+    }
+
+    rmdir(bench.directory);
+    return runtime_report(&test);
+}
+
+#define RUNTIME_TEST_SIZE 300
+#define RUNTIME_TEST_OFFSETS 32
+
+static void check_runtime_memset(RuntimeTest *const test)
+{
+    static unsigned char buffer[RUNTIME_TEST_SIZE + RUNTIME_TEST_OFFSETS + 16];
+
+    bool passed = true;
+    for (int offset = 0; offset < RUNTIME_TEST_OFFSETS; ++offset)
+    {
+        for (int size = 0; size <= RUNTIME_TEST_SIZE; ++size)
+        {
+            int const value = (offset * 31 + size) & 0xff;
+            memset(buffer, 0xa5, sizeof buffer);
+
+            if (runtime_memset(buffer + offset, value, (size_t)size) != buffer + offset)
+            {
+                passed = false;
+            }
+
+            // the bytes around the range are guards
+            for (size_t i = 0; i < sizeof buffer; ++i)
+            {
+                bool const inside = i >= (size_t)offset && i < (size_t)(offset + size);
+                passed &= buffer[i] == (inside ? value : 0xa5);
+            }
+        }
+    }
+
+    runtime_check(test, passed, "memset at every alignment and size");
+}
+
+static void check_runtime_memcpy(RuntimeTest *const test)
+{
+    static unsigned char source[RUNTIME_TEST_SIZE + RUNTIME_TEST_OFFSETS];
+    static unsigned char buffer[RUNTIME_TEST_SIZE + RUNTIME_TEST_OFFSETS + 16];
+
+    for (size_t i = 0; i < sizeof source; ++i)
+    {
+        source[i] = (unsigned char)(i * 7 + 1);
+    }
+
+    bool passed = true;
+    for (int dest_offset = 0; dest_offset < RUNTIME_TEST_OFFSETS; ++dest_offset)
+    {
+        for (int source_offset = 0; source_offset < RUNTIME_TEST_OFFSETS; ++source_offset)
+        {
+            for (int size = 0; size <= RUNTIME_TEST_SIZE; size += size < 70 ? 1 : 23)
+            {
+                memset(buffer, 0xa5, sizeof buffer);
+
+                if (runtime_memcpy(buffer + dest_offset, source + source_offset,
+                                   (size_t)size) != buffer + dest_offset)
+                {
+                    passed = false;
+                }
+
+                for (size_t i = 0; i < sizeof buffer; ++i)
+                {
+                    bool const inside = i >= (size_t)dest_offset &&
+                                        i < (size_t)(dest_offset + size);
+                    passed &= buffer[i] == (inside ? source[source_offset + i - dest_offset] :
+                                                     0xa5);
+                }
+            }
+        }
+    }
+
+    runtime_check(test, passed, "memcpy at every pair of alignments");
+}
+
+static void check_runtime_arena(RuntimeTest *const test)
+{
+    static _Alignas(64) unsigned char memory[1024 + 1];
+
+    // an odd base, so alignment comes from padding and not from the buffer
+    RuntimeArena arena;
+    runtime_arena_init(&arena, memory + 1, 1024);
+
+    unsigned char *const bytes = runtime_arena_push(&arena, 3, 1);
+    runtime_check(test, bytes == memory + 1 && arena.used == 3, "byte allocation");
+
+    double *const values = RUNTIME_ARENA_PUSH_ARRAY(&arena, double, 4);
+    runtime_check(test, (uintptr_t)values % _Alignof(double) == 0, "typed allocation is aligned");
+    runtime_check(test, (unsigned char *)values >= bytes + 3, "allocations do not overlap");
+
+    void *const block = runtime_arena_push(&arena, 64, 64);
+    runtime_check(test, (uintptr_t)block % 64 == 0, "64 byte alignment");
+
+    size_t const used = arena.used;
+    runtime_check(test, runtime_arena_push(&arena, 1024, 1) == NULL, "too large fails");
+    runtime_check(test, runtime_arena_push(&arena, SIZE_MAX - 8, 16) == NULL,
+                  "size overflowing the address space fails");
+    runtime_check(test, arena.used == used, "a failed allocation leaves the arena alone");
+
+    size_t const mark = runtime_arena_mark(&arena);
+    runtime_arena_push(&arena, 100, 1);
+    runtime_arena_rewind(&arena, mark);
+    runtime_check(test, arena.used == mark, "rewind to a mark");
+    runtime_check(test, arena.peak == mark + 100, "peak survives a rewind");
+
+    runtime_arena_reset(&arena);
+    runtime_check(test, arena.used == 0, "reset frees everything");
+
+    memset(memory, 0xff, sizeof memory);
+    unsigned char *const zeroed = runtime_arena_push_zero(&arena, 1024, 1);
+    bool all_zero = zeroed != NULL;
+    for (int i = 0; all_zero && i < 1024; ++i)
+    {
+        all_zero = zeroed[i] == 0;
+    }
+
+    runtime_check(test, all_zero, "the whole capacity can be allocated zeroed");
+    runtime_check(test, runtime_arena_push(&arena, 0, 1) != NULL, "empty allocation when full");
+    runtime_check(test, runtime_arena_push(&arena, 1, 1) == NULL, "full arena fails");
+}
+
+static void check_runtime_clock(RuntimeTest *const test)
+{
+    int64_t const frequency = runtime_clock_frequency();
+    runtime_check(test, frequency > 0, "clock frequency");
+
+    bool monotonic = true;
+    int64_t last = runtime_clock_ticks();
+    for (int i = 0; i < 1000000; ++i)
+    {
+        int64_t const now = runtime_clock_ticks();
+        monotonic &= now >= last;
+        last = now;
+    }
+
+    runtime_check(test, monotonic, "clock never goes back");
+
+    struct timespec const sleep_time = {.tv_nsec = 20000000};
+    int64_t const start = runtime_clock_ticks();
+    nanosleep(&sleep_time, NULL);
+    double const slept = runtime_clock_seconds(runtime_clock_ticks() - start, frequency);
+
+    runtime_check(test, slept >= 0.019 && slept < 0.5, "a 20 ms sleep measures 20 ms");
+}
+
+static int run_runtime(void)
+{
+    RuntimeTest test = {0};
+
+    check_runtime_memset(&test);
+    check_runtime_memcpy(&test);
+    check_runtime_arena(&test);
+    check_runtime_clock(&test);
+
+    return runtime_report(&test);
+}
+
+// the memset main.c had before the runtime, kept as the baseline
+RUNTIME_NO_BUILTIN
+static void *byte_memset(void *const dest, int const value, size_t count)
+{
+    unsigned char *bytes = dest;
+    while (count-- != 0)
+    {
+        *bytes++ = (unsigned char)value;
+    }
+    return dest;
+}
+
+RUNTIME_NO_BUILTIN
+static void *byte_memcpy(void *const dest, void const *const source, size_t count)
+{
+    unsigned char *to = dest;
+    unsigned char const *from = source;
+    while (count-- != 0)
+    {
+        *to++ = *from++;
+    }
+    return dest;
+}
+
+static void *memset_runtime(void *const dest, void const *const source, size_t const count)
+{
+    (void)source;
+    return runtime_memset(dest, 0x5a, count);
+}
+
+static void *memset_bytes(void *const dest, void const *const source, size_t const count)
+{
+    (void)source;
+    return byte_memset(dest, 0x5a, count);
+}
+
+static void *memset_libc(void *const dest, void const *const source, size_t const count)
+{
+    (void)source;
+    return memset(dest, 0x5a, count);
+}
+
+typedef void *(*MemoryRoutine)(void *dest, void const *source, size_t count);
+
+// gb/s of the best of 5 runs, each moving about 256 mb
+static double time_memory_routine(MemoryRoutine volatile const routine, unsigned char *const dest,
+                                  unsigned char const *const source, size_t const size)
+{
+    size_t const repeats = size < (256u << 20) ? (256u << 20) / size : 1;
+    int64_t const frequency = runtime_clock_frequency();
+    double best = 0.0;
+
+    for (int run = 0; run < 5; ++run)
+    {
+        int64_t const start = runtime_clock_ticks();
+        for (size_t i = 0; i < repeats; ++i)
+        {
+            routine(dest, source, size);
+        }
+
+        double const seconds = runtime_clock_seconds(runtime_clock_ticks() - start, frequency);
+        double const rate = (double)size * (double)repeats / seconds * 1e-9;
+        best = rate > best ? rate : best;
+    }
+
+    return best;
+}
+
+static int run_bench_runtime(void)
+{
+    size_t const sizes[] = {64, 4096, 256 << 10, 16 << 20};
+    size_t const largest = sizes[sizeof sizes / sizeof *sizes - 1];
+
+    // one byte past an aligned address, like most buffers the caller passes in
+    unsigned char *const dest = malloc(largest + 64);
+    unsigned char *const source = malloc(largest + 64);
+    if (dest == NULL || source == NULL)
+    {
+        fprintf(stderr, "error: out of memory\n");
+        free(dest);
+        free(source);
+        return 1;
+    }
+
+    memset(source, 1, largest + 64);
+
+    struct
+    {
+        char const *name;
+        MemoryRoutine routine;
+    } const routines[] = {
+        {"memset byte loop", &memset_bytes},
+        {"memset runtime", &memset_runtime},
+        {"memset libc", &memset_libc},
+        {"memcpy byte loop", &byte_memcpy},
+        {"memcpy runtime", &runtime_memcpy},
+        {"memcpy libc", &memcpy},
+    };
+
+    printf("gb/s, best of 5, unaligned destination\n%-18s", "routine");
+    for (size_t i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+    {
+        char label[16];
+        snprintf(label, sizeof label, sizes[i] >= (1 << 20) ? "%zu mb" :
+                                      sizes[i] >= (1 << 10) ? "%zu kb" : "%zu b",
+                 sizes[i] >= (1 << 20) ? sizes[i] >> 20 :
+                 sizes[i] >= (1 << 10) ? sizes[i] >> 10 : sizes[i]);
+        printf(" %9s", label);
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < sizeof routines / sizeof *routines; ++i)
+    {
+        printf("%-18s", routines[i].name);
+        for (size_t j = 0; j < sizeof sizes / sizeof *sizes; ++j)
+        {
+            printf(" %9.2f", time_memory_routine(routines[i].routine, dest + 1, source + 3,
+                                                 sizes[j]));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    // an arena push is a few adds against a trip through the heap
+    static unsigned char memory[1 << 16];
+    RuntimeArena arena;
+    runtime_arena_init(&arena, memory, sizeof memory);
+
+    int64_t const frequency = runtime_clock_frequency();
+    int const frames = 100000;
+    int const allocations = 64;
+
+    int64_t start = runtime_clock_ticks();
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        for (int i = 0; i < allocations; ++i)
+        {
+            unsigned char *volatile block = runtime_arena_push(&arena, 48, 16);
+            (void)block;
+        }
+        runtime_arena_reset(&arena);
+    }
+    double const arena_seconds = runtime_clock_seconds(runtime_clock_ticks() - start, frequency);
+
+    void *blocks[64];
+    start = runtime_clock_ticks();
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        for (int i = 0; i < allocations; ++i)
+        {
+            blocks[i] = malloc(48);
+        }
+        for (int i = 0; i < allocations; ++i)
+        {
+            free(blocks[i]);
+        }
+    }
+    double const heap_seconds = runtime_clock_seconds(runtime_clock_ticks() - start, frequency);
+
+    double const calls = (double)frames * allocations;
+    printf("arena push %.1f ns, malloc and free %.1f ns\n",
+           arena_seconds * 1e9 / calls, heap_seconds * 1e9 / calls);
+
+    start = runtime_clock_ticks();
+    for (int i = 0; i < 1000000; ++i)
+    {
+        int64_t volatile ticks = runtime_clock_ticks();
+        (void)ticks;
+    }
+    printf("clock read %.1f ns\n",
+           runtime_clock_seconds(runtime_clock_ticks() - start, frequency) * 1e9 / 1000000.0);
+
+    free(dest);
+    free(source);
+    return 0;
+}
+
+// a gpu whose frame time follows the work of a level, with one frame of
+// every level taking several times as long as if it had been preempted
+static int64_t simulated_frame_ticks(QualitySettings const *const settings, double const speed,
+                                     uint32_t const frame)
+{
+    double const pixels = (double)settings->resolution_percent * settings->resolution_percent;
+    double const work = pixels * settings->total_samples * settings->max_steps *
+                        (1.0 + settings->max_bounces);
+
+    int64_t const ticks = (int64_t)(work / speed);
+    return frame % 4 == 2 ? ticks * 5 : ticks;
+}
+
+static void check_tuner_search(RuntimeTest *const test)
+{
+    int measurements = 0;
+    int searches = 0;
+    int max_measurements = 0;
+
+    for (double speed = 1.0; speed < 4096.0; speed *= 1.1)
+    {
+        for (int64_t target = 100000; target <= 100000000; target *= 10)
+        {
+            QualityTuner tuner;
+            quality_tuner_init(&tuner, target, 1, 3);
+
+            while (!quality_tuner_done(&tuner))
+            {
+                QualitySettings const settings = quality_tuner_settings(&tuner);
+                quality_tuner_frame(&tuner, simulated_frame_ticks(&settings, speed, tuner.frame));
+            }
+
+            // measuring every level, the best one within the target or the cheapest
+            int expected = QUALITY_LEVEL_COUNT - 1;
+            for (int level = 0; level < QUALITY_LEVEL_COUNT; ++level)
+            {
+                if (simulated_frame_ticks(quality_levels + level, speed, 0) <= target)
+                {
+                    expected = level;
+                    break;
+                }
+            }
+
+            runtime_check(test, tuner.level == expected,
+                          "the search picks the level an exhaustive search does");
+
+            measurements += (int)tuner.measured_levels;
+            max_measurements = (int)tuner.measured_levels > max_measurements ?
+                               (int)tuner.measured_levels : max_measurements;
+            ++searches;
+        }
+    }
+
+    // the ladder has to get cheaper level by level for the search to be right
+    for (int level = 1; level < QUALITY_LEVEL_COUNT; ++level)
+    {
+        runtime_check(test, simulated_frame_ticks(quality_levels + level, 1.0, 0) <
+                            simulated_frame_ticks(quality_levels + level - 1, 1.0, 0),
+                      "every level is cheaper than the one before");
+    }
+
+    printf("%d searches, %.2f levels measured on average, %d at most, exhaustive %d\n",
+           searches, (double)measurements / searches, max_measurements, QUALITY_LEVEL_COUNT);
+}
+
+static void check_tuner_cache(RuntimeTest *const test)
+{
+    uint64_t const hardware = 0x1234;
+    uint64_t const key = quality_cache_key(&hardware, sizeof hardware, 1, 1920, 1080, 16666);
+    int level = -1;
+
+    QualityCacheRecord record = quality_cache_record(key, 5);
+    runtime_check(test, quality_cache_read(&record, sizeof record, key, &level) && level == 5,
+                  "a record reads back");
+
+    runtime_check(test, key != quality_cache_key(&hardware, sizeof hardware, 2, 1920, 1080, 16666),
+                  "the build is part of the key");
+    runtime_check(test, key != quality_cache_key(&hardware, sizeof hardware, 1, 1280, 720, 16666),
+                  "the size is part of the key");
+    runtime_check(test, key != quality_cache_key(&hardware, sizeof hardware, 1, 1920, 1080, 6944),
+                  "the target is part of the key");
+
+    runtime_check(test, !quality_cache_read(&record, sizeof record, key + 1, &level),
+                  "a record for other hardware is ignored");
+    runtime_check(test, !quality_cache_read(&record, sizeof record - 1, key, &level),
+                  "a short record is ignored");
+
+    unsigned char longer[sizeof record + 1] = {0};
+    memcpy(longer, &record, sizeof record);
+    runtime_check(test, !quality_cache_read(longer, sizeof longer, key, &level),
+                  "a long record is ignored");
+
+    QualityCacheRecord changed = record;
+    changed.version = QUALITY_CACHE_VERSION + 1;
+    runtime_check(test, !quality_cache_read(&changed, sizeof changed, key, &level),
+                  "a record of another version is ignored");
+
+    changed = record;
+    changed.magic = 0;
+    runtime_check(test, !quality_cache_read(&changed, sizeof changed, key, &level),
+                  "a record with the wrong magic is ignored");
+
+    changed = record;
+    changed.level = QUALITY_LEVEL_COUNT;
+    runtime_check(test, !quality_cache_read(&changed, sizeof changed, key, &level),
+                  "a level past the ladder is ignored");
+
+    changed = record;
+    changed.settings.max_steps += 1;
+    runtime_check(test, !quality_cache_read(&changed, sizeof changed, key, &level),
+                  "a record of different levels is ignored");
+
+    QualitySettings const half = {1, 1, 64, 50};
+    runtime_check(test, quality_scaled_size(1920, &half) == 960 &&
+                        quality_scaled_size(1, &half) == 1,
+                  "scaled sizes are at least a pixel");
+}
+
+static int run_check_tuner(void)
+{
+    RuntimeTest test = {0};
+
+    check_tuner_search(&test);
+    check_tuner_cache(&test);
+
+    return runtime_report(&test);
+}
+
+// the cpu stands in for the gpu, identified by its model and core count
+static uint64_t tune_hardware_id(void)
+{
+    uint64_t hash = SHADER_CACHE_HASH_SEED;
+
+    FILE *const file = fopen("/proc/cpuinfo", "r");
+    if (file != NULL)
+    {
+        char line[256];
+        while (fgets(line, sizeof line, file) != NULL)
+        {
+            if (strncmp(line, "model name", 10) == 0)
+            {
+                hash = shader_cache_hash(hash, line, strlen(line));
+                break;
+            }
+        }
+        fclose(file);
+    }
+
+    long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return shader_cache_hash(hash, &cpus, sizeof cpus);
+}
+
+static double tune_render_frame(Options const *const options, QualitySettings const *const settings,
+                                GBufferTexel *const gbuffer, float3 *const output)
+{
+    int const width = quality_scaled_size(options->width, settings);
+    int const height = quality_scaled_size(options->height, settings);
+
+    SceneConstants constants = scene_constants(width, height, options->timer);
+    constants.total_samples = (int)settings->total_samples;
+    constants.max_bounces = (int)settings->max_bounces;
+    constants.max_steps = (int)settings->max_steps;
+
+    double const start = runtime_clock_now();
+    scene_trace_rows(&constants, width, height, 0, height, gbuffer);
+    post_process_frame(gbuffer, width, height, output);
+    return runtime_clock_now() - start;
+}
+
+static int run_tune(Options const *const options)
+{
+    char const *const path = options->output_path != NULL ? options->output_path : "quality_cache.bin";
+    int64_t const target_us = (int64_t)(options->target_ms * 1000.0);
+
+    static char const build[] = __DATE__ " " __TIME__ " " __VERSION__;
+    uint64_t const hardware = tune_hardware_id();
+    uint64_t const key = quality_cache_key(&hardware, sizeof hardware,
+                                           shader_cache_hash(SHADER_CACHE_HASH_SEED, build,
+                                                             sizeof build),
+                                           options->width, options->height, target_us);
+
+    int level = -1;
+    FILE *file = fopen(path, "rb");
+    if (file != NULL)
+    {
+        unsigned char data[sizeof(QualityCacheRecord) + 1];
+        size_t const size = fread(data, 1, sizeof data, file);
+        fclose(file);
+
+        if (quality_cache_read(data, size, key, &level))
+        {
+            printf("cache hit in %s: level %d\n", path, level);
+        }
+    }
+
+    GBufferTexel *const gbuffer = malloc((size_t)options->width * options->height * sizeof *gbuffer);
+    float3 *const output = malloc((size_t)options->width * options->height * sizeof *output);
+    if (gbuffer == NULL || output == NULL) return 1;
+
+    if (level < 0)
+    {
+        QualityTuner tuner;
+        quality_tuner_init(&tuner, target_us, 1, 3);
+
+        double const start = runtime_clock_now();
+        while (!quality_tuner_done(&tuner))
+        {
+            QualitySettings const settings = quality_tuner_settings(&tuner);
+            double const seconds = tune_render_frame(options, &settings, gbuffer, output);
+            quality_tuner_frame(&tuner, (int64_t)(seconds * 1e6));
+        }
+
+        level = tuner.level;
+        printf("calibrated in %.2f s, %u of %d levels measured\n",
+               runtime_clock_now() - start, tuner.measured_levels, QUALITY_LEVEL_COUNT);
+
+        for (int i = 0; i < QUALITY_LEVEL_COUNT; ++i)
+        {
+            if (tuner.level_ticks[i] != 0)
+            {
+                printf("  level %d: %.1f ms\n", i, (double)tuner.level_ticks[i] / 1000.0);
+            }
+        }
+
+        QualityCacheRecord const record = quality_cache_record(key, level);
+        file = fopen(path, "wb");
+        if (file == NULL || fwrite(&record, sizeof record, 1, file) != 1)
+        {
+            fprintf(stderr, "error: could not write %s\n", path);
+        }
+        if (file != NULL) fclose(file);
+    }
+
+    QualitySettings const *const settings = quality_levels + level;
+    double const seconds = tune_render_frame(options, settings, gbuffer, output);
+
+    printf("level %d: %u samples, %u bounces, %u steps at %dx%d, %.1f ms for a %.1f ms target\n",
+           level, settings->total_samples, settings->max_bounces, settings->max_steps,
+           quality_scaled_size(options->width, settings),
+           quality_scaled_size(options->height, settings), seconds * 1000.0, options->target_ms);
+
+    free(gbuffer);
+    free(output);
+    return 0;
+}
+
+static bool parse_options(int const argc, char **const argv, Options *const options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        char const *const argument = argv[i];
+        char const *const value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(argument, "-render") == 0 && value != NULL)
+        {
+            options->mode = RENDER_MODE;
+            options->output_path = value;
+            ++i;
+        }
+        else if (strcmp(argument, "-bench-sdf") == 0)
+        {
+            options->mode = BENCH_SDF_MODE;
+        }
+        else if (strcmp(argument, "-bench-kernels") == 0)
+        {
+            options->mode = BENCH_KERNELS_MODE;
+        }
+        else if (strcmp(argument, "-wavefront") == 0)
+        {
+            options->mode = WAVEFRONT_MODE;
+        }
+        else if (strcmp(argument, "-pacing") == 0)
+        {
+            options->mode = PACING_MODE;
+        }
+        else if (strcmp(argument, "-pipeline") == 0)
+        {
+            options->mode = PIPELINE_MODE;
+        }
+        else if (strcmp(argument, "-still") == 0 && value != NULL)
+        {
+            options->mode = STILL_MODE;
+            options->output_path = value;
+            ++i;
+        }
+        else if (strcmp(argument, "-bench-still") == 0)
+        {
+            options->mode = BENCH_STILL_MODE;
+        }
+        else if (strcmp(argument, "-scanline") == 0)
+        {
+            options->mode = SCANLINE_MODE;
+        }
+        else if (strcmp(argument, "-distributed") == 0)
+        {
+            options->mode = DISTRIBUTED_MODE;
+        }
+        else if (strcmp(argument, "-worker") == 0 && value != NULL)
+        {
+            options->mode = WORKER_MODE;
+            options->port = atoi(value);
+            if (options->port <= 0 || options->port > 65535) return false;
+            ++i;
+        }
+        else if (strcmp(argument, "-window-state") == 0)
+        {
+            options->mode = WINDOW_STATE_MODE;
+        }
+        else if (strcmp(argument, "-shader-cache") == 0)
+        {
+            options->mode = SHADER_CACHE_MODE;
+        }
+        else if (strcmp(argument, "-runtime") == 0)
+        {
+            options->mode = RUNTIME_MODE;
+        }
+        else if (strcmp(argument, "-bench-runtime") == 0)
+        {
+            options->mode = BENCH_RUNTIME_MODE;
+        }
+        else if (strcmp(argument, "-check-tuner") == 0)
+        {
+            options->mode = CHECK_TUNER_MODE;
+        }
+        else if (strcmp(argument, "-tune") == 0)
+        {
+            options->mode = TUNE_MODE;
+        }
+        else if (strcmp(argument, "-frame-generation") == 0)
+        {
+            options->mode = FRAME_GENERATION_MODE;
+        }
+        else if (strcmp(argument, "-bench-lod") == 0)
+        {
+            options->mode = BENCH_LOD_MODE;
+        }
+        else if (strcmp(argument, "-gbuffer") == 0)
+        {
+            options->mode = GBUFFER_MODE;
+        }
+        else if (strcmp(argument, "-checkerboard") == 0 && value != NULL)
+        {
+            if (strlen(value) != 3 ||
+                value[0] < '0' || value[0] > '2' ||
+                value[1] < '0' || value[1] > '1' ||
+                value[2] < '0' || value[2] > '1')
+            {
+                return false;
+            }
+
+            options->mode = CHECKERBOARD_MODE;
+            options->checkerboard = (CheckerboardSettings) {
+                value[0] - '0', value[1] - '0', value[2] - '0',
+            };
+            ++i;
+        }
+        else if (strcmp(argument, "-frames") == 0 && value != NULL)
+        {
+            options->frame_count = atoi(value);
+            if (options->frame_count <= 0) return false;
+            ++i;
+        }
+        else if (strcmp(argument, "-depth") == 0 && value != NULL)
+        {
+            options->pipeline_depth = atoi(value);
+            if (options->pipeline_depth <= 0) return false;
+            ++i;
+        }
+        else if (strcmp(argument, "-tile") == 0 && value != NULL)
+        {
+            options->tile_size = atoi(value);
+            if (options->tile_size <= 0) return false;
+            ++i;
+        }
+        else if (strcmp(argument, "-workers") == 0 && value != NULL)
+        {
+            options->worker_count = atoi(value);
+            if (options->worker_count <= 0 ||
+                options->worker_count > DISTRIBUTED_MAX_WORKERS)
+            {
+                return false;
+            }
+            ++i;
+        }
+        else if (strcmp(argument, "-threads") == 0 && value != NULL)
+        {
+            options->thread_count = atoi(value);
+            if (options->thread_count <= 0 ||
+                options->thread_count > SCANLINE_MAX_THREADS)
+            {
+                return false;
+            }
+            ++i;
+        }
+        else if (strcmp(argument, "-target-ms") == 0 && value != NULL)
+        {
+            options->target_ms = strtod(value, NULL);
+            if (options->target_ms <= 0.0) return false;
+            ++i;
+        }
+        else if (strcmp(argument, "-lod") == 0)
+        {
+            options->lod = true;
+        }
+        else if (strcmp(argument, "-output") == 0 && value != NULL)
+        {
+            options->output_path = value;
+            ++i;
+        }
+        else if (strcmp(argument, "-size") == 0 && value != NULL)
+        {
+            if (sscanf(value, "%dx%d", &options->width, &options->height) != 2 ||
+                options->width <= 0 || options->height <= 0)
+            {
+                return false;
+            }
+            ++i;
+        }
+        else if (strcmp(argument, "-timer") == 0 && value != NULL)
+        {
+            options->timer = strtof(value, NULL);
+            ++i;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return options->mode != NOTHING_MODE;
+}
+
+int main(int argc, char **argv)
+{
+    Options options = {
+        .mode = NOTHING_MODE,
+        .width = 320,
+        .height = 180,
+        .timer = 1.5f,
+        .frame_count = 8,
+        .tile_size = 64,
+        .target_ms = 250.0,
+    };
+
+    if (!parse_options(argc, argv, &options))
+    {
+        fprintf(stderr, "usage: %s -render <file.ppm> | -bench-sdf | -bench-kernels | -wavefront | -gbuffer | -pacing | -pipeline | -still <file> | -bench-still | -scanline | -distributed | -worker <port> | -window-state | -shader-cache | -runtime | -bench-runtime | -check-tuner | -tune | -checkerboard <ptf> | -frame-generation | -bench-lod "
+                        "[-frames <count>] [-depth <count>] [-tile <pixels>] [-workers <count>] [-threads <count>] [-target-ms <ms>] [-output <file>] [-lod] [-size <width>x<height>] [-timer <seconds>]\n", argv[0]);
+        return 1;
+    }
+
+    switch (options.mode)
+    {
+        case RENDER_MODE: return run_render(&options);
+        case BENCH_SDF_MODE: return run_bench_sdf(&options);
+        case BENCH_KERNELS_MODE: return run_bench_kernels(&options);
+        case WAVEFRONT_MODE: return run_wavefront(&options);
+        case CHECKERBOARD_MODE: return run_checkerboard(&options);
+        case FRAME_GENERATION_MODE: return run_frame_generation(&options);
+        case GBUFFER_MODE: return run_gbuffer(&options);
+        case PACING_MODE: return run_pacing();
+        case SHADER_CACHE_MODE: return run_shader_cache();
+        case WINDOW_STATE_MODE: return run_window_state();
+        case PIPELINE_MODE: return run_pipeline(&options);
+        case DISTRIBUTED_MODE: return run_distributed(&options);
+        case WORKER_MODE: return distributed_worker(options.port, 0);
+        case STILL_MODE: return run_still(&options);
+        case BENCH_STILL_MODE: return run_bench_still(&options);
+        case SCANLINE_MODE: return run_scanline(&options);
+        case RUNTIME_MODE: return run_runtime();
+        case BENCH_RUNTIME_MODE: return run_bench_runtime();
+        case CHECK_TUNER_MODE: return run_check_tuner();
+        case TUNE_MODE: return run_tune(&options);
+        case BENCH_LOD_MODE: return run_bench_lod(&options);
+        default: return 1;
+    }
+}
@@ -0,0 +1,539 @@
+#ifndef CPU_DISTRIBUTED_H
+#define CPU_DISTRIBUTED_H
+
+// distributed tile rendering for the cpu port. a coordinator splits every
+// frame of a sequence into tiles and hands (timer, tile) jobs to worker
+// processes over tcp. a worker renders its tile with render_tile and sends
+// back the finished 8 bit tile, the coordinator assembles the frames in order.
+// a job whose worker disconnects before answering is handed out again.
+//
+// the protocol is fixed size messages in host byte order, it is meant for
+// workers on the same machine or on machines of the same architecture
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tile.h"
+#include "../runtime.h"
+
+#define DISTRIBUTED_MAX_WORKERS 64
+#define DISTRIBUTED_MAX_TILE_SIZE 256
+
+typedef enum
+{
+    TILE_MESSAGE_JOB,
+    TILE_MESSAGE_QUIT,
+} TileMessageType;
+
+// coordinator to worker
+typedef struct
+{
+    uint32_t type;
+    int32_t job;
+    float timer;
+    int32_t frame_width;
+    int32_t frame_height;
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+} TileJobMessage;
+
+// worker to coordinator, followed by width * height * 3 bytes of rgb
+typedef struct
+{
+    int32_t job;
+    int32_t width;
+    int32_t height;
+} TileResultHeader;
+
+typedef enum
+{
+    TILE_JOB_PENDING,
+    TILE_JOB_ASSIGNED,
+    TILE_JOB_DONE,
+} TileJobState;
+
+typedef struct
+{
+    int frame;
+    int x;
+    int y;
+    int width;
+    int height;
+    TileJobState state;
+} TileJob;
+
+typedef struct
+{
+    int width;
+    int height;
+    int frame_count;
+    float frame_time;
+    int tile_size;
+    FILE *output;       // frames are appended as binary ppm, NULL discards them
+} DistributedSettings;
+
+typedef struct
+{
+    double seconds;
+    int jobs;
+    int requeued;       // jobs handed out again after their worker was lost
+    int workers_lost;
+    uint64_t checksum;  // fnv-1a of every frame in order, like the pipeline's
+} DistributedStats;
+
+static bool distributed_send_all(int const socket, void const *const data, size_t const size)
+{
+    unsigned char const *bytes = data;
+    size_t sent = 0;
+
+    while (sent < size)
+    {
+        // a worker that died must not take the coordinator down with SIGPIPE
+        ssize_t const result = send(socket, bytes + sent, size - sent, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) return false;
+
+        sent += (size_t)result;
+    }
+
+    return true;
+}
+
+// the messages are small and each one is answered, without this nagle's
+// algorithm holds back the tile after its header until the header is acked
+static void distributed_set_no_delay(int const socket)
+{
+    int const no_delay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof no_delay);
+}
+
+static bool distributed_receive_all(int const socket, void *const data, size_t const size)
+{
+    unsigned char *bytes = data;
+    size_t received = 0;
+
+    while (received < size)
+    {
+        ssize_t const result = recv(socket, bytes + received, size - received, 0);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) return false;
+
+        received += (size_t)result;
+    }
+
+    return true;
+}
+
+// connects to the coordinator on the loopback port and renders jobs until
+// told to quit. fail_after > 0 makes the worker exit without answering its
+// next job after that many, to exercise the coordinator's recovery
+static int distributed_worker(int const port, int const fail_after)
+{
+    int const socket_handle = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_handle < 0) return 1;
+
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons((uint16_t)port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+
+    if (connect(socket_handle, (struct sockaddr *)&address, sizeof address) != 0)
+    {
+        close(socket_handle);
+        return 1;
+    }
+
+    distributed_set_no_delay(socket_handle);
+
+    static unsigned char rgb[DISTRIBUTED_MAX_TILE_SIZE * DISTRIBUTED_MAX_TILE_SIZE * 3];
+    GBufferTexel *const scratch =
+        malloc(tile_scratch_texels(DISTRIBUTED_MAX_TILE_SIZE) * sizeof *scratch);
+
+    if (scratch == NULL)
+    {
+        close(socket_handle);
+        return 1;
+    }
+
+    int jobs_done = 0;
+
+    for (;;)
+    {
+        TileJobMessage job;
+        if (!distributed_receive_all(socket_handle, &job, sizeof job) ||
+            job.type != TILE_MESSAGE_JOB)
+        {
+            break;
+        }
+
+        if (fail_after > 0 && jobs_done == fail_after) _exit(1);
+
+        if (job.width <= 0 || job.width > DISTRIBUTED_MAX_TILE_SIZE ||
+            job.height <= 0 || job.height > DISTRIBUTED_MAX_TILE_SIZE)
+        {
+            break;
+        }
+
+        SceneConstants const constants =
+            scene_constants(job.frame_width, job.frame_height, job.timer);
+
+        render_tile(&constants, job.frame_width, job.frame_height,
+                    job.x, job.y, job.width, job.height,
+                    scratch, rgb, (size_t)job.width * 3);
+
+        TileResultHeader const header = {job.job, job.width, job.height};
+        if (!distributed_send_all(socket_handle, &header, sizeof header) ||
+            !distributed_send_all(socket_handle, rgb, (size_t)job.width * job.height * 3))
+        {
+            break;
+        }
+
+        ++jobs_done;
+    }
+
+    free(scratch);
+    close(socket_handle);
+    return 0;
+}
+
+// listens on the loopback interface, port 0 picks a free port. returns the
+// socket and stores the port, or returns -1
+static int distributed_listen(int *const port)
+{
+    int const socket_handle = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_handle < 0) return -1;
+
+    int const reuse = 1;
+    setsockopt(socket_handle, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons((uint16_t)*port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+
+    socklen_t address_size = sizeof address;
+    if (bind(socket_handle, (struct sockaddr *)&address, sizeof address) != 0 ||
+        listen(socket_handle, DISTRIBUTED_MAX_WORKERS) != 0 ||
+        getsockname(socket_handle, (struct sockaddr *)&address, &address_size) != 0)
+    {
+        close(socket_handle);
+        return -1;
+    }
+
+    *port = ntohs(address.sin_port);
+    return socket_handle;
+}
+
+// forks a worker process, returns its pid or -1
+static pid_t distributed_spawn_worker(int const port, int const fail_after)
+{
+    pid_t const pid = fork();
+    if (pid == 0)
+    {
+        _exit(distributed_worker(port, fail_after));
+    }
+
+    return pid;
+}
+
+typedef struct
+{
+    int socket;
+    int job;        // the job it is working on, -1 when idle
+} DistributedWorker;
+
+typedef struct
+{
+    DistributedSettings settings;
+    TileJob *jobs;
+    int job_count;
+    int tiles_per_frame;
+    int next_pending;       // no pending job before this index
+
+    unsigned char **frames; // assembled frames, allocated on their first tile
+    int *tiles_done;
+    int next_output;        // frames are written in order
+
+    DistributedWorker workers[DISTRIBUTED_MAX_WORKERS];
+    int worker_count;
+
+    DistributedStats stats;
+} Coordinator;
+
+static int coordinator_take_job(Coordinator *const this)
+{
+    while (this->next_pending < this->job_count &&
+           this->jobs[this->next_pending].state != TILE_JOB_PENDING)
+    {
+        ++this->next_pending;
+    }
+
+    return this->next_pending < this->job_count ? this->next_pending : -1;
+}
+
+static void coordinator_requeue(Coordinator *const this, int const job)
+{
+    this->jobs[job].state = TILE_JOB_PENDING;
+    this->next_pending = job < this->next_pending ? job : this->next_pending;
+    ++this->stats.requeued;
+}
+
+static void coordinator_drop_worker(Coordinator *const this, int const index)
+{
+    DistributedWorker *const worker = this->workers + index;
+    if (worker->job >= 0) coordinator_requeue(this, worker->job);
+
+    close(worker->socket);
+    this->workers[index] = this->workers[--this->worker_count];
+    ++this->stats.workers_lost;
+}
+
+// hands an idle worker the next job, false when the worker was lost
+static bool coordinator_assign(Coordinator *const this, DistributedWorker *const worker)
+{
+    int const job_index = coordinator_take_job(this);
+    if (job_index < 0) return true;
+
+    TileJob *const job = this->jobs + job_index;
+    TileJobMessage const message = {
+        .type = TILE_MESSAGE_JOB,
+        .job = job_index,
+        .timer = (float)job->frame * this->settings.frame_time,
+        .frame_width = this->settings.width,
+        .frame_height = this->settings.height,
+        .x = job->x,
+        .y = job->y,
+        .width = job->width,
+        .height = job->height,
+    };
+
+    job->state = TILE_JOB_ASSIGNED;
+    worker->job = job_index;
+    return distributed_send_all(worker->socket, &message, sizeof message);
+}
+
+static void coordinator_output_frames(Coordinator *const this)
+{
+    size_t const frame_size = (size_t)this->settings.width * this->settings.height * 3;
+
+    while (this->next_output < this->settings.frame_count &&
+           this->tiles_done[this->next_output] == this->tiles_per_frame)
+    {
+        unsigned char *const frame = this->frames[this->next_output];
+
+        uint64_t hash = this->stats.checksum;
+        for (size_t i = 0; i < frame_size; ++i)
+        {
+            hash = (hash ^ frame[i]) * 0x100000001b3ULL;
+        }
+
+        this->stats.checksum = hash;
+
+        if (this->settings.output != NULL)
+        {
+            fprintf(this->settings.output, "P6\n%d %d\n255\n",
+                    this->settings.width, this->settings.height);
+            fwrite(frame, 1, frame_size, this->settings.output);
+        }
+
+        free(frame);
+        this->frames[this->next_output++] = NULL;
+    }
+}
+
+// reads a finished tile into its frame, false when the worker was lost
+static bool coordinator_receive(Coordinator *const this, DistributedWorker *const worker,
+                                unsigned char *const tile)
+{
+    TileResultHeader header;
+    if (!distributed_receive_all(worker->socket, &header, sizeof header)) return false;
+
+    if (header.job != worker->job) return false;
+
+    TileJob *const job = this->jobs + header.job;
+    if (header.width != job->width || header.height != job->height ||
+        !distributed_receive_all(worker->socket, tile, (size_t)job->width * job->height * 3))
+    {
+        return false;
+    }
+
+    worker->job = -1;
+    job->state = TILE_JOB_DONE;
+
+    int const width = this->settings.width;
+    unsigned char **const frame = this->frames + job->frame;
+    if (*frame == NULL)
+    {
+        *frame = malloc((size_t)width * this->settings.height * 3);
+        if (*frame == NULL)
+        {
+            fprintf(stderr, "error: out of memory\n");
+            exit(1);
+        }
+    }
+
+    for (int y = 0; y < job->height; ++y)
+    {
+        memcpy(*frame + ((size_t)(job->y + y) * width + job->x) * 3,
+               tile + (size_t)y * job->width * 3, (size_t)job->width * 3);
+    }
+
+    ++this->tiles_done[job->frame];
+    coordinator_output_frames(this);
+    return true;
+}
+
+// renders the sequence with the workers that connect to listener, gives up
+// when all expected workers connected and every one of them was lost
+static bool distributed_render(DistributedSettings const *const settings,
+                               int const listener, int const expected_workers,
+                               DistributedStats *const stats)
+{
+    int const tile_size = settings->tile_size;
+    int const tiles_x = (settings->width + tile_size - 1) / tile_size;
+    int const tiles_y = (settings->height + tile_size - 1) / tile_size;
+
+    Coordinator this = {
+        .settings = *settings,
+        .tiles_per_frame = tiles_x * tiles_y,
+        .job_count = tiles_x * tiles_y * settings->frame_count,
+        .stats = {.checksum = 0xcbf29ce484222325ULL},
+    };
+
+    this.jobs = malloc((size_t)this.job_count * sizeof *this.jobs);
+    this.frames = calloc((size_t)settings->frame_count, sizeof *this.frames);
+    this.tiles_done = calloc((size_t)settings->frame_count, sizeof *this.tiles_done);
+    unsigned char *const tile = malloc((size_t)tile_size * tile_size * 3);
+
+    if (this.jobs == NULL || this.frames == NULL || this.tiles_done == NULL || tile == NULL)
+    {
+        free(this.jobs);
+        free(this.frames);
+        free(this.tiles_done);
+        free(tile);
+        return false;
+    }
+
+    // frame by frame so frames complete and leave memory in order
+    for (int i = 0; i < this.job_count; ++i)
+    {
+        int const frame_tile = i % this.tiles_per_frame;
+        int const x = frame_tile % tiles_x * tile_size;
+        int const y = frame_tile / tiles_x * tile_size;
+
+        this.jobs[i] = (TileJob) {
+            .frame = i / this.tiles_per_frame,
+            .x = x,
+            .y = y,
+            .width = x + tile_size > settings->width ? settings->width - x : tile_size,
+            .height = y + tile_size > settings->height ? settings->height - y : tile_size,
+            .state = TILE_JOB_PENDING,
+        };
+    }
+
+    int connected = 0;
+    bool success = true;
+    double const start = runtime_clock_now();
+
+    while (this.next_output < settings->frame_count)
+    {
+        if (this.worker_count == 0 && connected >= expected_workers)
+        {
+            fprintf(stderr, "error: every worker was lost\n");
+            success = false;
+            break;
+        }
+
+        struct pollfd poll_handles[DISTRIBUTED_MAX_WORKERS + 1];
+        for (int i = 0; i < this.worker_count; ++i)
+        {
+            poll_handles[i] = (struct pollfd) {.fd = this.workers[i].socket, .events = POLLIN};
+        }
+
+        poll_handles[this.worker_count] = (struct pollfd) {.fd = listener, .events = POLLIN};
+
+        int const handle_count = this.worker_count + 1;
+        if (poll(poll_handles, (nfds_t)handle_count, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+
+            success = false;
+            break;
+        }
+
+        // walk backwards, dropping a worker moves the last one into its place
+        for (int i = handle_count - 2; i >= 0; --i)
+        {
+            if (poll_handles[i].revents == 0) continue;
+
+            if (!coordinator_receive(&this, this.workers + i, tile))
+            {
+                coordinator_drop_worker(&this, i);
+            }
+        }
+
+        if ((poll_handles[handle_count - 1].revents & POLLIN) != 0)
+        {
+            int const socket_handle = accept(listener, NULL, NULL);
+            if (socket_handle >= 0 && this.worker_count == DISTRIBUTED_MAX_WORKERS)
+            {
+                close(socket_handle);
+            }
+            else if (socket_handle >= 0)
+            {
+                ++connected;
+                distributed_set_no_delay(socket_handle);
+                this.workers[this.worker_count++] = (DistributedWorker) {socket_handle, -1};
+            }
+        }
+
+        // idle workers include new ones and ones that were idle until a lost
+        // worker's job came back
+        for (int i = this.worker_count - 1; i >= 0; --i)
+        {
+            if (this.workers[i].job < 0 && !coordinator_assign(&this, this.workers + i))
+            {
+                coordinator_drop_worker(&this, i);
+            }
+        }
+    }
+
+    this.stats.seconds = runtime_clock_now() - start;
+    this.stats.jobs = this.job_count;
+    *stats = this.stats;
+
+    TileJobMessage const quit = {.type = TILE_MESSAGE_QUIT};
+    for (int i = 0; i < this.worker_count; ++i)
+    {
+        distributed_send_all(this.workers[i].socket, &quit, sizeof quit);
+        close(this.workers[i].socket);
+    }
+
+    for (int i = 0; i < settings->frame_count; ++i)
+    {
+        free(this.frames[i]);
+    }
+
+    free(this.jobs);
+    free(this.frames);
+    free(this.tiles_done);
+    free(tile);
+    return success;
+}
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef CPU_FRAME_GENERATION_H
+#define CPU_FRAME_GENERATION_H
+
+// cpu reference for frame generation: every other displayed frame is not
+// traced but warped from the last two traced ones. everything in
+// distance_function moves as a known function of the timer, so the point a
+// texel hit can be carried from the time it was traced to the time being
+// displayed and projected back onto the screen. generate_ps_main in
+// shaders.hlsl gathers the same way, per output pixel it searches the
+// traced frame for the texel that lands on it, falls back to the older
+// traced frame where the newer one has nothing (a disocclusion) and to the
+// background next to the pixel where neither has
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "scene.h"
+
+// a texel has to land within this many pixels of the output pixel
+#define FRAME_GENERATION_TOLERANCE 1.0f
+#define FRAME_GENERATION_ITERATIONS 3
+
+// the inverses of scene_logo_local, scene_light_local and scene_board_local
+static float3 scene_logo_world(float3 local, float const timer)
+{
+    float2 const xz = rotate2(f2(local.x - .1f * sinf(timer), local.z - .1f * sinf(timer)), -timer);
+    float2 const xy = rotate2(f2(xz.x, local.y), -timer);
+    return f3(xy.x, xy.y - .5f, xz.y);
+}
+
+static float3 scene_light_world(float3 const local, float const timer)
+{
+    float2 const xz = rotate2(f2(local.x, local.z), timer);
+    return f3(xz.x, local.y + 2.0f, xz.y);
+}
+
+static float3 scene_board_world(float3 const local, float const timer)
+{
+    float2 const xz = rotate2(f2(local.x, local.z - timer), -timer * 0.5f);
+    float2 const zy = rotate2(f2(xz.y, local.y - 2.3f), -sinf(timer) * 0.3f);
+    return f3(xz.x, zy.y, zy.x);
+}
+
+// the height of the pylon nearest to a point on the board, hexagon_sdf picks it the same way
+static float scene_pylon_height(float2 const p, float const pH, float const timer)
+{
+    float nearest = INFINITY;
+    float height = 0.0f;
+    for (int i = 0; i < HEXAGON_CELL_LATTICES; ++i)
+    {
+        float2 const cell = hexagon_cell_center(p, i);
+        float const ht = hexagon_hash(cell, timer);
+        float const distance = hexagon_pylon(hexagon_cell_offset(p, cell.x, cell.y),
+                                             pH, HEXAGON_PYLON_RADIUS, ht);
+        if (distance < nearest)
+        {
+            nearest = distance;
+            height = ht;
+        }
+    }
+
+    return height;
+}
+
+// where the point hit on material at from_timer is at to_timer. the pylons
+// also grow and shrink, their points are scaled along the pylon with it
+static float3 scene_motion(float3 const pos, int const material,
+                           float const from_timer, float const to_timer)
+{
+    if (material >= 0 && material < (int)SCENE_HEXAGON_MATERIAL)
+    {
+        return scene_logo_world(scene_logo_local(pos, from_timer), to_timer);
+    }
+
+    if (material == (int)SCENE_HEXAGON_MATERIAL)
+    {
+        float3 local = scene_board_local(pos, from_timer);
+        float2 const p = f2(local.x, local.z);
+
+        float const from_height = scene_pylon_height(p, -local.y, from_timer);
+        float const to_height = scene_pylon_height(p, -local.y, to_timer);
+        if (from_height > 0.01f) local.y *= to_height / from_height;
+
+        return scene_board_world(local, to_timer);
+    }
+
+    if (material == (int)SCENE_LIGHT_MATERIAL)
+    {
+        return scene_light_world(scene_light_local(pos, from_timer), to_timer);
+    }
+
+    return pos;
+}
+
+// look_at_ray for the fixed camera and its inverse
+typedef struct
+{
+    float3 eye;
+    float3 view_direction;
+    float3 u;
+    float3 v;
+    float3 bottom_left;
+    float half_width;
+    float half_height;
+} SceneCamera;
+
+static SceneCamera scene_camera(SceneConstants const *const constants)
+{
+    float3 const eye = scene_camera_position();
+    float3 const look_at = scene_camera_look_at();
+    float3 const view_direction = sub3(look_at, eye);
+    float3 const up = f3(0, 1, 0);
+
+    SceneCamera camera = {
+        .eye = eye,
+        .view_direction = view_direction,
+        .u = normalize3(cross3(view_direction, up)),
+        .v = normalize3(cross3(cross3(view_direction, up), view_direction)),
+        .half_width = tanf(to_radians(60.0f) / 2.0f),
+    };
+
+    camera.half_height = camera.half_width * constants->aspect_ratio;
+    camera.bottom_left = sub3(sub3(look_at, scale3(camera.v, camera.half_height)),
+                              scale3(camera.u, camera.half_width));
+    return camera;
+}
+
+// the position on screen in pixels, pixel (x, y) covers [x, x + 1) x [y, y + 1),
+// false behind the camera
+static bool scene_project(SceneCamera const *const camera, float3 const pos,
+                          int const width, int const height, float2 *const pixel)
+{
+    float3 const to_pos = sub3(pos, camera->eye);
+    float const along = dot3(to_pos, camera->view_direction);
+    if (along <= 0.0f) return false;
+
+    // where the line from the eye crosses the view plane through look_at
+    float const scale = dot3(camera->view_direction, camera->view_direction) / along;
+    float3 const on_plane = sub3(add3(camera->eye, scale3(to_pos, scale)), camera->bottom_left);
+
+    float2 const coords = f2(dot3(on_plane, camera->u) / (2.0f * camera->half_width),
+                             dot3(on_plane, camera->v) / (2.0f * camera->half_height));
+
+    *pixel = f2(coords.x * (float)width, (1.0f - coords.y) * (float)height);
+    return true;
+}
+
+// a traced frame with where each of its texels is at the time being generated.
+// the shader works the motion out per fetch, here it is done once per texel
+typedef struct
+{
+    GBufferTexel const *gbuffer;
+    float timer;
+    float2 *motion;     // pixels from the texel to where it lands
+    float *depth;       // distance from the eye when it lands, SCENE_MAX_DISTANCE if it does not
+} FrameGenerationSource;
+
+static void frame_generation_motion(SceneConstants const *const constants,
+                                    SceneCamera const *const camera,
+                                    int const width, int const height,
+                                    float const to_timer, FrameGenerationSource *const source)
+{
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            size_t const i = (size_t)y * width + x;
+            GBufferTexel const *const texel = source->gbuffer + i;
+
+            // the background only depends on the ray direction, it stays where it is
+            source->motion[i] = f2(0.0f, 0.0f);
+            source->depth[i] = SCENE_MAX_DISTANCE;
+            if (texel->material == GBUFFER_MATERIAL_MISS) continue;
+
+            Ray const ray = look_at_ray(constants, scene_camera_position(),
+                                        scene_camera_look_at(), to_radians(60.0f),
+                                        scene_pixel_coords(x, y, width, height));
+
+            float3 const hit = add3(ray.pos, scale3(ray.dir, texel->depth));
+            float3 const moved = scene_motion(hit, (int)texel->material, source->timer, to_timer);
+
+            float2 pixel;
+            if (!scene_project(camera, moved, width, height, &pixel))
+            {
+                // off behind the camera, never lands anywhere
+                source->motion[i] = f2((float)(2 * width), 0.0f);
+                continue;
+            }
+
+            source->motion[i] = sub2(pixel, f2((float)x + 0.5f, (float)y + 0.5f));
+            source->depth[i] = length3(sub3(moved, camera->eye));
+        }
+    }
+}
+
+static inline size_t frame_generation_index(int x, int y, int const width, int const height)
+{
+    x = x < 0 ? 0 : x >= width ? width - 1 : x;
+    y = y < 0 ? 0 : y >= height ? height - 1 : y;
+    return (size_t)y * width + x;
+}
+
+// searches from a guess of the motion for the texel that lands on pixel
+// (x, y), the nearest of the texels found from the guesses wins. returns
+// the texel index or -1 when none lands close enough
+static long frame_generation_find(FrameGenerationSource const *const source,
+                                  int const width, int const height,
+                                  int const x, int const y,
+                                  float2 const *const guesses, int const guess_count)
+{
+    float2 const center = f2((float)x + 0.5f, (float)y + 0.5f);
+
+    long best = -1;
+    float best_depth = INFINITY;
+    for (int g = 0; g < guess_count; ++g)
+    {
+        // fixed point iteration of texel = pixel - motion(texel)
+        float2 motion = guesses[g];
+        size_t index = 0;
+        for (int i = 0; i < FRAME_GENERATION_ITERATIONS; ++i)
+        {
+            float2 const texel = sub2(center, motion);
+            index = frame_generation_index((int)floorf(texel.x), (int)floorf(texel.y),
+                                           width, height);
+            motion = source->motion[index];
+        }
+
+        float2 const texel_center = f2((float)(index % width) + 0.5f,
+                                       (float)(index / width) + 0.5f);
+        float2 const miss = sub2(add2(texel_center, source->motion[index]), center);
+
+        if (fabsf(miss.x) <= FRAME_GENERATION_TOLERANCE &&
+            fabsf(miss.y) <= FRAME_GENERATION_TOLERANCE &&
+            source->depth[index] < best_depth)
+        {
+            best = (long)index;
+            best_depth = source->depth[index];
+        }
+    }
+
+    return best;
+}
+
+// the motion of the nearest and the farthest texel around the pixel, objects
+// moving over it start the search from the first, revealed background the second
+static void frame_generation_guesses(FrameGenerationSource const *const source,
+                                     int const width, int const height, int const x, int const y,
+                                     float2 *const nearest, float2 *const farthest)
+{
+    float nearest_depth = INFINITY;
+    float farthest_depth = -INFINITY;
+
+    for (int dy = -1; dy <= 1; ++dy)
+    {
+        for (int dx = -1; dx <= 1; ++dx)
+        {
+            size_t const index = frame_generation_index(x + dx, y + dy, width, height);
+            float const depth = source->gbuffer[index].depth;
+
+            if (depth < nearest_depth)
+            {
+                nearest_depth = depth;
+                *nearest = source->motion[index];
+            }
+
+            if (depth > farthest_depth)
+            {
+                farthest_depth = depth;
+                *farthest = source->motion[index];
+            }
+        }
+    }
+}
+
+typedef struct
+{
+    long from_newer;
+    long from_older;
+    long filled;        // disocclusions neither frame saw
+} FrameGenerationStats;
+
+// generates the g-buffer of the frame at constants->timer from the newer
+// traced frame and, if not NULL, the older one. the texels keep the color,
+// normal and material they were traced with, the depth is where they land
+static void frame_generation_generate(SceneConstants const *const constants,
+                                      int const width, int const height,
+                                      FrameGenerationSource *const newer,
+                                      FrameGenerationSource *const older,
+                                      GBufferTexel *const output,
+                                      FrameGenerationStats *const stats)
+{
+    SceneCamera const camera = scene_camera(constants);
+
+    frame_generation_motion(constants, &camera, width, height, constants->timer, newer);
+    if (older != NULL)
+    {
+        frame_generation_motion(constants, &camera, width, height, constants->timer, older);
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            size_t const i = (size_t)y * width + x;
+
+            float2 guesses[3];
+            guesses[0] = newer->motion[i];
+            frame_generation_guesses(newer, width, height, x, y, guesses + 1, guesses + 2);
+
+            FrameGenerationSource const *source = newer;
+            long index = frame_generation_find(newer, width, height, x, y, guesses, 2);
+
+            if (index >= 0)
+            {
+                ++stats->from_newer;
+            }
+            else if (older != NULL)
+            {
+                float2 older_guesses[2];
+                older_guesses[0] = older->motion[i];
+                frame_generation_guesses(older, width, height, x, y,
+                                         older_guesses + 1, &(float2) {0});
+
+                source = older;
+                index = frame_generation_find(older, width, height, x, y, older_guesses, 2);
+                if (index >= 0) ++stats->from_older;
+            }
+
+            if (index < 0)
+            {
+                // whatever was behind the pixel moves like the background around it
+                float2 const texel = sub2(f2((float)x + 0.5f, (float)y + 0.5f), guesses[2]);
+                source = newer;
+                index = (long)frame_generation_index((int)floorf(texel.x), (int)floorf(texel.y),
+                                                     width, height);
+                ++stats->filled;
+            }
+
+            GBufferTexel texel = source->gbuffer[index];
+            texel.depth = fminf(source->depth[index], SCENE_MAX_DISTANCE);
+            output[i] = gbuffer_quantize(texel);
+        }
+    }
+}
+
+#endif
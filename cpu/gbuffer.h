@@ -0,0 +1,170 @@
+#ifndef CPU_GBUFFER_H
+#define CPU_GBUFFER_H
+
+// the g-buffer layout ps_main writes, encoded the same way as shaders.hlsl:
+//   color:   DXGI_FORMAT_R11G11B10_FLOAT
+//   gbuffer: DXGI_FORMAT_R32_UINT, bits 0-15 octahedral normal (8 bits per
+//            axis), bits 16-27 linear depth, bits 28-31 material
+
+#include "vec.h"
+
+#define GBUFFER_MAX_DEPTH 8.0f
+#define GBUFFER_DEPTH_BITS 12
+#define GBUFFER_MATERIAL_MISS 15
+
+// one texel of the render targets ps_main writes, decoded
+typedef struct
+{
+    float3 color;
+    float3 normal;  // unit length, (0, 0, 1) when nothing was hit
+    float depth;    // distance to the first hit of the first sample
+    float material; // material of that hit, GBUFFER_MATERIAL_MISS when nothing was hit
+} GBufferTexel;
+
+// the texel as it is stored, 8 bytes
+typedef struct
+{
+    uint32_t color;
+    uint32_t gbuffer;
+} CompactTexel;
+
+static inline float sign_not_zero(float const value) { return value >= 0.0f ? 1.0f : -1.0f; }
+
+static inline uint32_t quantize_unorm(float const value, uint32_t const max_value)
+{
+    return (uint32_t)(saturate(value) * (float)max_value + 0.5f);
+}
+
+static uint32_t encode_octahedral_normal(float3 n)
+{
+    float const length = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    n = length > 0.0f ? scale3(n, 1.0f / length) : f3(0, 0, 1);
+
+    float2 e = f2(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        e = f2((1.0f - fabsf(n.y)) * sign_not_zero(n.x),
+               (1.0f - fabsf(n.x)) * sign_not_zero(n.y));
+    }
+
+    return quantize_unorm(e.x * 0.5f + 0.5f, 255) |
+           (quantize_unorm(e.y * 0.5f + 0.5f, 255) << 8);
+}
+
+static float3 decode_octahedral_normal(uint32_t const bits)
+{
+    float2 const e = f2((float)(bits & 0xff) / 255.0f * 2.0f - 1.0f,
+                        (float)((bits >> 8) & 0xff) / 255.0f * 2.0f - 1.0f);
+
+    float3 n = f3(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+    float const t = saturate(-n.z);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+
+    return normalize3(n);
+}
+
+static inline uint32_t pack_gbuffer(float3 const normal, float const depth, int const material)
+{
+    uint32_t const depth_bits =
+        quantize_unorm(depth / GBUFFER_MAX_DEPTH, (1U << GBUFFER_DEPTH_BITS) - 1);
+    uint32_t const material_bits =
+        material < 0 || material > GBUFFER_MATERIAL_MISS ? GBUFFER_MATERIAL_MISS : (uint32_t)material;
+
+    return encode_octahedral_normal(normal) | (depth_bits << 16) | (material_bits << 28);
+}
+
+static inline void unpack_gbuffer(uint32_t const bits, float3 *const normal,
+                                  float *const depth, int *const material)
+{
+    *normal = decode_octahedral_normal(bits & 0xffff);
+    *depth = (float)((bits >> 16) & ((1U << GBUFFER_DEPTH_BITS) - 1)) /
+             (float)((1U << GBUFFER_DEPTH_BITS) - 1) * GBUFFER_MAX_DEPTH;
+    *material = (int)(bits >> 28);
+}
+
+// unsigned float with a 5 bit exponent, like the channels of R11G11B10_FLOAT,
+// rounded to nearest and clamped to the largest finite value
+static uint32_t encode_small_float(float const value, int const mantissa_bits)
+{
+    uint32_t const max_finite = (30U << mantissa_bits) | ((1U << mantissa_bits) - 1);
+    if (!(value > 0.0f)) return 0;
+
+    uint32_t const bits = as_uint(value);
+    int const exponent = (int)(bits >> 23) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent >= 31) return max_finite;
+
+    uint32_t result;
+    if (exponent <= 0)
+    {
+        // denormal
+        int const shift = 23 - mantissa_bits + 1 - exponent;
+        if (shift > 24) return 0;
+
+        mantissa |= 0x800000;
+        result = (mantissa + (1U << (shift - 1))) >> shift;
+    }
+    else
+    {
+        int const shift = 23 - mantissa_bits;
+        result = ((uint32_t)exponent << mantissa_bits) | (mantissa >> shift);
+        result += (mantissa >> (shift - 1)) & 1;
+    }
+
+    return result > max_finite ? max_finite : result;
+}
+
+static float decode_small_float(uint32_t const bits, int const mantissa_bits)
+{
+    uint32_t const exponent = bits >> mantissa_bits;
+    float const mantissa = (float)(bits & ((1U << mantissa_bits) - 1)) /
+                           (float)(1U << mantissa_bits);
+
+    if (exponent == 0) return ldexpf(mantissa, -14);
+    if (exponent == 31) return INFINITY;
+    return ldexpf(1.0f + mantissa, (int)exponent - 15);
+}
+
+static inline uint32_t encode_r11g11b10(float3 const color)
+{
+    return encode_small_float(color.x, 6) |
+           (encode_small_float(color.y, 6) << 11) |
+           (encode_small_float(color.z, 5) << 22);
+}
+
+static inline float3 decode_r11g11b10(uint32_t const bits)
+{
+    return f3(decode_small_float(bits & 0x7ff, 6),
+              decode_small_float((bits >> 11) & 0x7ff, 6),
+              decode_small_float(bits >> 22, 5));
+}
+
+static inline CompactTexel gbuffer_encode(GBufferTexel const texel)
+{
+    return (CompactTexel) {
+        encode_r11g11b10(texel.color),
+        pack_gbuffer(texel.normal, texel.depth, (int)texel.material),
+    };
+}
+
+static inline GBufferTexel gbuffer_decode(CompactTexel const texel)
+{
+    GBufferTexel result;
+    int material;
+
+    result.color = decode_r11g11b10(texel.color);
+    unpack_gbuffer(texel.gbuffer, &result.normal, &result.depth, &material);
+    result.material = (float)material;
+
+    return result;
+}
+
+// what a texel reads back as after a trip through the render targets
+static inline GBufferTexel gbuffer_quantize(GBufferTexel const texel)
+{
+    return gbuffer_decode(gbuffer_encode(texel));
+}
+
+#endif
@@ -0,0 +1,513 @@
+#ifndef CPU_MICROBENCH_H
+#define CPU_MICROBENCH_H
+
+// per function benchmarks of the pieces of the scene. the inputs of every
+// function are captured from the camera rays of a real frame, marched with
+// the level of detail cone like ray_march: each point it evaluates is taken
+// apart the way distance_function does it, so windows_logo_sdf sees the
+// rotated logo space points and hexagon_sdf the board space ones. each function runs over its inputs in batches, the first
+// batches warm the caches and branch predictors and are dropped, the rest
+// are reduced to a median with outliers past MICROBENCH_OUTLIER_MADS median
+// absolute deviations left out
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scene.h"
+#include "../runtime.h"
+
+#define MICROBENCH_WARMUP_BATCHES 3
+#define MICROBENCH_BATCHES 21
+#define MICROBENCH_OUTLIER_MADS 3.0
+
+typedef struct
+{
+    int width;              // of the capture grid
+    int height;
+    SceneConstants constants;
+
+    // one entry for every point ray_march evaluates
+    int point_count;
+    float3 *points;
+    float *epsilon;         // the hit epsilon of the march at the point
+    float2 *logo_uv;        // windows_logo_sdf, in logo space
+    float3 *logo_pos;       // op_extrude, with the 2d distance of the logo
+    float *logo_distance;
+    float2 *board_p;        // hexagon_sdf, in board space
+    float *board_height;
+    float2 *pylon_p;        // hexagon_pylon and hexagon_hash, for the first cell
+    float *pylon_height;
+    float2 *cell;
+
+    // one entry for every camera ray that hit something
+    int hit_count;
+    float3 *hits;
+
+    // one entry for every pixel of the grid
+    int pixel_count;
+    float2 *coords;
+    uint32_t *seeds;        // the bits of coords, like seed_hash
+
+    GBufferTexel *gbuffer;  // a traced frame for the post pass
+} MicrobenchInputs;
+
+typedef struct
+{
+    char const *name;
+    int calls;              // per batch
+    double median_ns;       // per call
+    double min_ns;
+    double mad_ns;          // median absolute deviation
+    int outliers;           // batches left out of the mean
+    double mean_ns;         // of the batches that are not outliers
+} MicrobenchResult;
+
+static void microbench_inputs_free(MicrobenchInputs *const this)
+{
+    void *const arrays[] = {
+        this->points, this->epsilon, this->logo_uv, this->logo_pos, this->logo_distance, this->board_p,
+        this->board_height, this->pylon_p, this->pylon_height, this->cell, this->hits,
+        this->coords, this->seeds, this->gbuffer,
+    };
+
+    for (size_t i = 0; i < sizeof arrays / sizeof *arrays; ++i)
+    {
+        free(arrays[i]);
+    }
+}
+
+// marches the camera rays of a width x height grid with the level of detail
+// cone of the frame being benchmarked and takes every point apart. returns
+// false when out of memory, mismatches counts the points where the pieces do
+// not add up to distance_function, which means this file and scene.h went out
+// of sync
+static bool microbench_capture(MicrobenchInputs *const this, int const width, int const height,
+                               float const timer, float const cone, int *const mismatches)
+{
+    size_t const pixels = (size_t)width * height;
+    size_t const capacity = pixels * SCENE_MAX_STEPS;
+
+    *this = (MicrobenchInputs) {
+        .width = width,
+        .height = height,
+        .constants = scene_constants(width, height, timer),
+        .points = malloc(capacity * sizeof(float3)),
+        .epsilon = malloc(capacity * sizeof(float)),
+        .logo_uv = malloc(capacity * sizeof(float2)),
+        .logo_pos = malloc(capacity * sizeof(float3)),
+        .logo_distance = malloc(capacity * sizeof(float)),
+        .board_p = malloc(capacity * sizeof(float2)),
+        .board_height = malloc(capacity * sizeof(float)),
+        .pylon_p = malloc(capacity * sizeof(float2)),
+        .pylon_height = malloc(capacity * sizeof(float)),
+        .cell = malloc(capacity * sizeof(float2)),
+        .hits = malloc(pixels * sizeof(float3)),
+        .coords = malloc(pixels * sizeof(float2)),
+        .seeds = malloc(pixels * 2 * sizeof(uint32_t)),
+        .gbuffer = malloc(pixels * sizeof(GBufferTexel)),
+    };
+
+    if (this->points == NULL || this->epsilon == NULL || this->logo_uv == NULL || this->logo_pos == NULL ||
+        this->logo_distance == NULL || this->board_p == NULL || this->board_height == NULL ||
+        this->pylon_p == NULL || this->pylon_height == NULL || this->cell == NULL ||
+        this->hits == NULL || this->coords == NULL || this->seeds == NULL ||
+        this->gbuffer == NULL)
+    {
+        microbench_inputs_free(this);
+        return false;
+    }
+
+    *mismatches = 0;
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            float2 const coords = scene_pixel_coords(x, y, width, height);
+            this->coords[this->pixel_count] = coords;
+            this->seeds[this->pixel_count * 2 + 0] = as_uint(coords.x);
+            this->seeds[this->pixel_count * 2 + 1] = as_uint(coords.y);
+            ++this->pixel_count;
+
+            Ray const ray = look_at_ray(&this->constants, scene_camera_position(),
+                                        scene_camera_look_at(), to_radians(60.0f), coords);
+
+            // the same loop as ray_march
+            float distance_traveled = 0.0f;
+            for (int i = 0; i < SCENE_MAX_STEPS; ++i)
+            {
+                float3 const position = add3(ray.pos, scale3(ray.dir, distance_traveled));
+                float const epsilon = fminf(fmaxf(SCENE_MIN_DISTANCE, distance_traveled * cone),
+                                            SCENE_LOD_MAX_EPSILON);
+                int const n = this->point_count++;
+
+                float3 const logo = scene_logo_local(position, timer);
+                float const logo_2d = windows_logo_sdf(f2(logo.x, logo.y)).distance;
+
+                float3 const board = scene_board_local(position, timer);
+                float2 const board_p = f2(board.x, board.z);
+                float2 const cell = f2(floorf(board_p.x / .866025f), floorf(board_p.y));
+
+                this->points[n] = position;
+                this->epsilon[n] = cone > 0.0f ? epsilon : 0.0f;
+                this->logo_uv[n] = f2(logo.x, logo.y);
+                this->logo_pos[n] = logo;
+                this->logo_distance[n] = logo_2d;
+                this->board_p[n] = board_p;
+                this->board_height[n] = -board.y;
+                this->pylon_p[n] = hexagon_cell_offset(board_p, cell.x, cell.y);
+                this->pylon_height[n] = hexagon_hash(cell, timer);
+                this->cell[n] = cell;
+
+                float const distance = distance_function(position, timer).distance;
+                float const pieces =
+                    fminf(fminf(op_extrude(logo, logo_2d, 0.1f),
+                                light_sdf(scene_light_local(position, timer))),
+                          hexagon_sdf(board_p, -board.y, timer).distance);
+
+                *mismatches += pieces != distance;
+
+                // the march itself steps like ray_march, with the level of detail
+                float const step = distance_function_lod(position, timer,
+                                                         this->epsilon[n]).distance;
+                if (fabsf(step) < epsilon)
+                {
+                    this->hits[this->hit_count++] = position;
+                    break;
+                }
+
+                distance_traveled += step;
+                if (step > SCENE_MAX_DISTANCE) break;
+            }
+        }
+    }
+
+    scene_trace_rows(&this->constants, width, height, 0, height, this->gbuffer);
+    return true;
+}
+
+// a batch calls the function once for every input and returns something
+// that depends on every result, so no call can be optimized away
+typedef float (*MicrobenchBatch)(MicrobenchInputs const *inputs);
+
+static float microbench_windows_logo_sdf(MicrobenchInputs const *const inputs)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->point_count; ++i)
+    {
+        DistanceInfo const info = windows_logo_sdf(inputs->logo_uv[i]);
+        sum += info.distance + info.material;
+    }
+    return sum;
+}
+
+static float microbench_op_extrude(MicrobenchInputs const *const inputs)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->point_count; ++i)
+    {
+        sum += op_extrude(inputs->logo_pos[i], inputs->logo_distance[i], 0.1f);
+    }
+    return sum;
+}
+
+static float microbench_hexagon_sdf(MicrobenchInputs const *const inputs)
+{
+    float const timer = inputs->constants.timer;
+
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->point_count; ++i)
+    {
+        sum += hexagon_sdf(inputs->board_p[i], inputs->board_height[i], timer).distance;
+    }
+    return sum;
+}
+
+static float microbench_hexagon_pylon(MicrobenchInputs const *const inputs)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->point_count; ++i)
+    {
+        sum += hexagon_pylon(inputs->pylon_p[i], inputs->board_height[i], .25f,
+                             inputs->pylon_height[i]);
+    }
+    return sum;
+}
+
+// at the epsilon the march used, or the smallest one when it marched at full detail
+static float microbench_hexagon_sdf_far(MicrobenchInputs const *const inputs)
+{
+    float const timer = inputs->constants.timer;
+
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->point_count; ++i)
+    {
+        sum += hexagon_sdf_far(inputs->board_p[i], inputs->board_height[i], timer,
+                               fmaxf(inputs->epsilon[i], SCENE_MIN_DISTANCE)).distance;
+    }
+    return sum;
+}
+
+static float microbench_logo_bound(MicrobenchInputs const *const inputs)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->point_count; ++i)
+    {
+        sum += scene_logo_bound(inputs->logo_pos[i]);
+    }
+    return sum;
+}
+
+static float microbench_board_bound(MicrobenchInputs const *const inputs)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->point_count; ++i)
+    {
+        sum += scene_board_bound(f3(0.0f, -inputs->board_height[i], 0.0f));
+    }
+    return sum;
+}
+
+static float microbench_hexagon_hash(MicrobenchInputs const *const inputs)
+{
+    float const timer = inputs->constants.timer;
+
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->point_count; ++i)
+    {
+        sum += hexagon_hash(inputs->cell[i], timer);
+    }
+    return sum;
+}
+
+static float microbench_distance_function(MicrobenchInputs const *const inputs)
+{
+    float const timer = inputs->constants.timer;
+
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->point_count; ++i)
+    {
+        sum += distance_function(inputs->points[i], timer).distance;
+    }
+    return sum;
+}
+
+// at the epsilon the march used, so the bounds and far pylons run where they would
+static float microbench_distance_function_lod(MicrobenchInputs const *const inputs)
+{
+    float const timer = inputs->constants.timer;
+
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->point_count; ++i)
+    {
+        sum += distance_function_lod(inputs->points[i], timer, inputs->epsilon[i]).distance;
+    }
+    return sum;
+}
+
+static float microbench_calculate_normal(MicrobenchInputs const *const inputs)
+{
+    float const timer = inputs->constants.timer;
+
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->hit_count; ++i)
+    {
+        float3 const normal = calculate_normal(inputs->hits[i], timer);
+        sum += normal.x + normal.y + normal.z;
+    }
+    return sum;
+}
+
+static float microbench_look_at_ray(MicrobenchInputs const *const inputs)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->pixel_count; ++i)
+    {
+        Ray const ray = look_at_ray(&inputs->constants, scene_camera_position(),
+                                    scene_camera_look_at(), to_radians(60.0f),
+                                    inputs->coords[i]);
+        sum += ray.dir.x + ray.dir.y + ray.dir.z;
+    }
+    return sum;
+}
+
+static float microbench_base_hash(MicrobenchInputs const *const inputs)
+{
+    uint32_t hash = 0;
+    for (int i = 0; i < inputs->pixel_count; ++i)
+    {
+        hash ^= base_hash(inputs->seeds[i * 2 + 0], inputs->seeds[i * 2 + 1]);
+    }
+    return (float)hash;
+}
+
+static float microbench_hash22(MicrobenchInputs const *const inputs)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < inputs->pixel_count; ++i)
+    {
+        float2 seed = inputs->coords[i];
+        float2 const value = hash22(&seed);
+        sum += value.x + value.y;
+    }
+    return sum;
+}
+
+static float microbench_post_pixel(MicrobenchInputs const *const inputs)
+{
+    float sum = 0.0f;
+    for (int y = 0; y < inputs->height; ++y)
+    {
+        for (int x = 0; x < inputs->width; ++x)
+        {
+            float3 const color = scene_post_pixel(inputs->gbuffer, inputs->width,
+                                                  inputs->height, x, y);
+            sum += color.x + color.y + color.z;
+        }
+    }
+    return sum;
+}
+
+static int microbench_compare_doubles(void const *const a, void const *const b)
+{
+    double const x = *(double const *)a;
+    double const y = *(double const *)b;
+    return (x > y) - (x < y);
+}
+
+static double microbench_median(double *const values, int const count)
+{
+    qsort(values, (size_t)count, sizeof *values, &microbench_compare_doubles);
+    return count % 2 != 0 ? values[count / 2] :
+                            (values[count / 2 - 1] + values[count / 2]) * 0.5;
+}
+
+// the result goes to a volatile so the compiler has to finish every batch
+static float volatile microbench_sink;
+
+static MicrobenchResult microbench_run(char const *const name, MicrobenchBatch const batch,
+                                       MicrobenchInputs const *const inputs, int const calls)
+{
+    MicrobenchResult result = {.name = name, .calls = calls};
+    if (calls == 0) return result;
+
+    for (int i = 0; i < MICROBENCH_WARMUP_BATCHES; ++i)
+    {
+        microbench_sink = batch(inputs);
+    }
+
+    int64_t const frequency = runtime_clock_frequency();
+    double samples[MICROBENCH_BATCHES];
+
+    for (int i = 0; i < MICROBENCH_BATCHES; ++i)
+    {
+        int64_t const start = runtime_clock_ticks();
+        microbench_sink = batch(inputs);
+        int64_t const end = runtime_clock_ticks();
+
+        samples[i] = runtime_clock_seconds(end - start, frequency) * 1e9 / (double)calls;
+    }
+
+    result.median_ns = microbench_median(samples, MICROBENCH_BATCHES);
+    result.min_ns = samples[0];
+
+    // samples is sorted now, the deviations go into a copy
+    double deviations[MICROBENCH_BATCHES];
+    for (int i = 0; i < MICROBENCH_BATCHES; ++i)
+    {
+        deviations[i] = fabs(samples[i] - result.median_ns);
+    }
+    result.mad_ns = microbench_median(deviations, MICROBENCH_BATCHES);
+
+    // a batch interrupted by the scheduler is far from the median, drop it
+    double sum = 0.0;
+    int kept = 0;
+    for (int i = 0; i < MICROBENCH_BATCHES; ++i)
+    {
+        if (fabs(samples[i] - result.median_ns) > MICROBENCH_OUTLIER_MADS * result.mad_ns &&
+            result.mad_ns > 0.0)
+        {
+            ++result.outliers;
+            continue;
+        }
+
+        sum += samples[i];
+        ++kept;
+    }
+
+    result.mean_ns = sum / (double)kept;
+    return result;
+}
+
+typedef struct
+{
+    char const *name;
+    MicrobenchBatch batch;
+    enum { MICROBENCH_POINTS, MICROBENCH_HITS, MICROBENCH_PIXELS } inputs;
+} MicrobenchFunction;
+
+static MicrobenchFunction const microbench_functions[] = {
+    {"windows_logo_sdf", &microbench_windows_logo_sdf, MICROBENCH_POINTS},
+    {"op_extrude", &microbench_op_extrude, MICROBENCH_POINTS},
+    {"hexagon_sdf", &microbench_hexagon_sdf, MICROBENCH_POINTS},
+    {"hexagon_pylon", &microbench_hexagon_pylon, MICROBENCH_POINTS},
+    {"hexagon_sdf far", &microbench_hexagon_sdf_far, MICROBENCH_POINTS},
+    {"logo bound", &microbench_logo_bound, MICROBENCH_POINTS},
+    {"board bound", &microbench_board_bound, MICROBENCH_POINTS},
+    {"hexagon_hash", &microbench_hexagon_hash, MICROBENCH_POINTS},
+    {"distance_function", &microbench_distance_function, MICROBENCH_POINTS},
+    {"distance_function_lod", &microbench_distance_function_lod, MICROBENCH_POINTS},
+    {"calculate_normal", &microbench_calculate_normal, MICROBENCH_HITS},
+    {"look_at_ray", &microbench_look_at_ray, MICROBENCH_PIXELS},
+    {"base_hash", &microbench_base_hash, MICROBENCH_PIXELS},
+    {"hash22", &microbench_hash22, MICROBENCH_PIXELS},
+    {"post_ps_main pixel", &microbench_post_pixel, MICROBENCH_PIXELS},
+};
+
+#define MICROBENCH_FUNCTION_COUNT \
+    ((int)(sizeof microbench_functions / sizeof *microbench_functions))
+
+static void microbench_run_all(MicrobenchInputs const *const inputs,
+                               MicrobenchResult results[MICROBENCH_FUNCTION_COUNT])
+{
+    for (int i = 0; i < MICROBENCH_FUNCTION_COUNT; ++i)
+    {
+        MicrobenchFunction const *const function = microbench_functions + i;
+        int const calls = function->inputs == MICROBENCH_POINTS ? inputs->point_count :
+                          function->inputs == MICROBENCH_HITS ? inputs->hit_count :
+                          inputs->pixel_count;
+
+        results[i] = microbench_run(function->name, function->batch, inputs, calls);
+    }
+}
+
+static bool microbench_write_json(char const *const path, MicrobenchInputs const *const inputs,
+                                  MicrobenchResult const results[MICROBENCH_FUNCTION_COUNT])
+{
+    FILE *const file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    fprintf(file, "{\n  \"grid\": [%d, %d],\n  \"timer\": %g,\n", inputs->width,
+            inputs->height, (double)inputs->constants.timer);
+    fprintf(file, "  \"warmup_batches\": %d,\n  \"batches\": %d,\n  \"functions\": [\n",
+            MICROBENCH_WARMUP_BATCHES, MICROBENCH_BATCHES);
+
+    for (int i = 0; i < MICROBENCH_FUNCTION_COUNT; ++i)
+    {
+        MicrobenchResult const *const result = results + i;
+        double const calls_per_second = result->median_ns > 0.0 ? 1e9 / result->median_ns : 0.0;
+
+        fprintf(file, "    {\"name\": \"%s\", \"calls\": %d, \"ns_per_call\": %.3f, "
+                      "\"min_ns\": %.3f, \"mad_ns\": %.3f, \"mean_ns\": %.3f, "
+                      "\"outliers\": %d, \"calls_per_second\": %.0f}%s\n",
+                result->name, result->calls, result->median_ns, result->min_ns,
+                result->mad_ns, result->mean_ns, result->outliers, calls_per_second,
+                i + 1 < MICROBENCH_FUNCTION_COUNT ? "," : "");
+    }
+
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+#endif
@@ -0,0 +1,297 @@
+#ifndef CPU_PIPELINE_H
+#define CPU_PIPELINE_H
+
+// pipelined frame engine for the cpu port. trace, denoise, tonemap and
+// output each run on their own thread over a ring of frame slots, so frame
+// n + 1 is traced while frame n is denoised. a stage starts a frame once the
+// stage before it has finished that frame, and tracing waits for the output
+// stage to free a slot, which is the back-pressure that keeps at most
+// depth frames in flight. a depth of 1 runs the stages one after another
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scene.h"
+#include "../runtime.h"
+
+typedef enum
+{
+    PIPELINE_TRACE,
+    PIPELINE_DENOISE,
+    PIPELINE_TONEMAP,
+    PIPELINE_OUTPUT,
+    PIPELINE_STAGE_COUNT,
+} PipelineStage;
+
+static char const *const pipeline_stage_names[PIPELINE_STAGE_COUNT] = {
+    "trace", "denoise", "tonemap", "output",
+};
+
+typedef struct
+{
+    GBufferTexel *gbuffer;
+    float3 *denoised;
+    unsigned char *rgb;
+    double started;     // when tracing of the frame in this slot began
+} PipelineSlot;
+
+typedef struct
+{
+    double busy;        // seconds spent working on frames
+    double waiting;     // seconds blocked on the stage before or a free slot
+} PipelineStageStats;
+
+typedef struct
+{
+    int frame_count;
+    double seconds;
+    double mean_latency;    // from the start of tracing to the end of output
+    double max_latency;
+    uint64_t checksum;      // of every output byte, equal for every depth
+    PipelineStageStats stages[PIPELINE_STAGE_COUNT];
+} PipelineStats;
+
+typedef struct
+{
+    int width;
+    int height;
+    int depth;
+    int frame_count;
+    float frame_time;
+    FILE *output;       // frames are appended as binary ppm, NULL discards them
+
+    PipelineSlot *slots;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t progress;
+    int completed[PIPELINE_STAGE_COUNT];
+
+    PipelineStats stats;
+} Pipeline;
+
+typedef struct
+{
+    Pipeline *pipeline;
+    PipelineStage stage;
+} PipelineWorker;
+
+// call with the mutex held
+static bool pipeline_can_start(Pipeline const *const this, PipelineStage const stage,
+                               int const frame)
+{
+    if (stage == PIPELINE_TRACE)
+    {
+        return frame - this->completed[PIPELINE_OUTPUT] < this->depth;
+    }
+
+    return this->completed[stage - 1] > frame;
+}
+
+static void pipeline_run_stage(Pipeline *const this, PipelineStage const stage,
+                               int const frame, PipelineSlot *const slot)
+{
+    int const width = this->width;
+    int const height = this->height;
+    size_t const pixel_count = (size_t)width * height;
+
+    switch (stage)
+    {
+        case PIPELINE_TRACE:
+        {
+            SceneConstants const constants =
+                scene_constants(width, height, (float)frame * this->frame_time);
+
+            scene_trace_rows(&constants, width, height, 0, height, slot->gbuffer);
+            break;
+        }
+
+        case PIPELINE_DENOISE:
+        {
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    slot->denoised[(size_t)y * width + x] =
+                        scene_denoise_pixel(slot->gbuffer, width, height, x, y);
+                }
+            }
+
+            break;
+        }
+
+        case PIPELINE_TONEMAP:
+        {
+            for (size_t i = 0; i < pixel_count; ++i)
+            {
+                float3 const color = saturate3(scene_tonemap(slot->denoised[i]));
+
+                slot->rgb[i * 3 + 0] = (unsigned char)(color.x * 255.0f + 0.5f);
+                slot->rgb[i * 3 + 1] = (unsigned char)(color.y * 255.0f + 0.5f);
+                slot->rgb[i * 3 + 2] = (unsigned char)(color.z * 255.0f + 0.5f);
+            }
+
+            break;
+        }
+
+        case PIPELINE_OUTPUT:
+        {
+            // fnv-1a over the frames, so every depth can be checked against depth 1
+            uint64_t hash = this->stats.checksum;
+            for (size_t i = 0; i < pixel_count * 3; ++i)
+            {
+                hash = (hash ^ slot->rgb[i]) * 0x100000001b3ULL;
+            }
+
+            this->stats.checksum = hash;
+
+            if (this->output != NULL)
+            {
+                fprintf(this->output, "P6\n%d %d\n255\n", width, height);
+                fwrite(slot->rgb, 3, pixel_count, this->output);
+            }
+
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static void *pipeline_stage_thread(void *const context)
+{
+    PipelineWorker const *const worker = context;
+    Pipeline *const this = worker->pipeline;
+    PipelineStage const stage = worker->stage;
+    PipelineStageStats *const stage_stats = this->stats.stages + stage;
+
+    for (int frame = 0; frame < this->frame_count; ++frame)
+    {
+        double const wait_start = runtime_clock_now();
+
+        pthread_mutex_lock(&this->mutex);
+        while (!pipeline_can_start(this, stage, frame))
+        {
+            pthread_cond_wait(&this->progress, &this->mutex);
+        }
+        pthread_mutex_unlock(&this->mutex);
+
+        PipelineSlot *const slot = this->slots + frame % this->depth;
+        double const work_start = runtime_clock_now();
+
+        if (stage == PIPELINE_TRACE) slot->started = work_start;
+        pipeline_run_stage(this, stage, frame, slot);
+
+        double const work_end = runtime_clock_now();
+        stage_stats->waiting += work_start - wait_start;
+        stage_stats->busy += work_end - work_start;
+
+        if (stage == PIPELINE_OUTPUT)
+        {
+            double const latency = work_end - slot->started;
+            this->stats.mean_latency += latency;
+            this->stats.max_latency = latency > this->stats.max_latency ?
+                                      latency : this->stats.max_latency;
+        }
+
+        pthread_mutex_lock(&this->mutex);
+        ++this->completed[stage];
+        pthread_cond_broadcast(&this->progress);
+        pthread_mutex_unlock(&this->mutex);
+    }
+
+    return NULL;
+}
+
+static void pipeline_free_slots(Pipeline *const this)
+{
+    for (int i = 0; i < this->depth; ++i)
+    {
+        free(this->slots[i].gbuffer);
+        free(this->slots[i].denoised);
+        free(this->slots[i].rgb);
+    }
+
+    free(this->slots);
+}
+
+// renders frame_count frames of frame_time seconds apart, returns false
+// when the slots or threads could not be created
+static bool pipeline_run(int const width, int const height, int const depth,
+                         int const frame_count, float const frame_time,
+                         FILE *const output, PipelineStats *const stats)
+{
+    size_t const pixel_count = (size_t)width * height;
+
+    Pipeline this = {
+        .width = width,
+        .height = height,
+        .depth = depth,
+        .frame_count = frame_count,
+        .frame_time = frame_time,
+        .output = output,
+        .slots = calloc((size_t)depth, sizeof(PipelineSlot)),
+        .stats = {.frame_count = frame_count, .checksum = 0xcbf29ce484222325ULL},
+    };
+
+    if (this.slots == NULL) return false;
+
+    bool success = true;
+    for (int i = 0; i < depth; ++i)
+    {
+        PipelineSlot *const slot = this.slots + i;
+        slot->gbuffer = malloc(pixel_count * sizeof *slot->gbuffer);
+        slot->denoised = malloc(pixel_count * sizeof *slot->denoised);
+        slot->rgb = malloc(pixel_count * 3);
+
+        success &= slot->gbuffer != NULL && slot->denoised != NULL && slot->rgb != NULL;
+    }
+
+    if (!success)
+    {
+        pipeline_free_slots(&this);
+        return false;
+    }
+
+    pthread_mutex_init(&this.mutex, NULL);
+    pthread_cond_init(&this.progress, NULL);
+
+    PipelineWorker workers[PIPELINE_STAGE_COUNT];
+    pthread_t threads[PIPELINE_STAGE_COUNT];
+    int started = 0;
+
+    double const start = runtime_clock_now();
+    for (; started < PIPELINE_STAGE_COUNT; ++started)
+    {
+        workers[started] = (PipelineWorker) {&this, (PipelineStage)started};
+        if (pthread_create(threads + started, NULL,
+                           &pipeline_stage_thread, workers + started) != 0)
+        {
+            break;
+        }
+    }
+
+    // without every stage the ones that did start would wait for ever
+    if (started != PIPELINE_STAGE_COUNT)
+    {
+        fprintf(stderr, "could not start the pipeline threads\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    this.stats.seconds = runtime_clock_now() - start;
+    this.stats.mean_latency /= (double)frame_count;
+    *stats = this.stats;
+
+    pthread_cond_destroy(&this.progress);
+    pthread_mutex_destroy(&this.mutex);
+    pipeline_free_slots(&this);
+    return true;
+}
+
+#endif
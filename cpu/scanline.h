@@ -0,0 +1,258 @@
+#ifndef CPU_SCANLINE_H
+#define CPU_SCANLINE_H
+
+// streaming tracer and denoiser for the cpu port. trace threads claim rows
+// in order and write them into a small ring, the calling thread runs the
+// post filter on a row as soon as the rows within SCENE_POST_RADIUS of it
+// are traced. a slot of the ring is reused once every row that reads it has
+// been filtered, so the g-buffer never exists for the whole frame and the
+// rows being filtered are still in cache. scanline_render_full does the
+// same work in two passes over a whole frame g-buffer for comparison
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "scene.h"
+
+#define SCANLINE_WINDOW_ROWS (2 * SCENE_POST_RADIUS + 1)
+#define SCANLINE_MAX_THREADS 64
+
+typedef struct
+{
+    int width;
+    int height;
+    SceneConstants constants;
+
+    GBufferTexel *rows;     // ring_rows rows, or the whole frame for the two pass render
+    int ring_rows;
+    int *slot_rows;         // the row traced into each slot, -1 before the first
+
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    int next_row;           // next row to claim for tracing
+    int traced_rows;        // every row before this one is traced
+    int filtered_rows;      // every row before this one is filtered
+} ScanlineFrame;
+
+// rows a streaming render keeps for thread_count trace threads, a window
+// for the filter plus a row in flight for every thread
+static inline int scanline_ring_rows(int const thread_count)
+{
+    return SCANLINE_WINDOW_ROWS + thread_count;
+}
+
+static void scanline_trace_row(ScanlineFrame const *const this, int const y,
+                               GBufferTexel *const row)
+{
+    for (int x = 0; x < this->width; ++x)
+    {
+        row[x] = scene_trace_pixel(&this->constants,
+                                   scene_pixel_coords(x, y, this->width, this->height));
+    }
+}
+
+// call with the mutex held. the slot of row y last held row y - ring_rows,
+// which the filter reads until row y - ring_rows + SCENE_POST_RADIUS is done
+static bool scanline_slot_free(ScanlineFrame const *const this, int const y)
+{
+    int const previous_row = y - this->ring_rows;
+    return previous_row < 0 || previous_row + SCENE_POST_RADIUS < this->filtered_rows;
+}
+
+static void *scanline_trace_thread(void *const context)
+{
+    ScanlineFrame *const this = context;
+
+    pthread_mutex_lock(&this->mutex);
+    for (;;)
+    {
+        while (this->next_row < this->height && !scanline_slot_free(this, this->next_row))
+        {
+            pthread_cond_wait(&this->changed, &this->mutex);
+        }
+
+        if (this->next_row >= this->height) break;
+
+        int const y = this->next_row++;
+        int const slot = y % this->ring_rows;
+        pthread_mutex_unlock(&this->mutex);
+
+        scanline_trace_row(this, y, this->rows + (size_t)slot * this->width);
+
+        pthread_mutex_lock(&this->mutex);
+        this->slot_rows[slot] = y;
+
+        // rows can finish out of order, only advance over a complete prefix
+        while (this->traced_rows < this->height &&
+               this->slot_rows[this->traced_rows % this->ring_rows] == this->traced_rows)
+        {
+            ++this->traced_rows;
+        }
+
+        pthread_cond_broadcast(&this->changed);
+    }
+
+    pthread_mutex_unlock(&this->mutex);
+    return NULL;
+}
+
+static void scanline_filter_row(ScanlineFrame const *const this, int const y,
+                                unsigned char *const rgb)
+{
+    GBufferTexel const *rows[SCANLINE_WINDOW_ROWS];
+    for (int dy = -SCENE_POST_RADIUS; dy <= SCENE_POST_RADIUS; ++dy)
+    {
+        int const row = y + dy < 0 ? 0 : y + dy >= this->height ? this->height - 1 : y + dy;
+        rows[dy + SCENE_POST_RADIUS] = this->rows + (size_t)(row % this->ring_rows) * this->width;
+    }
+
+    for (int x = 0; x < this->width; ++x)
+    {
+        float3 const color = saturate3(scene_tonemap(scene_denoise_rows(rows, this->width, x)));
+
+        unsigned char *const pixel = rgb + (size_t)x * 3;
+        pixel[0] = (unsigned char)(color.x * 255.0f + 0.5f);
+        pixel[1] = (unsigned char)(color.y * 255.0f + 0.5f);
+        pixel[2] = (unsigned char)(color.z * 255.0f + 0.5f);
+    }
+}
+
+static bool scanline_frame_init(ScanlineFrame *const this, int const width, int const height,
+                                float const timer, int const ring_rows)
+{
+    *this = (ScanlineFrame) {
+        .width = width,
+        .height = height,
+        .constants = scene_constants(width, height, timer),
+        .rows = malloc((size_t)ring_rows * width * sizeof(GBufferTexel)),
+        .ring_rows = ring_rows,
+        .slot_rows = malloc((size_t)ring_rows * sizeof(int)),
+    };
+
+    if (this->rows == NULL || this->slot_rows == NULL)
+    {
+        free(this->rows);
+        free(this->slot_rows);
+        return false;
+    }
+
+    for (int i = 0; i < ring_rows; ++i)
+    {
+        this->slot_rows[i] = -1;
+    }
+
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_cond_init(&this->changed, NULL);
+    return true;
+}
+
+static void scanline_frame_destroy(ScanlineFrame *const this)
+{
+    pthread_cond_destroy(&this->changed);
+    pthread_mutex_destroy(&this->mutex);
+    free(this->rows);
+    free(this->slot_rows);
+}
+
+static bool scanline_start_threads(ScanlineFrame *const this, int const thread_count,
+                                   pthread_t *const threads)
+{
+    for (int i = 0; i < thread_count; ++i)
+    {
+        if (pthread_create(threads + i, NULL, &scanline_trace_thread, this) != 0)
+        {
+            // nobody filters yet, so a thread waiting for a free slot would wait
+            // for ever. stop handing out rows, the started threads finish the
+            // row they are tracing and return
+            pthread_mutex_lock(&this->mutex);
+            this->next_row = this->height;
+            pthread_cond_broadcast(&this->changed);
+            pthread_mutex_unlock(&this->mutex);
+
+            for (int j = 0; j < i; ++j) pthread_join(threads[j], NULL);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// renders into rgb (width * height * 3 bytes), false when out of memory or threads
+static bool scanline_render_streaming(int const width, int const height, float const timer,
+                                      int const thread_count, unsigned char *const rgb)
+{
+    ScanlineFrame this;
+    if (!scanline_frame_init(&this, width, height, timer, scanline_ring_rows(thread_count)))
+    {
+        return false;
+    }
+
+    pthread_t threads[SCANLINE_MAX_THREADS];
+    if (!scanline_start_threads(&this, thread_count, threads))
+    {
+        scanline_frame_destroy(&this);
+        return false;
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        int const last_row = y + SCENE_POST_RADIUS < height ? y + SCENE_POST_RADIUS : height - 1;
+
+        pthread_mutex_lock(&this.mutex);
+        while (this.traced_rows <= last_row)
+        {
+            pthread_cond_wait(&this.changed, &this.mutex);
+        }
+        pthread_mutex_unlock(&this.mutex);
+
+        scanline_filter_row(&this, y, rgb + (size_t)y * width * 3);
+
+        pthread_mutex_lock(&this.mutex);
+        this.filtered_rows = y + 1;
+        pthread_cond_broadcast(&this.changed);
+        pthread_mutex_unlock(&this.mutex);
+    }
+
+    for (int i = 0; i < thread_count; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    scanline_frame_destroy(&this);
+    return true;
+}
+
+// the two pass render: trace the whole frame, then filter it. a ring as
+// tall as the frame never has to wait for the filter
+static bool scanline_render_full(int const width, int const height, float const timer,
+                                 int const thread_count, unsigned char *const rgb)
+{
+    ScanlineFrame this;
+    if (!scanline_frame_init(&this, width, height, timer, height))
+    {
+        return false;
+    }
+
+    pthread_t threads[SCANLINE_MAX_THREADS];
+    if (!scanline_start_threads(&this, thread_count, threads))
+    {
+        scanline_frame_destroy(&this);
+        return false;
+    }
+
+    for (int i = 0; i < thread_count; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int y = 0; y < height; ++y)
+    {
+        scanline_filter_row(&this, y, rgb + (size_t)y * width * 3);
+    }
+
+    scanline_frame_destroy(&this);
+    return true;
+}
+
+#endif
@@ -0,0 +1,648 @@
+#ifndef CPU_SCENE_H
+#define CPU_SCENE_H
+
+// cpu port of shaders.hlsl, kept line for line with the shader so changes
+// can be mirrored between the two
+
+#include <stdbool.h>
+
+#include "gbuffer.h"
+#include "vec.h"
+
+typedef struct
+{
+    float aspect_ratio;
+    float timer;
+    float pixel_width;
+    int total_samples;
+    int max_bounces;
+    int max_steps;
+    float lod_cone;     // hit epsilon per unit marched, 0 keeps full detail everywhere
+} SceneConstants;
+
+typedef struct
+{
+    float distance;
+    float material;
+} DistanceInfo;
+
+typedef struct
+{
+    float3 pos;
+    float3 dir;
+} Ray;
+
+typedef struct
+{
+    DistanceInfo distance;
+    int step_count;
+} HitInfo;
+
+// the defaults of the quality constants, max_steps may not be raised past SCENE_MAX_STEPS
+#define SCENE_MAX_STEPS 100
+#define SCENE_MIN_DISTANCE 0.001f
+#define SCENE_MAX_DISTANCE 8.0f
+#define SCENE_TOTAL_SAMPLES 3
+#define SCENE_MAX_BOUNCES 4
+#define SCENE_LIGHT_MATERIAL 9.0f
+#define SCENE_HEXAGON_MATERIAL 4.0f
+
+// edge stopping of post_ps_main on the signed unit normal and the linear depth
+// of the first hit, tuned against a converged frame by cpu_render -gbuffer
+#define SCENE_POST_NORMAL_SHARPNESS 0.05f
+#define SCENE_POST_DEPTH_SHARPNESS 0.5f
+
+// level of detail: a primary ray hits once it is closer than a fraction of the
+// world space footprint of its pixel at the distance it marched, bounce rays
+// are that much looser and the epsilon is capped. larger fractions dilate the
+// silhouettes of the pylons. bounds stand in for the logo and the board
+// further than the margin away, the margin is kept above the largest epsilon
+// so a bound never registers a hit, and large enough that rays do not crawl
+// along the bound before the real surface takes over. a ray closer than the
+// cell margin to the edge of a pylon cell would crawl along it the same way,
+// there it sees all four cells instead
+#define SCENE_LOD_PIXEL_FRACTION 0.25f
+#define SCENE_LOD_BOUNCE_SCALE 4.0f
+#define SCENE_LOD_MAX_EPSILON 0.02f
+#define SCENE_LOD_BOUND_MARGIN 0.5f
+#define SCENE_LOD_CELL_MARGIN 0.05f
+#define SCENE_PYLON_BEVEL 0.005f
+#define SCENE_PYLON_MAX_HEIGHT 1.0f     // hexagon_hash never goes past it
+#define SCENE_LOGO_RADIUS 1.21f         // the .78 box plus its .1 wave, in logo space
+
+static inline float to_radians(float const degree) { return degree * 0.017453f; }
+
+// the lod_cone of a frame height rows high, a pixel of ps_main's 60 degree
+// field of view covers 2 tan(30 degrees) / height per unit marched
+static inline float scene_lod_cone(int const height)
+{
+    return SCENE_LOD_PIXEL_FRACTION * 2.0f * tanf(to_radians(60.0f) * 0.5f) / (float)height;
+}
+
+// full detail, modes that march with the level of detail set lod_cone themselves
+static SceneConstants scene_constants(int const width, int const height, float const timer)
+{
+    return (SceneConstants) {
+        .aspect_ratio = (float)height / (float)width,
+        .timer = timer,
+        .pixel_width = 1.0f / (float)height,
+        .total_samples = SCENE_TOTAL_SAMPLES,
+        .max_bounces = SCENE_MAX_BOUNCES,
+        .max_steps = SCENE_MAX_STEPS,
+        .lod_cone = 0.0f,
+    };
+}
+
+// from https://www.shadertoy.com/view/Xt3cDn by nimitz
+static inline uint32_t base_hash(uint32_t const x, uint32_t const y)
+{
+    uint32_t const px = 1103515245U * ((x >> 1U) ^ y);
+    uint32_t const py = 1103515245U * ((y >> 1U) ^ x);
+    uint32_t const h32 = 1103515245U * (px ^ (py >> 3U));
+    return h32 ^ (h32 >> 16);
+}
+
+static inline uint32_t seed_hash(float2 *const uv)
+{
+    *uv = add2(*uv, f2(0.1f, 0.1f));
+    return base_hash(as_uint(uv->x), as_uint(uv->y));
+}
+
+static inline float2 hash22(float2 *const uv)
+{
+    uint32_t const n = seed_hash(uv);
+    return f2((float)(n & 0x7fffffffU) / (float)0x7fffffff,
+              (float)((n * 48271U) & 0x7fffffffU) / (float)0x7fffffff);
+}
+
+static inline float hash12(float2 *const uv)
+{
+    uint32_t const n = seed_hash(uv);
+    return (float)(n & 0x7fffffffU) / (float)0x7fffffff;
+}
+
+// https://steveharveynz.wordpress.com/2012/12/20/ray-tracer-part-two-creating-the-camera/
+static Ray look_at_ray(SceneConstants const *const constants,
+                       float3 const eye_point, float3 const look_at_point,
+                       float const fov, float2 const coords)
+{
+    float3 const up = f3(0, 1, 0);
+
+    float3 const view_direction = sub3(look_at_point, eye_point);
+    float3 const u = normalize3(cross3(view_direction, up));
+    float3 const v = normalize3(cross3(cross3(view_direction, up), view_direction));
+
+    float const view_plane_half_width = tanf(fov / 2.0f);
+    float const view_plane_half_height = view_plane_half_width * constants->aspect_ratio;
+
+    float3 const view_plane_bottom_left_point =
+        sub3(sub3(look_at_point, scale3(v, view_plane_half_height)),
+             scale3(u, view_plane_half_width));
+
+    float3 const x_increment_vector = scale3(u, 2.0f * view_plane_half_width);
+    float3 const y_increment_vector = scale3(v, 2.0f * view_plane_half_height);
+
+    float3 const view_plane_point = add3(add3(view_plane_bottom_left_point,
+                                              scale3(x_increment_vector, coords.x)),
+                                         scale3(y_increment_vector, coords.y));
+
+    return (Ray) {eye_point, normalize3(sub3(view_plane_point, eye_point))};
+}
+
+static inline float sdf_box(float2 const p, float2 const b)
+{
+    float2 const d = f2(fabsf(p.x) - b.x, fabsf(p.y) - b.y);
+    return length2(f2(fmaxf(d.x, 0.0f), fmaxf(d.y, 0.0f))) + fminf(fmaxf(d.x, d.y), 0.0f);
+}
+
+static inline float windows_logo_color_index(float2 const uv)
+{
+    if (uv.x < 0.0f && uv.y > 0.0f) return 0.0f;
+    if (uv.x > 0.0f && uv.y > 0.0f) return 1.0f;
+    if (uv.y < 0.0f && uv.x < 0.0f) return 2.0f;
+    if (uv.y < 0.0f && uv.x > 0.0f) return 3.0f;
+
+    // the shader leaves color_index uninitialized on the axes
+    return 0.0f;
+}
+
+static inline DistanceInfo windows_logo_sdf(float2 uv)
+{
+    float const theta = atan2f(uv.x, uv.y) - 0.2f;
+    float const radius = length2(uv);
+
+    uv = f2(radius * sinf(theta), radius * cosf(theta));
+    uv.y += sinf(uv.x * 3.14159265f) * 0.1f;
+
+    float d = sdf_box(uv, f2(.78f, .78f));
+
+    d = fmaxf(d, -(fabsf(uv.x) - 0.03f));
+    d = fmaxf(d, -(fabsf(uv.y) - 0.03f));
+
+    return (DistanceInfo) {d, windows_logo_color_index(uv)};
+}
+
+static inline float op_extrude(float3 const p, float const sdf_2d, float const height)
+{
+    float2 const w = f2(sdf_2d, fabsf(p.z) - height);
+    return fminf(fmaxf(w.x, w.y), 0.0f) + length2(f2(fmaxf(w.x, 0.0f), fmaxf(w.y, 0.0f)));
+}
+
+static inline DistanceInfo windows_logo_3d_sdf(float3 const pos, float const extrude)
+{
+    DistanceInfo const logo_sdf = windows_logo_sdf(f2(pos.x, pos.y));
+    return (DistanceInfo) {op_extrude(pos, logo_sdf.distance, extrude), logo_sdf.material};
+}
+
+static inline DistanceInfo combine_sdf(DistanceInfo const a, DistanceInfo const b)
+{
+    return a.distance < b.distance ? a : b;
+}
+
+static inline float light_sdf(float3 const light_pos)
+{
+    return length3(max3s(sub3(abs3(light_pos), f3(1.f, 0.01f, 10.25f)), 0.0f));
+}
+
+static inline float hexagon_hash(float2 const p, float const timer)
+{
+    return (sinf(p.x * 4.0f - cosf(p.y * 1.4f) + timer) +
+            sinf(p.y * 4.0f - cosf(p.x * 1.4f) + timer)) * 0.25f + .5f;
+}
+
+// from https://www.shadertoy.com/view/MsVfz1
+static inline float hexagon_pylon(float2 const p2, float const pz, float const r, float const ht)
+{
+    float3 p = f3(fabsf(p2.x), pz, fabsf(p2.y));
+    p.x = p.x * 0.866025f + p.z * 0.5f;
+
+    float3 const b = f3(r, ht, r);
+    return length3(max3s(add3(sub3(abs3(p), b), f3s(SCENE_PYLON_BEVEL)), 0.0f)) -
+           SCENE_PYLON_BEVEL;
+}
+
+static inline float2 hexagon_cell_offset(float2 const p, float const cell_x, float const cell_y)
+{
+    return f2(p.x - (cell_x + .5f) * .866025f, p.y - (cell_y + .5f));
+}
+
+// the pylons repeat over four lattices of cells, two sets of repeat hexagons
+// are required to fill in the space
+#define HEXAGON_CELL_LATTICES 4
+
+// the pylon radius, lower numbers leave gaps and higher numbers give overlap
+#define HEXAGON_PYLON_RADIUS .25f
+
+// the center of the cell of lattice that p lies in
+static inline float2 hexagon_cell_center(float2 const p, int const lattice)
+{
+    switch (lattice)
+    {
+        case 0: return f2(floorf(p.x / .866025f), floorf(p.y));
+        case 1: return f2(floorf(p.x / .866025f), floorf(p.y - .5f) + .5f);
+        case 2: return f2(floorf((p.x - .5f) / .866025f) + .5f, floorf(p.y - .25f) + .25f);
+        default: return f2(floorf((p.x - .5f) / .866025f) + .5f, floorf(p.y - .75f) + .75f);
+    }
+}
+
+static inline DistanceInfo hexagon_sdf(float2 const p, float const pH, float const timer)
+{
+    // one pylon per lattice, centered on its cell and as high as the cell's hash
+    float obj[HEXAGON_CELL_LATTICES];
+    for (int i = 0; i < HEXAGON_CELL_LATTICES; ++i)
+    {
+        float2 const center = hexagon_cell_center(p, i);
+        obj[i] = hexagon_pylon(hexagon_cell_offset(p, center.x, center.y), pH,
+                               HEXAGON_PYLON_RADIUS, hexagon_hash(center, timer));
+    }
+
+    float const oH = obj[0] < obj[1] ? obj[0] : obj[1];
+    float const oH2 = obj[2] < obj[3] ? obj[2] : obj[3];
+
+    return (DistanceInfo) {oH < oH2 ? oH : oH2, SCENE_HEXAGON_MATERIAL};
+}
+
+// hexagon_sdf for a ray that hits at epsilon, with the pylon of the nearest
+// cell only. the four lattices together put the pylon centers on a hexagonal
+// grid whose cells are the pylon footprints, so any other pylon is at least
+// as far as the edge of this cell, or as the top of the tallest pylon. below
+// epsilon that bound could register a hit that is not there, and below the
+// cell margin it holds rays back, so the four cells are evaluated instead
+static inline DistanceInfo hexagon_sdf_far(float2 const p, float const pH, float const timer,
+                                           float const epsilon)
+{
+    float2 center = hexagon_cell_center(p, 0);
+    float2 offset = hexagon_cell_offset(p, center.x, center.y);
+    for (int i = 1; i < HEXAGON_CELL_LATTICES; ++i)
+    {
+        float2 const cell_center = hexagon_cell_center(p, i);
+        float2 const cell_offset = hexagon_cell_offset(p, cell_center.x, cell_center.y);
+        if (dot2(cell_offset, cell_offset) < dot2(offset, offset))
+        {
+            center = cell_center;
+            offset = cell_offset;
+        }
+    }
+
+    float const edge = HEXAGON_PYLON_RADIUS -
+                       fmaxf(fabsf(offset.x) * .866025f + fabsf(offset.y) * .5f, fabsf(offset.y));
+    float const others = fmaxf(edge, fabsf(pH) - SCENE_PYLON_MAX_HEIGHT);
+    if (others < fmaxf(epsilon, SCENE_LOD_CELL_MARGIN)) return hexagon_sdf(p, pH, timer);
+
+    float const pylon = hexagon_pylon(offset, pH, HEXAGON_PYLON_RADIUS,
+                                      hexagon_hash(center, timer));
+    return (DistanceInfo) {fminf(pylon, others), SCENE_HEXAGON_MATERIAL};
+}
+
+// the logo, the light and the hexagon board each move rigidly, the local
+// position of a point is where distance_function evaluates their sdfs
+static inline float3 scene_logo_local(float3 pos, float const timer)
+{
+    pos.y += .5f;
+    float2 const xy = rotate2(f2(pos.x, pos.y), timer);
+    float2 const xz = rotate2(f2(xy.x, pos.z), timer);
+    return f3(xz.x + .1f * sinf(timer), xy.y, xz.y + .1f * sinf(timer));
+}
+
+static inline float3 scene_light_local(float3 const pos, float const timer)
+{
+    float2 const xz = rotate2(f2(pos.x, pos.z), -timer);
+    return f3(xz.x, pos.y - 2.0f, xz.y);
+}
+
+static inline float3 scene_board_local(float3 const pos, float const timer)
+{
+    float2 const zy = rotate2(f2(pos.z, pos.y), sinf(timer) * 0.3f);
+    float2 const xz = rotate2(f2(pos.x, zy.x), timer * 0.5f);
+    return f3(xz.x, zy.y + 2.3f, xz.y + timer);
+}
+
+// the bounding cylinder of the logo, in logo space, skips the atan2 and the wave
+static inline float scene_logo_bound(float3 const logo)
+{
+    return fmaxf(length2(f2(logo.x, logo.y)) - SCENE_LOGO_RADIUS, fabsf(logo.z) - 0.1f);
+}
+
+// the slab above the tallest pylon and below the board, in board space
+static inline float scene_board_bound(float3 const board)
+{
+    return fabsf(board.y) - SCENE_PYLON_MAX_HEIGHT;
+}
+
+// distance_function for a ray that hits at epsilon, 0 is full detail. the
+// variants only ever return less than the full distance, so the march stays safe
+static DistanceInfo distance_function_lod(float3 const world_pos, float const timer,
+                                          float const epsilon)
+{
+    bool const lod = epsilon > 0.0f;
+    float3 const pos = scene_logo_local(world_pos, timer);
+
+    float const logo_bound = scene_logo_bound(pos);
+    DistanceInfo distance = lod && logo_bound > SCENE_LOD_BOUND_MARGIN ?
+        (DistanceInfo) {logo_bound, 0.0f} : windows_logo_3d_sdf(pos, 0.1f);
+
+    distance = combine_sdf(distance,
+                           (DistanceInfo) {light_sdf(scene_light_local(world_pos, timer)),
+                                           SCENE_LIGHT_MATERIAL});
+
+    {
+        float3 const board = scene_board_local(world_pos, timer);
+
+        // above the tallest pylon the slab is enough, below it one cell is
+        float const board_bound = scene_board_bound(board);
+        distance = combine_sdf(distance, lod && board_bound > SCENE_LOD_BOUND_MARGIN ?
+            (DistanceInfo) {board_bound, SCENE_HEXAGON_MATERIAL} :
+            lod ? hexagon_sdf_far(f2(board.x, board.z), -board.y, timer, epsilon) :
+                  hexagon_sdf(f2(board.x, board.z), -board.y, timer));
+    }
+
+    return distance;
+}
+
+static inline DistanceInfo distance_function(float3 const pos, float const timer)
+{
+    return distance_function_lod(pos, timer, 0.0f);
+}
+
+// the hit epsilon grows with the footprint of the ray, cone is its growth per
+// unit marched and 0 marches at full detail with SCENE_MIN_DISTANCE
+static HitInfo ray_march(Ray const ray, float const timer, int const max_steps,
+                         float const cone)
+{
+    float distance_traveled = 0.0f;
+
+    int i = 0;
+    for (; i < max_steps; ++i)
+    {
+        float3 const current_position = add3(ray.pos, scale3(ray.dir, distance_traveled));
+        float const epsilon = fminf(fmaxf(SCENE_MIN_DISTANCE, distance_traveled * cone),
+                                    SCENE_LOD_MAX_EPSILON);
+        DistanceInfo const distance_to_closest =
+            distance_function_lod(current_position, timer, cone > 0.0f ? epsilon : 0.0f);
+
+        if (fabsf(distance_to_closest.distance) < epsilon)
+        {
+            return (HitInfo) {{distance_traveled, distance_to_closest.material}, i};
+        }
+
+        distance_traveled += distance_to_closest.distance;
+        if (distance_to_closest.distance > SCENE_MAX_DISTANCE)
+        {
+            break;
+        }
+    }
+
+    return (HitInfo) {{distance_traveled, -1}, i};
+}
+
+// from https://www.iquilezles.org/www/articles/normalsSDF/normalsSDF.htm
+static float3 calculate_normal(float3 const p, float const timer)
+{
+    float const eps = 0.0001f;
+
+    return normalize3(f3(distance_function(f3(p.x + eps, p.y, p.z), timer).distance -
+                         distance_function(f3(p.x - eps, p.y, p.z), timer).distance,
+                         distance_function(f3(p.x, p.y + eps, p.z), timer).distance -
+                         distance_function(f3(p.x, p.y - eps, p.z), timer).distance,
+                         distance_function(f3(p.x, p.y, p.z + eps), timer).distance -
+                         distance_function(f3(p.x, p.y, p.z - eps), timer).distance));
+}
+
+static float3 random_in_unit_sphere(float2 *const seed, float3 const nor)
+{
+    float2 const r = hash22(seed);
+
+    float3 const uu = normalize3(cross3(nor, f3(0.0f, 1.0f, 1.0f)));
+    float3 const vv = cross3(uu, nor);
+
+    float const ra = sqrtf(r.y);
+    float const rx = ra * cosf(6.2831f * r.x);
+    float const ry = ra * sinf(6.2831f * r.x);
+    float const rz = sqrtf(1.0f - r.y);
+    return normalize3(add3(add3(scale3(uu, rx), scale3(vv, ry)), scale3(nor, rz)));
+}
+
+static inline float pow2(float const value) { return value * value; }
+
+static float3 material_attenuation(int const hit_index)
+{
+    switch (hit_index)
+    {
+        case 0: return f3(.9f, .05f, 0);
+        case 1: return f3(0, 0.7f, 0);
+        case 2: return f3(.0f, .15f, 1.0f);
+        case 3: return f3(1, 1, 0);
+        default: return f3s(1.0f);
+    }
+}
+
+static inline float3 scene_camera_position(void) { return f3(0, .8f - 0.9f, 3.4f); }
+static inline float3 scene_camera_look_at(void) { return f3(0, .6f - 0.9f, 2.85f); }
+
+static inline float2 scene_pixel_size(SceneConstants const *const constants)
+{
+    return f2(1.0f / (1.0f / constants->pixel_width * constants->aspect_ratio),
+              constants->pixel_width);
+}
+
+// the texture coordinates vs_main hands to ps_main for pixel (x, y), y going down
+static inline float2 scene_pixel_coords(int const x, int const y,
+                                        int const width, int const height)
+{
+    return f2(((float)x + 0.5f) / (float)width,
+              1.0f - ((float)y + 0.5f) / (float)height);
+}
+
+// bounce rays only light the surface they leave, so they march coarser
+static inline float scene_ray_cone(SceneConstants const *const constants, int const bounce)
+{
+    return bounce == 0 ? constants->lod_cone : constants->lod_cone * SCENE_LOD_BOUNCE_SCALE;
+}
+
+// ps_main, the result is quantized like the render targets it is written to
+static GBufferTexel scene_trace_pixel(SceneConstants const *const constants,
+                                      float2 const coords)
+{
+    float2 seed = coords;
+    float2 const pixel_size = scene_pixel_size(constants);
+
+    float3 color = f3s(0.0f);
+    float3 normal = f3s(0.0f);
+    float depth = SCENE_MAX_DISTANCE;
+    float material = GBUFFER_MATERIAL_MISS;
+
+    int j = 0;
+    for (; j < constants->total_samples; ++j)
+    {
+        float3 total_attenuation = f3s(0.0f);
+
+        float2 const jitter = mul2(hash22(&seed), pixel_size);
+        Ray ray = look_at_ray(constants, scene_camera_position(), scene_camera_look_at(),
+                              to_radians(60.0f), add2(coords, jitter));
+
+        for (int i = 0; i < constants->max_bounces; ++i)
+        {
+            HitInfo const hit_info = ray_march(ray, constants->timer, constants->max_steps,
+                                               scene_ray_cone(constants, i));
+
+            // we didn't hit anything draw a background
+            if (hit_info.step_count == constants->max_steps ||
+                hit_info.distance.distance >= SCENE_MAX_DISTANCE)
+            {
+                if (i == 0) total_attenuation = f3s(1.0f);
+
+                float const background =
+                    pow2(fabsf(ray.dir.y + 0.3f) + hash12(&seed) * 0.1f) * 0.25f;
+
+                color = add3(color, scale3(total_attenuation, background));
+                break;
+            }
+
+            float3 const hit_position =
+                add3(ray.pos, scale3(ray.dir, hit_info.distance.distance));
+            float3 const hit_normal = calculate_normal(hit_position, constants->timer);
+
+            if (i == 0 && j == 0)
+            {
+                depth = hit_info.distance.distance;
+                material = hit_info.distance.material;
+            }
+
+            int const hit_index = (int)hit_info.distance.material;
+            if (hit_index > 8)
+            {
+                float3 const strength = f3s(0.9f);
+                color = add3(color, i == 0 ? strength : mul3(strength, total_attenuation));
+                normal = add3(normal, hit_normal);
+                break;
+            }
+
+            float3 const target = add3(hit_normal, random_in_unit_sphere(&seed, hit_normal));
+
+            ray.pos = add3(hit_position, scale3(hit_normal, 0.003f));
+            ray.dir = normalize3(target);
+
+            float3 const attenuation = material_attenuation(hit_index);
+            total_attenuation = i == 0 ? attenuation : mul3(total_attenuation, attenuation);
+
+            if (i == 0 && j == 0)
+            {
+                normal = add3(normal, hit_normal);
+            }
+
+            if (dot3(total_attenuation, total_attenuation) < 0.01f)
+            {
+                break;
+            }
+        }
+    }
+
+    float const inverse_count = 1.0f / (float)(j == 0 ? 1 : j);
+    return gbuffer_quantize((GBufferTexel) {
+        scale3(color, inverse_count), scale3(normal, inverse_count), depth, material,
+    });
+}
+
+// traces rows [first_row, last_row) of a width x height frame into gbuffer
+static void scene_trace_rows(SceneConstants const *const constants,
+                             int const width, int const height,
+                             int const first_row, int const last_row,
+                             GBufferTexel *const gbuffer)
+{
+    for (int y = first_row; y < last_row; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            gbuffer[(size_t)y * width + x] =
+                scene_trace_pixel(constants, scene_pixel_coords(x, y, width, height));
+        }
+    }
+}
+
+// based on https://www.shadertoy.com/view/ldKBzG
+static float const scene_post_kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f,
+                                           1.0f / 4.0f, 1.0f / 16.0f};
+
+#define SCENE_POST_RADIUS 2
+
+static inline GBufferTexel const *gbuffer_fetch(GBufferTexel const *const gbuffer,
+                                                int const width, int const height,
+                                                int x, int y)
+{
+    // clamp addressing like the post pass sampler
+    x = x < 0 ? 0 : x >= width ? width - 1 : x;
+    y = y < 0 ? 0 : y >= height ? height - 1 : y;
+    return gbuffer + (size_t)y * width + x;
+}
+
+// the edge aware filter of post_ps_main over the 2 * SCENE_POST_RADIUS + 1
+// rows around the pixel, already clamped to the frame, so it can run on a
+// window of rows as well as on a whole frame
+static float3 scene_denoise_rows(GBufferTexel const *const rows[2 * SCENE_POST_RADIUS + 1],
+                                 int const width, int const x)
+{
+    GBufferTexel const *const center = rows[SCENE_POST_RADIUS] + x;
+
+    float3 sum = f3s(0.0f);
+    float total_weight = 0.0f;
+
+    for (int dy = -SCENE_POST_RADIUS; dy <= SCENE_POST_RADIUS; ++dy)
+    {
+        for (int dx = -SCENE_POST_RADIUS; dx <= SCENE_POST_RADIUS; ++dx)
+        {
+            // clamp addressing like the post pass sampler
+            int const sample_x = x + dx < 0 ? 0 : x + dx >= width ? width - 1 : x + dx;
+            GBufferTexel const *const sample = rows[dy + SCENE_POST_RADIUS] + sample_x;
+
+            float3 const color_difference = sub3(center->color, sample->color);
+            float const color_weight =
+                fminf(expf(-dot3(color_difference, color_difference)), 1.0f);
+
+            float3 const normal_difference = sub3(center->normal, sample->normal);
+            float const normal_weight =
+                fminf(expf(-dot3(normal_difference, normal_difference) *
+                           SCENE_POST_NORMAL_SHARPNESS), 1.0f);
+
+            float const depth_weight =
+                expf(-fabsf(center->depth - sample->depth) * SCENE_POST_DEPTH_SHARPNESS);
+
+            float const weight = normal_weight * color_weight * depth_weight *
+                                 scene_post_kernel[dx + SCENE_POST_RADIUS] *
+                                 scene_post_kernel[dy + SCENE_POST_RADIUS];
+
+            sum = add3(sum, scale3(sample->color, weight));
+            total_weight += weight;
+        }
+    }
+
+    return scale3(sum, 1.0f / total_weight);
+}
+
+// gbuffer is addressed with y going down like texture space
+static float3 scene_denoise_pixel(GBufferTexel const *const gbuffer,
+                                  int const width, int const height,
+                                  int const x, int const y)
+{
+    GBufferTexel const *rows[2 * SCENE_POST_RADIUS + 1];
+    for (int dy = -SCENE_POST_RADIUS; dy <= SCENE_POST_RADIUS; ++dy)
+    {
+        rows[dy + SCENE_POST_RADIUS] = gbuffer_fetch(gbuffer, width, height, 0, y + dy);
+    }
+
+    return scene_denoise_rows(rows, width, x);
+}
+
+static inline float3 scene_tonemap(float3 const color)
+{
+    return f3(powf(color.x, 1.0f / 2.2f), powf(color.y, 1.0f / 2.2f), powf(color.z, 1.0f / 2.2f));
+}
+
+// post_ps_main: the denoised color, gamma corrected
+static float3 scene_post_pixel(GBufferTexel const *const gbuffer,
+                               int const width, int const height,
+                               int const x, int const y)
+{
+    return scene_tonemap(scene_denoise_pixel(gbuffer, width, height, x, y));
+}
+
+#endif
@@ -0,0 +1,415 @@
+#ifndef CPU_SDF_PROGRAM_H
+#define CPU_SDF_PROGRAM_H
+
+// data driven version of distance_function: the scene is a flat array of ops
+// that a batch interpreter runs over many points at once, one op at a time,
+// with the points stored as structure of arrays
+
+#include <stdbool.h>
+
+#include "scene.h"
+
+#define SDF_PROGRAM_MAX_OPS 64
+#define SDF_PROGRAM_MAX_STACK 4
+#define SDF_BATCH_SIZE 64
+
+typedef enum
+{
+    SDF_OP_PUSH_POSITION,   // save the current point so a later branch can start from it
+    SDF_OP_POP_POSITION,    // restore the last saved point
+    SDF_OP_TRANSLATE,       // p += value.xyz
+    SDF_OP_ROTATE,          // p.ab = mul(p.ab, rotation_matrix(value.x))
+    SDF_OP_WINDOWS_LOGO,    // windows_logo_sdf(p.xy) into the 2d register
+    SDF_OP_EXTRUDE,         // op_extrude(p, 2d register, value.x) onto the distance stack
+    SDF_OP_BOX,             // length(max(abs(p) - value.xyz, 0)) onto the distance stack
+    SDF_OP_HEXAGON_CELL,    // repeat domain: p.xz to its offset in the cell of lattice value.x,
+                            // the cell's hexagon_hash at timer into the cell register
+    SDF_OP_HEXAGON_PYLON,   // hexagon_pylon(p.xz, -p.y, value.x, cell register) onto the distance stack
+    SDF_OP_UNION,           // combine_sdf of the top two distances
+} SdfOpType;
+
+typedef enum
+{
+    SDF_AXIS_X,
+    SDF_AXIS_Y,
+    SDF_AXIS_Z,
+} SdfAxis;
+
+// a parameter that may be animated: constant + timer_scale * timer + sin_scale * sin(timer)
+typedef struct
+{
+    float constant;
+    float timer_scale;
+    float sin_scale;
+} SdfParam;
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t axis_a;
+    uint8_t axis_b;
+    float material;
+    SdfParam params[3];
+} SdfOp;
+
+// an op with its parameters resolved for one timer value
+typedef struct
+{
+    uint8_t type;
+    uint8_t axis_a;
+    uint8_t axis_b;
+    float material;
+    float value[3];
+} SdfBoundOp;
+
+typedef struct
+{
+    SdfOp ops[SDF_PROGRAM_MAX_OPS];
+    SdfBoundOp bound_ops[SDF_PROGRAM_MAX_OPS];
+    int op_count;
+    float timer;
+} SdfProgram;
+
+static inline SdfParam sdf_constant(float const value) { return (SdfParam) {value, 0, 0}; }
+static inline SdfParam sdf_timer(float const scale) { return (SdfParam) {0, scale, 0}; }
+static inline SdfParam sdf_sin_timer(float const scale) { return (SdfParam) {0, 0, scale}; }
+
+static bool sdf_program_append(SdfProgram *const this, SdfOp const op)
+{
+    if (this->op_count >= SDF_PROGRAM_MAX_OPS) return false;
+
+    this->ops[this->op_count++] = op;
+    return true;
+}
+
+static float sdf_param_resolve(SdfParam const param, float const timer)
+{
+    return param.constant + param.timer_scale * timer + param.sin_scale * sinf(timer);
+}
+
+// resolve every animated parameter once so the interpreter only sees constants
+static void sdf_program_bind(SdfProgram *const this, float const timer)
+{
+    this->timer = timer;
+
+    for (int i = 0; i < this->op_count; ++i)
+    {
+        SdfOp const *const op = this->ops + i;
+        SdfBoundOp *const bound_op = this->bound_ops + i;
+
+        bound_op->type = op->type;
+        bound_op->axis_a = op->axis_a;
+        bound_op->axis_b = op->axis_b;
+        bound_op->material = op->material;
+
+        for (int j = 0; j < 3; ++j)
+        {
+            bound_op->value[j] = sdf_param_resolve(op->params[j], timer);
+        }
+
+        if (op->type == SDF_OP_ROTATE)
+        {
+            float const angle = bound_op->value[0];
+            bound_op->value[0] = cosf(angle);
+            bound_op->value[1] = sinf(angle);
+        }
+    }
+}
+
+// checks that the program never over or underflows its stacks and leaves one distance
+static bool sdf_program_validate(SdfProgram const *const this)
+{
+    int position_depth = 0;
+    int distance_depth = 0;
+    bool have_2d = false;
+    bool have_cell = false;
+
+    for (int i = 0; i < this->op_count; ++i)
+    {
+        switch (this->ops[i].type)
+        {
+            case SDF_OP_PUSH_POSITION: ++position_depth; break;
+            case SDF_OP_POP_POSITION: --position_depth; break;
+            case SDF_OP_WINDOWS_LOGO: have_2d = true; break;
+            case SDF_OP_HEXAGON_CELL: have_cell = true; break;
+
+            case SDF_OP_EXTRUDE:
+            {
+                if (!have_2d) return false;
+                ++distance_depth;
+                break;
+            }
+
+            case SDF_OP_HEXAGON_PYLON:
+            {
+                if (!have_cell) return false;
+                ++distance_depth;
+                break;
+            }
+
+            case SDF_OP_BOX: ++distance_depth; break;
+            case SDF_OP_UNION: --distance_depth; break;
+            default: break;
+        }
+
+        if (position_depth < 0 || position_depth > SDF_PROGRAM_MAX_STACK ||
+            distance_depth < 0 || distance_depth > SDF_PROGRAM_MAX_STACK)
+        {
+            return false;
+        }
+
+        if (this->ops[i].type == SDF_OP_UNION && distance_depth < 1) return false;
+    }
+
+    return position_depth == 0 && distance_depth == 1;
+}
+
+// the scene distance_function draws, expressed as a program
+static bool sdf_program_build_scene(SdfProgram *const this)
+{
+    this->op_count = 0;
+
+    SdfOp const ops[] = {
+        // windows logo
+        {.type = SDF_OP_PUSH_POSITION},
+        {.type = SDF_OP_TRANSLATE,
+         .params = {sdf_constant(0), sdf_constant(.5f), sdf_constant(0)}},
+        {.type = SDF_OP_ROTATE, .axis_a = SDF_AXIS_X, .axis_b = SDF_AXIS_Y,
+         .params = {sdf_timer(1)}},
+        {.type = SDF_OP_ROTATE, .axis_a = SDF_AXIS_X, .axis_b = SDF_AXIS_Z,
+         .params = {sdf_timer(1)}},
+        {.type = SDF_OP_TRANSLATE,
+         .params = {sdf_sin_timer(.1f), sdf_constant(0), sdf_sin_timer(.1f)}},
+        {.type = SDF_OP_WINDOWS_LOGO},
+        {.type = SDF_OP_EXTRUDE, .params = {sdf_constant(0.1f)}},
+        {.type = SDF_OP_POP_POSITION},
+
+        // light
+        {.type = SDF_OP_PUSH_POSITION},
+        {.type = SDF_OP_TRANSLATE,
+         .params = {sdf_constant(0), sdf_constant(-2.0f), sdf_constant(0)}},
+        {.type = SDF_OP_ROTATE, .axis_a = SDF_AXIS_X, .axis_b = SDF_AXIS_Z,
+         .params = {sdf_timer(-1)}},
+        {.type = SDF_OP_BOX, .material = SCENE_LIGHT_MATERIAL,
+         .params = {sdf_constant(1.f), sdf_constant(0.01f), sdf_constant(10.25f)}},
+        {.type = SDF_OP_POP_POSITION},
+        {.type = SDF_OP_UNION},
+
+        // hexagon board
+        {.type = SDF_OP_ROTATE, .axis_a = SDF_AXIS_Z, .axis_b = SDF_AXIS_Y,
+         .params = {sdf_sin_timer(0.3f)}},
+        {.type = SDF_OP_ROTATE, .axis_a = SDF_AXIS_X, .axis_b = SDF_AXIS_Z,
+         .params = {sdf_timer(0.5f)}},
+        {.type = SDF_OP_TRANSLATE,
+         .params = {sdf_constant(0), sdf_constant(2.3f), sdf_timer(1)}},
+
+        // one pylon per cell lattice, the nearest one wins like in hexagon_sdf
+        {.type = SDF_OP_PUSH_POSITION},
+        {.type = SDF_OP_HEXAGON_CELL, .params = {sdf_constant(0)}},
+        {.type = SDF_OP_HEXAGON_PYLON, .material = SCENE_HEXAGON_MATERIAL,
+         .params = {sdf_constant(HEXAGON_PYLON_RADIUS)}},
+        {.type = SDF_OP_POP_POSITION},
+        {.type = SDF_OP_PUSH_POSITION},
+        {.type = SDF_OP_HEXAGON_CELL, .params = {sdf_constant(1)}},
+        {.type = SDF_OP_HEXAGON_PYLON, .material = SCENE_HEXAGON_MATERIAL,
+         .params = {sdf_constant(HEXAGON_PYLON_RADIUS)}},
+        {.type = SDF_OP_POP_POSITION},
+        {.type = SDF_OP_UNION},
+        {.type = SDF_OP_PUSH_POSITION},
+        {.type = SDF_OP_HEXAGON_CELL, .params = {sdf_constant(2)}},
+        {.type = SDF_OP_HEXAGON_PYLON, .material = SCENE_HEXAGON_MATERIAL,
+         .params = {sdf_constant(HEXAGON_PYLON_RADIUS)}},
+        {.type = SDF_OP_POP_POSITION},
+        {.type = SDF_OP_PUSH_POSITION},
+        {.type = SDF_OP_HEXAGON_CELL, .params = {sdf_constant(3)}},
+        {.type = SDF_OP_HEXAGON_PYLON, .material = SCENE_HEXAGON_MATERIAL,
+         .params = {sdf_constant(HEXAGON_PYLON_RADIUS)}},
+        {.type = SDF_OP_POP_POSITION},
+        {.type = SDF_OP_UNION},
+        {.type = SDF_OP_UNION},
+        {.type = SDF_OP_UNION},
+    };
+
+    for (size_t i = 0; i < sizeof ops / sizeof *ops; ++i)
+    {
+        if (!sdf_program_append(this, ops[i])) return false;
+    }
+
+    return sdf_program_validate(this);
+}
+
+typedef struct
+{
+    float position[SDF_PROGRAM_MAX_STACK + 1][3][SDF_BATCH_SIZE];
+    float distance[SDF_PROGRAM_MAX_STACK][SDF_BATCH_SIZE];
+    float material[SDF_PROGRAM_MAX_STACK][SDF_BATCH_SIZE];
+    float distance_2d[SDF_BATCH_SIZE];
+    float material_2d[SDF_BATCH_SIZE];
+    float cell[SDF_BATCH_SIZE];
+} SdfMachine;
+
+static void sdf_program_run_batch(SdfProgram const *const this,
+                                  SdfMachine *const machine, int const count)
+{
+    int position_top = 0;
+    int distance_top = -1;
+
+    for (int i = 0; i < this->op_count; ++i)
+    {
+        SdfBoundOp const *const op = this->bound_ops + i;
+        float (*const p)[SDF_BATCH_SIZE] = machine->position[position_top];
+
+        switch (op->type)
+        {
+            case SDF_OP_PUSH_POSITION:
+            {
+                memcpy(machine->position[position_top + 1], p, sizeof machine->position[0]);
+                ++position_top;
+                break;
+            }
+
+            case SDF_OP_POP_POSITION:
+            {
+                --position_top;
+                break;
+            }
+
+            case SDF_OP_TRANSLATE:
+            {
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    float const offset = op->value[axis];
+                    for (int k = 0; k < count; ++k) p[axis][k] += offset;
+                }
+                break;
+            }
+
+            case SDF_OP_ROTATE:
+            {
+                float const c = op->value[0];
+                float const s = op->value[1];
+                float *const a = p[op->axis_a];
+                float *const b = p[op->axis_b];
+
+                for (int k = 0; k < count; ++k)
+                {
+                    float const old_a = a[k];
+                    a[k] = old_a * c + b[k] * s;
+                    b[k] = -old_a * s + b[k] * c;
+                }
+                break;
+            }
+
+            case SDF_OP_WINDOWS_LOGO:
+            {
+                for (int k = 0; k < count; ++k)
+                {
+                    DistanceInfo const logo = windows_logo_sdf(f2(p[0][k], p[1][k]));
+                    machine->distance_2d[k] = logo.distance;
+                    machine->material_2d[k] = logo.material;
+                }
+                break;
+            }
+
+            case SDF_OP_EXTRUDE:
+            {
+                ++distance_top;
+                for (int k = 0; k < count; ++k)
+                {
+                    machine->distance[distance_top][k] =
+                        op_extrude(f3(p[0][k], p[1][k], p[2][k]),
+                                   machine->distance_2d[k], op->value[0]);
+                    machine->material[distance_top][k] = machine->material_2d[k];
+                }
+                break;
+            }
+
+            case SDF_OP_BOX:
+            {
+                ++distance_top;
+                float3 const b = f3(op->value[0], op->value[1], op->value[2]);
+                for (int k = 0; k < count; ++k)
+                {
+                    machine->distance[distance_top][k] =
+                        length3(max3s(sub3(abs3(f3(p[0][k], p[1][k], p[2][k])), b), 0.0f));
+                    machine->material[distance_top][k] = op->material;
+                }
+                break;
+            }
+
+            case SDF_OP_HEXAGON_CELL:
+            {
+                int const lattice = (int)op->value[0];
+                for (int k = 0; k < count; ++k)
+                {
+                    float2 const point = f2(p[0][k], p[2][k]);
+                    float2 const center = hexagon_cell_center(point, lattice);
+                    float2 const offset = hexagon_cell_offset(point, center.x, center.y);
+
+                    p[0][k] = offset.x;
+                    p[2][k] = offset.y;
+                    machine->cell[k] = hexagon_hash(center, this->timer);
+                }
+                break;
+            }
+
+            case SDF_OP_HEXAGON_PYLON:
+            {
+                ++distance_top;
+                for (int k = 0; k < count; ++k)
+                {
+                    machine->distance[distance_top][k] =
+                        hexagon_pylon(f2(p[0][k], p[2][k]), -p[1][k], op->value[0],
+                                      machine->cell[k]);
+                    machine->material[distance_top][k] = op->material;
+                }
+                break;
+            }
+
+            case SDF_OP_UNION:
+            {
+                float *const a = machine->distance[distance_top - 1];
+                float *const b = machine->distance[distance_top];
+                float *const a_material = machine->material[distance_top - 1];
+                float *const b_material = machine->material[distance_top];
+
+                for (int k = 0; k < count; ++k)
+                {
+                    bool const keep_a = a[k] < b[k];
+                    a[k] = keep_a ? a[k] : b[k];
+                    a_material[k] = keep_a ? a_material[k] : b_material[k];
+                }
+
+                --distance_top;
+                break;
+            }
+        }
+    }
+}
+
+// evaluates a bound program at count points, the inputs and outputs are structure of arrays
+static void sdf_program_evaluate(SdfProgram const *const this, size_t const count,
+                                 float const *const x, float const *const y,
+                                 float const *const z,
+                                 float *const distance, float *const material)
+{
+    SdfMachine machine;
+
+    for (size_t start = 0; start < count; start += SDF_BATCH_SIZE)
+    {
+        int const batch_count =
+            count - start < SDF_BATCH_SIZE ? (int)(count - start) : SDF_BATCH_SIZE;
+        size_t const batch_size = (size_t)batch_count * sizeof(float);
+
+        memcpy(machine.position[0][0], x + start, batch_size);
+        memcpy(machine.position[0][1], y + start, batch_size);
+        memcpy(machine.position[0][2], z + start, batch_size);
+
+        sdf_program_run_batch(this, &machine, batch_count);
+
+        memcpy(distance + start, machine.distance[0], batch_size);
+        memcpy(material + start, machine.material[0], batch_size);
+    }
+}
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef CPU_STILL_H
+#define CPU_STILL_H
+
+// out of core rendering of large stills. the image is rendered tile by tile
+// with render_tile and every tile goes straight to the output file, so the
+// memory needed is bounded by the tile size instead of the image size:
+//   ppm:  the rows of a tile are written at their place in the raw image
+//   tiff: a baseline tiled tiff, tiles are stored in the order they are
+//         rendered so the file is written front to back
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tile.h"
+#include "../runtime.h"
+
+// tiff tiles have to be a multiple of 16 pixels
+#define STILL_TILE_ALIGNMENT 16
+
+typedef enum
+{
+    STILL_FORMAT_PPM,
+    STILL_FORMAT_TIFF,
+} StillFormat;
+
+typedef struct
+{
+    double seconds;
+    int tile_count;
+    uint64_t file_size;
+} StillStats;
+
+static bool still_write_at(int const file, void const *const data, size_t const size,
+                           uint64_t const offset)
+{
+    unsigned char const *bytes = data;
+    size_t written = 0;
+
+    while (written < size)
+    {
+        ssize_t const result = pwrite(file, bytes + written, size - written,
+                                      (off_t)(offset + written));
+        if (result <= 0) return false;
+
+        written += (size_t)result;
+    }
+
+    return true;
+}
+
+static unsigned char *still_put16(unsigned char *const bytes, uint32_t const value)
+{
+    bytes[0] = (unsigned char)value;
+    bytes[1] = (unsigned char)(value >> 8);
+    return bytes + 2;
+}
+
+static unsigned char *still_put32(unsigned char *const bytes, uint32_t const value)
+{
+    bytes[0] = (unsigned char)value;
+    bytes[1] = (unsigned char)(value >> 8);
+    bytes[2] = (unsigned char)(value >> 16);
+    bytes[3] = (unsigned char)(value >> 24);
+    return bytes + 4;
+}
+
+enum
+{
+    TIFF_SHORT = 3,
+    TIFF_LONG = 4,
+    TIFF_ENTRY_COUNT = 11,
+    TIFF_IFD_SIZE = 2 + TIFF_ENTRY_COUNT * 12 + 4,
+};
+
+// an ifd entry, values that do not fit in 4 bytes are stored at value_offset
+static unsigned char *still_put_tiff_entry(unsigned char *bytes, uint32_t const tag,
+                                           uint32_t const type, uint32_t const count,
+                                           uint32_t const value)
+{
+    bytes = still_put16(bytes, tag);
+    bytes = still_put16(bytes, type);
+    bytes = still_put32(bytes, count);
+
+    // a single short sits in the first two bytes of the value field
+    if (type == TIFF_SHORT && count == 1)
+    {
+        bytes = still_put16(bytes, value);
+        return still_put16(bytes, 0);
+    }
+
+    return still_put32(bytes, value);
+}
+
+// writes the tiff header and directory, returns the offset of the first
+// tile or 0 when the image does not fit in a classic (4 gb) tiff
+static uint64_t still_write_tiff_header(int const file, int const width, int const height,
+                                        int const tile_size, int const tile_count)
+{
+    uint64_t const tile_bytes = (uint64_t)tile_size * tile_size * 3;
+
+    // header, directory, bits per sample, tile offsets and tile sizes
+    uint64_t const bits_offset = 8 + TIFF_IFD_SIZE;
+    uint64_t const offsets_offset = bits_offset + 8;
+    uint64_t const counts_offset = offsets_offset + (uint64_t)tile_count * 4;
+    uint64_t const first_tile = counts_offset + (uint64_t)tile_count * 4;
+
+    if (first_tile + tile_bytes * (uint64_t)tile_count > 0xffffffffULL) return 0;
+
+    unsigned char header[8 + TIFF_IFD_SIZE + 8];
+    unsigned char *bytes = header;
+
+    *bytes++ = 'I';
+    *bytes++ = 'I';
+    bytes = still_put16(bytes, 42);
+    bytes = still_put32(bytes, 8);
+
+    // entries are sorted by tag, with one tile its offset and size are inline
+    bytes = still_put16(bytes, TIFF_ENTRY_COUNT);
+    bytes = still_put_tiff_entry(bytes, 256, TIFF_LONG, 1, (uint32_t)width);
+    bytes = still_put_tiff_entry(bytes, 257, TIFF_LONG, 1, (uint32_t)height);
+    bytes = still_put_tiff_entry(bytes, 258, TIFF_SHORT, 3, (uint32_t)bits_offset);
+    bytes = still_put_tiff_entry(bytes, 259, TIFF_SHORT, 1, 1);  // no compression
+    bytes = still_put_tiff_entry(bytes, 262, TIFF_SHORT, 1, 2);  // rgb
+    bytes = still_put_tiff_entry(bytes, 277, TIFF_SHORT, 1, 3);  // samples per pixel
+    bytes = still_put_tiff_entry(bytes, 284, TIFF_SHORT, 1, 1);  // interleaved
+    bytes = still_put_tiff_entry(bytes, 322, TIFF_LONG, 1, (uint32_t)tile_size);
+    bytes = still_put_tiff_entry(bytes, 323, TIFF_LONG, 1, (uint32_t)tile_size);
+    bytes = still_put_tiff_entry(bytes, 324, TIFF_LONG, (uint32_t)tile_count,
+                                 tile_count == 1 ? (uint32_t)first_tile : (uint32_t)offsets_offset);
+    bytes = still_put_tiff_entry(bytes, 325, TIFF_LONG, (uint32_t)tile_count,
+                                 tile_count == 1 ? (uint32_t)tile_bytes : (uint32_t)counts_offset);
+    bytes = still_put32(bytes, 0);  // no next directory
+
+    bytes = still_put16(bytes, 8);
+    bytes = still_put16(bytes, 8);
+    bytes = still_put16(bytes, 8);
+    bytes = still_put16(bytes, 0);
+
+    if (!still_write_at(file, header, sizeof header, 0)) return 0;
+
+    // the tile tables are written in chunks to keep memory bounded
+    uint32_t table[1024];
+    for (int first = 0; first < tile_count; first += 1024)
+    {
+        int const count = tile_count - first < 1024 ? tile_count - first : 1024;
+
+        for (int i = 0; i < count; ++i)
+        {
+            still_put32((unsigned char *)(table + i),
+                        (uint32_t)(first_tile + tile_bytes * (uint64_t)(first + i)));
+        }
+
+        if (!still_write_at(file, table, (size_t)count * 4, offsets_offset + (uint64_t)first * 4))
+        {
+            return 0;
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            still_put32((unsigned char *)(table + i), (uint32_t)tile_bytes);
+        }
+
+        if (!still_write_at(file, table, (size_t)count * 4, counts_offset + (uint64_t)first * 4))
+        {
+            return 0;
+        }
+    }
+
+    return first_tile;
+}
+
+// renders the frame at timer into path, prints the reason and returns
+// false on failure
+static bool still_render(char const *const path, StillFormat const format,
+                         int const width, int const height, float const timer,
+                         int const tile_size, StillStats *const stats)
+{
+    if (format == STILL_FORMAT_TIFF && tile_size % STILL_TILE_ALIGNMENT != 0)
+    {
+        fprintf(stderr, "error: tiff tiles must be a multiple of %d pixels\n",
+                STILL_TILE_ALIGNMENT);
+        return false;
+    }
+
+    int const file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0)
+    {
+        fprintf(stderr, "error: could not open %s\n", path);
+        return false;
+    }
+
+    int const tiles_x = (width + tile_size - 1) / tile_size;
+    int const tiles_y = (height + tile_size - 1) / tile_size;
+    int const tile_count = tiles_x * tiles_y;
+    size_t const tile_bytes = (size_t)tile_size * tile_size * 3;
+
+    GBufferTexel *const scratch = malloc(tile_scratch_texels(tile_size) * sizeof *scratch);
+    unsigned char *const rgb = malloc(tile_bytes);
+
+    double const start = runtime_clock_now();
+    bool success = scratch != NULL && rgb != NULL;
+
+    uint64_t data_offset = 0;
+    if (success && format == STILL_FORMAT_PPM)
+    {
+        char header[64];
+        int const header_size = snprintf(header, sizeof header, "P6\n%d %d\n255\n", width, height);
+
+        success = still_write_at(file, header, (size_t)header_size, 0);
+        data_offset = (uint64_t)header_size;
+    }
+    else if (success)
+    {
+        data_offset = still_write_tiff_header(file, width, height, tile_size, tile_count);
+        if (data_offset == 0)
+        {
+            fprintf(stderr, "error: the image is too large for a tiff, write a ppm instead\n");
+            success = false;
+        }
+    }
+
+    SceneConstants const constants = scene_constants(width, height, timer);
+    uint64_t file_size = data_offset;
+
+    for (int tile = 0; success && tile < tile_count; ++tile)
+    {
+        int const x = tile % tiles_x * tile_size;
+        int const y = tile / tiles_x * tile_size;
+        int const tile_width = x + tile_size > width ? width - x : tile_size;
+        int const tile_height = y + tile_size > height ? height - y : tile_size;
+
+        if (format == STILL_FORMAT_TIFF)
+        {
+            // edge tiles are padded to the full tile size
+            memset(rgb, 0, tile_bytes);
+            render_tile(&constants, width, height, x, y, tile_width, tile_height,
+                        scratch, rgb, (size_t)tile_size * 3);
+
+            file_size = data_offset + (uint64_t)tile * tile_bytes;
+            success = still_write_at(file, rgb, tile_bytes, file_size);
+            file_size += tile_bytes;
+        }
+        else
+        {
+            size_t const row_bytes = (size_t)tile_width * 3;
+            render_tile(&constants, width, height, x, y, tile_width, tile_height,
+                        scratch, rgb, row_bytes);
+
+            for (int row = 0; success && row < tile_height; ++row)
+            {
+                success = still_write_at(file, rgb + row * row_bytes, row_bytes,
+                                         data_offset + ((uint64_t)(y + row) * width + x) * 3);
+            }
+
+            file_size = data_offset + (uint64_t)width * height * 3;
+        }
+    }
+
+    bool const written = close(file) == 0 && success;
+    if (!written && data_offset != 0)
+    {
+        fprintf(stderr, "error: could not write %s\n", path);
+    }
+
+    stats->seconds = runtime_clock_now() - start;
+    stats->tile_count = tile_count;
+    stats->file_size = file_size;
+
+    free(scratch);
+    free(rgb);
+    return written;
+}
+
+#endif
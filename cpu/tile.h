@@ -0,0 +1,64 @@
+#ifndef CPU_TILE_H
+#define CPU_TILE_H
+
+// renders one tile of a frame with ps_main and post_ps_main. the tile is
+// traced with an apron of SCENE_POST_RADIUS pixels so the post filter sees
+// the same neighbours it would in the full frame
+
+#include "scene.h"
+
+#define TILE_APRON SCENE_POST_RADIUS
+
+// texels of scratch render_tile needs for tiles of up to tile_size pixels
+static inline size_t tile_scratch_texels(int const tile_size)
+{
+    return (size_t)(tile_size + 2 * TILE_APRON) * (size_t)(tile_size + 2 * TILE_APRON);
+}
+
+// writes 8 bit rgb rows of row_stride bytes
+static void render_tile(SceneConstants const *const constants,
+                        int const frame_width, int const frame_height,
+                        int const tile_x, int const tile_y,
+                        int const tile_width, int const tile_height,
+                        GBufferTexel *const scratch,
+                        unsigned char *const rgb, size_t const row_stride)
+{
+    // the apron stops at the frame edges, where the post filter clamps, so
+    // clamping at the region edges gives the same result as the full frame
+    int const region_x = tile_x - TILE_APRON < 0 ? 0 : tile_x - TILE_APRON;
+    int const region_y = tile_y - TILE_APRON < 0 ? 0 : tile_y - TILE_APRON;
+    int const region_end_x = tile_x + tile_width + TILE_APRON > frame_width ?
+                             frame_width : tile_x + tile_width + TILE_APRON;
+    int const region_end_y = tile_y + tile_height + TILE_APRON > frame_height ?
+                             frame_height : tile_y + tile_height + TILE_APRON;
+
+    int const region_width = region_end_x - region_x;
+    int const region_height = region_end_y - region_y;
+
+    for (int y = 0; y < region_height; ++y)
+    {
+        for (int x = 0; x < region_width; ++x)
+        {
+            scratch[(size_t)y * region_width + x] =
+                scene_trace_pixel(constants, scene_pixel_coords(region_x + x, region_y + y,
+                                                                frame_width, frame_height));
+        }
+    }
+
+    for (int y = 0; y < tile_height; ++y)
+    {
+        for (int x = 0; x < tile_width; ++x)
+        {
+            float3 const color = saturate3(scene_tonemap(
+                scene_denoise_pixel(scratch, region_width, region_height,
+                                    tile_x - region_x + x, tile_y - region_y + y)));
+
+            unsigned char *const pixel = rgb + (size_t)y * row_stride + (size_t)x * 3;
+            pixel[0] = (unsigned char)(color.x * 255.0f + 0.5f);
+            pixel[1] = (unsigned char)(color.y * 255.0f + 0.5f);
+            pixel[2] = (unsigned char)(color.z * 255.0f + 0.5f);
+        }
+    }
+}
+
+#endif
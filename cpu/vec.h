@@ -0,0 +1,84 @@
+#ifndef CPU_VEC_H
+#define CPU_VEC_H
+
+// the small part of hlsl's vector library that shaders.hlsl uses,
+// so the cpu port can be read side by side with the shader
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct
+{
+    float x, y;
+} float2;
+
+typedef struct
+{
+    float x, y, z;
+} float3;
+
+static inline float2 f2(float const x, float const y) { return (float2) {x, y}; }
+static inline float3 f3(float const x, float const y, float const z) { return (float3) {x, y, z}; }
+static inline float3 f3s(float const value) { return (float3) {value, value, value}; }
+
+static inline float2 add2(float2 const a, float2 const b) { return f2(a.x + b.x, a.y + b.y); }
+static inline float2 sub2(float2 const a, float2 const b) { return f2(a.x - b.x, a.y - b.y); }
+static inline float2 mul2(float2 const a, float2 const b) { return f2(a.x * b.x, a.y * b.y); }
+static inline float2 scale2(float2 const a, float const s) { return f2(a.x * s, a.y * s); }
+static inline float dot2(float2 const a, float2 const b) { return a.x * b.x + a.y * b.y; }
+static inline float length2(float2 const a) { return sqrtf(dot2(a, a)); }
+
+static inline float3 add3(float3 const a, float3 const b) { return f3(a.x + b.x, a.y + b.y, a.z + b.z); }
+static inline float3 sub3(float3 const a, float3 const b) { return f3(a.x - b.x, a.y - b.y, a.z - b.z); }
+static inline float3 mul3(float3 const a, float3 const b) { return f3(a.x * b.x, a.y * b.y, a.z * b.z); }
+static inline float3 scale3(float3 const a, float const s) { return f3(a.x * s, a.y * s, a.z * s); }
+static inline float dot3(float3 const a, float3 const b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+static inline float length3(float3 const a) { return sqrtf(dot3(a, a)); }
+
+static inline float3 cross3(float3 const a, float3 const b)
+{
+    return f3(a.y * b.z - a.z * b.y,
+              a.z * b.x - a.x * b.z,
+              a.x * b.y - a.y * b.x);
+}
+
+static inline float3 normalize3(float3 const a)
+{
+    return scale3(a, 1.0f / length3(a));
+}
+
+static inline float3 max3s(float3 const a, float const b)
+{
+    return f3(fmaxf(a.x, b), fmaxf(a.y, b), fmaxf(a.z, b));
+}
+
+static inline float3 abs3(float3 const a) { return f3(fabsf(a.x), fabsf(a.y), fabsf(a.z)); }
+
+static inline float saturate(float const value)
+{
+    return value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+}
+
+static inline float3 saturate3(float3 const a)
+{
+    return f3(saturate(a.x), saturate(a.y), saturate(a.z));
+}
+
+// mul(v, rotation_matrix(angle)) for a row vector v
+static inline float2 rotate2(float2 const v, float const angle)
+{
+    float const s = sinf(angle);
+    float const c = cosf(angle);
+
+    return f2(v.x * c + v.y * s, -v.x * s + v.y * c);
+}
+
+static inline uint32_t as_uint(float const value)
+{
+    uint32_t result;
+    memcpy(&result, &value, sizeof result);
+    return result;
+}
+
+#endif
@@ -0,0 +1,417 @@
+#ifndef CPU_WAVEFRONT_H
+#define CPU_WAVEFRONT_H
+
+// wavefront version of ps_main: instead of one pixel running march, normal,
+// material and bounce inside nested loops, every stage runs over a compact
+// queue of rays and the queues are bucketed by material and direction octant
+// between stages so neighbouring rays do similar work
+//
+// samples of a pixel share one seed in ps_main, so each sample is its own wave
+// and the output matches scene_trace_pixel exactly
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "scene.h"
+
+#define WAVEFRONT_SIMD_WIDTH 8
+
+// miss, the four logo colors, the hexagons and the light
+#define WAVEFRONT_MATERIAL_KEYS 7
+#define WAVEFRONT_SORT_KEYS (WAVEFRONT_MATERIAL_KEYS * 8)
+
+typedef struct
+{
+    Ray ray;
+    float3 total_attenuation;
+    HitInfo hit;
+    float3 hit_normal;
+    int pixel;
+    int bounce;
+    int material_key; // material of the last hit, used to bucket the next march
+    int sort_key;
+} WavefrontPath;
+
+typedef struct
+{
+    uint64_t rays;
+    uint64_t march_evaluations;  // distance_function calls that did useful work
+    uint64_t march_lane_slots;   // simd width * lockstep iterations of the march packets
+    uint64_t shade_packets;
+    uint64_t shade_material_runs; // distinct materials summed over shade packets
+} WavefrontStats;
+
+typedef struct
+{
+    int width;
+    int height;
+    int pixel_count;
+
+    float2 *seeds;
+    float3 *colors;
+    float3 *normals;
+    float *depths;
+    float *materials;
+
+    WavefrontPath *queue;
+    WavefrontPath *scratch;
+    int queue_count;
+
+    // march cost and material of every (sample, bounce, pixel), -1 when the path
+    // had already finished, so the per pixel megakernel can be costed afterwards
+    int16_t *step_log;
+    int8_t *material_log;
+
+    WavefrontStats stats;
+} Wavefront;
+
+static bool wavefront_create(Wavefront *const this, int const width, int const height)
+{
+    size_t const pixel_count = (size_t)width * height;
+    size_t const log_count = pixel_count * SCENE_TOTAL_SAMPLES * SCENE_MAX_BOUNCES;
+
+    *this = (Wavefront) {
+        .width = width,
+        .height = height,
+        .pixel_count = (int)pixel_count,
+        .seeds = malloc(pixel_count * sizeof(float2)),
+        .colors = malloc(pixel_count * sizeof(float3)),
+        .normals = malloc(pixel_count * sizeof(float3)),
+        .depths = malloc(pixel_count * sizeof(float)),
+        .materials = malloc(pixel_count * sizeof(float)),
+        .queue = malloc(pixel_count * sizeof(WavefrontPath)),
+        .scratch = malloc(pixel_count * sizeof(WavefrontPath)),
+        .step_log = malloc(log_count * sizeof(int16_t)),
+        .material_log = malloc(log_count),
+    };
+
+    return this->seeds != NULL && this->colors != NULL && this->normals != NULL &&
+           this->depths != NULL && this->materials != NULL &&
+           this->queue != NULL && this->scratch != NULL &&
+           this->step_log != NULL && this->material_log != NULL;
+}
+
+static void wavefront_destroy(Wavefront *const this)
+{
+    free(this->seeds);
+    free(this->colors);
+    free(this->normals);
+    free(this->depths);
+    free(this->materials);
+    free(this->queue);
+    free(this->scratch);
+    free(this->step_log);
+    free(this->material_log);
+}
+
+static inline int march_evaluations(HitInfo const hit)
+{
+    // ray_march calls distance_function once more than the step it stopped at
+    return hit.step_count < SCENE_MAX_STEPS ? hit.step_count + 1 : hit.step_count;
+}
+
+static inline bool hit_is_miss(HitInfo const hit)
+{
+    return hit.step_count == SCENE_MAX_STEPS || hit.distance.distance >= SCENE_MAX_DISTANCE;
+}
+
+static inline int material_key(HitInfo const hit)
+{
+    if (hit_is_miss(hit)) return 0;
+
+    int const hit_index = (int)hit.distance.material;
+    return hit_index > 8 ? WAVEFRONT_MATERIAL_KEYS - 1 : hit_index + 1;
+}
+
+static inline int direction_octant(float3 const dir)
+{
+    return (dir.x < 0.0f) | ((dir.y < 0.0f) << 1) | ((dir.z < 0.0f) << 2);
+}
+
+static inline size_t wavefront_log_index(Wavefront const *const this,
+                                         int const sample, int const bounce,
+                                         int const pixel)
+{
+    return ((size_t)sample * SCENE_MAX_BOUNCES + bounce) * this->pixel_count + pixel;
+}
+
+// stable counting sort of the queue by sort_key
+static void wavefront_bucket(Wavefront *const this, int const key_count)
+{
+    int offsets[WAVEFRONT_SORT_KEYS + 1] = {0};
+
+    for (int i = 0; i < this->queue_count; ++i) ++offsets[this->queue[i].sort_key + 1];
+    for (int k = 0; k < key_count; ++k) offsets[k + 1] += offsets[k];
+
+    for (int i = 0; i < this->queue_count; ++i)
+    {
+        this->scratch[offsets[this->queue[i].sort_key]++] = this->queue[i];
+    }
+
+    WavefrontPath *const swap = this->queue;
+    this->queue = this->scratch;
+    this->scratch = swap;
+}
+
+static void wavefront_generate(Wavefront *const this, SceneConstants const *const constants)
+{
+    float2 const pixel_size = scene_pixel_size(constants);
+
+    this->queue_count = 0;
+    for (int y = 0; y < this->height; ++y)
+    {
+        for (int x = 0; x < this->width; ++x)
+        {
+            int const pixel = y * this->width + x;
+            float2 const coords = scene_pixel_coords(x, y, this->width, this->height);
+            float2 const jitter = mul2(hash22(this->seeds + pixel), pixel_size);
+
+            this->queue[this->queue_count++] = (WavefrontPath) {
+                .ray = look_at_ray(constants, scene_camera_position(),
+                                   scene_camera_look_at(), to_radians(60.0f),
+                                   add2(coords, jitter)),
+                .pixel = pixel,
+            };
+        }
+    }
+}
+
+static void wavefront_march(Wavefront *const this, SceneConstants const *const constants,
+                            int const sample)
+{
+    for (int start = 0; start < this->queue_count; start += WAVEFRONT_SIMD_WIDTH)
+    {
+        int const end = start + WAVEFRONT_SIMD_WIDTH < this->queue_count ?
+                        start + WAVEFRONT_SIMD_WIDTH : this->queue_count;
+
+        int packet_steps = 0;
+        for (int i = start; i < end; ++i)
+        {
+            WavefrontPath *const path = this->queue + i;
+            path->hit = ray_march(path->ray, constants->timer, SCENE_MAX_STEPS,
+                                  scene_ray_cone(constants, path->bounce));
+
+            int const steps = march_evaluations(path->hit);
+            packet_steps = steps > packet_steps ? steps : packet_steps;
+
+            this->stats.march_evaluations += (uint64_t)steps;
+            path->sort_key = material_key(path->hit);
+
+            size_t const log_index = wavefront_log_index(this, sample, path->bounce, path->pixel);
+            this->step_log[log_index] = (int16_t)steps;
+            this->material_log[log_index] = (int8_t)path->sort_key;
+        }
+
+        this->stats.march_lane_slots += (uint64_t)packet_steps * WAVEFRONT_SIMD_WIDTH;
+    }
+
+    this->stats.rays += (uint64_t)this->queue_count;
+}
+
+static uint64_t count_distinct_bits(uint32_t seen)
+{
+    uint64_t distinct = 0;
+    for (; seen != 0; seen &= seen - 1) ++distinct;
+    return distinct;
+}
+
+// terminates missed rays and rays that reached the light, computes the
+// normal and attenuation for the rest
+static void wavefront_shade(Wavefront *const this, SceneConstants const *const constants,
+                            int const sample)
+{
+    for (int start = 0; start < this->queue_count; start += WAVEFRONT_SIMD_WIDTH)
+    {
+        int const count = this->queue_count - start < WAVEFRONT_SIMD_WIDTH ?
+                          this->queue_count - start : WAVEFRONT_SIMD_WIDTH;
+
+        uint32_t seen = 0;
+        for (int i = 0; i < count; ++i) seen |= 1U << this->queue[start + i].sort_key;
+
+        ++this->stats.shade_packets;
+        this->stats.shade_material_runs += count_distinct_bits(seen);
+    }
+
+    int survivors = 0;
+    for (int k = 0; k < this->queue_count; ++k)
+    {
+        WavefrontPath path = this->queue[k];
+        int const i = path.bounce;
+
+        if (hit_is_miss(path.hit))
+        {
+            if (i == 0) path.total_attenuation = f3s(1.0f);
+
+            float const background =
+                pow2(fabsf(path.ray.dir.y + 0.3f) + hash12(this->seeds + path.pixel) * 0.1f) *
+                0.25f;
+
+            this->colors[path.pixel] = add3(this->colors[path.pixel],
+                                            scale3(path.total_attenuation, background));
+            continue;
+        }
+
+        float3 const hit_position =
+            add3(path.ray.pos, scale3(path.ray.dir, path.hit.distance.distance));
+        path.hit_normal = calculate_normal(hit_position, constants->timer);
+
+        if (i == 0 && sample == 0)
+        {
+            this->depths[path.pixel] = path.hit.distance.distance;
+            this->materials[path.pixel] = path.hit.distance.material;
+        }
+
+        int const hit_index = (int)path.hit.distance.material;
+        if (hit_index > 8)
+        {
+            float3 const strength = f3s(0.9f);
+            this->colors[path.pixel] =
+                add3(this->colors[path.pixel],
+                     i == 0 ? strength : mul3(strength, path.total_attenuation));
+            this->normals[path.pixel] = add3(this->normals[path.pixel], path.hit_normal);
+            continue;
+        }
+
+        float3 const attenuation = material_attenuation(hit_index);
+        path.total_attenuation = i == 0 ? attenuation : mul3(path.total_attenuation, attenuation);
+        path.ray.pos = hit_position;
+        path.material_key = path.sort_key;
+
+        if (i == 0 && sample == 0)
+        {
+            this->normals[path.pixel] = add3(this->normals[path.pixel], path.hit_normal);
+        }
+
+        this->scratch[survivors++] = path;
+    }
+
+    WavefrontPath *const swap = this->queue;
+    this->queue = this->scratch;
+    this->scratch = swap;
+    this->queue_count = survivors;
+}
+
+// picks the diffuse bounce direction for the shaded rays and drops rays whose
+// throughput is too small or that ran out of bounces
+static void wavefront_bounce(Wavefront *const this)
+{
+    int survivors = 0;
+    for (int k = 0; k < this->queue_count; ++k)
+    {
+        WavefrontPath path = this->queue[k];
+        float3 const target =
+            add3(path.hit_normal, random_in_unit_sphere(this->seeds + path.pixel,
+                                                        path.hit_normal));
+
+        path.ray.pos = add3(path.ray.pos, scale3(path.hit_normal, 0.003f));
+        path.ray.dir = normalize3(target);
+        ++path.bounce;
+
+        if (dot3(path.total_attenuation, path.total_attenuation) < 0.01f ||
+            path.bounce >= SCENE_MAX_BOUNCES)
+        {
+            continue;
+        }
+
+        path.sort_key = path.material_key * 8 + direction_octant(path.ray.dir);
+        this->queue[survivors++] = path;
+    }
+
+    this->queue_count = survivors;
+}
+
+// traces a full frame into gbuffer, stats accumulate across calls
+static void wavefront_trace_frame(Wavefront *const this,
+                                  SceneConstants const *const constants,
+                                  bool const sort_queues,
+                                  GBufferTexel *const gbuffer)
+{
+    for (int pixel = 0; pixel < this->pixel_count; ++pixel)
+    {
+        int const x = pixel % this->width;
+        int const y = pixel / this->width;
+
+        this->seeds[pixel] = scene_pixel_coords(x, y, this->width, this->height);
+        this->colors[pixel] = f3s(0.0f);
+        this->normals[pixel] = f3s(0.0f);
+        this->depths[pixel] = SCENE_MAX_DISTANCE;
+        this->materials[pixel] = GBUFFER_MATERIAL_MISS;
+    }
+
+    size_t const log_count = (size_t)this->pixel_count * SCENE_TOTAL_SAMPLES * SCENE_MAX_BOUNCES;
+    memset(this->step_log, -1, log_count * sizeof(int16_t));
+    memset(this->material_log, -1, log_count);
+
+    for (int sample = 0; sample < SCENE_TOTAL_SAMPLES; ++sample)
+    {
+        wavefront_generate(this, constants);
+
+        while (this->queue_count > 0)
+        {
+            wavefront_march(this, constants, sample);
+            if (sort_queues) wavefront_bucket(this, WAVEFRONT_MATERIAL_KEYS);
+
+            wavefront_shade(this, constants, sample);
+            wavefront_bounce(this);
+            if (sort_queues) wavefront_bucket(this, WAVEFRONT_SORT_KEYS);
+        }
+    }
+
+    float const inverse_count = 1.0f / (float)SCENE_TOTAL_SAMPLES;
+    for (int pixel = 0; pixel < this->pixel_count; ++pixel)
+    {
+        gbuffer[pixel] = gbuffer_quantize((GBufferTexel) {
+            scale3(this->colors[pixel], inverse_count),
+            scale3(this->normals[pixel], inverse_count),
+            this->depths[pixel],
+            this->materials[pixel],
+        });
+    }
+}
+
+// what the same frame costs when simd lanes run neighbouring pixels through
+// ps_main in lockstep, read back from the logs of the last wavefront_trace_frame
+static WavefrontStats wavefront_megakernel_stats(Wavefront const *const this)
+{
+    WavefrontStats stats = {0};
+
+    for (int start = 0; start < this->pixel_count; start += WAVEFRONT_SIMD_WIDTH)
+    {
+        int const count = this->pixel_count - start < WAVEFRONT_SIMD_WIDTH ?
+                          this->pixel_count - start : WAVEFRONT_SIMD_WIDTH;
+
+        for (int sample = 0; sample < SCENE_TOTAL_SAMPLES; ++sample)
+        {
+            for (int bounce = 0; bounce < SCENE_MAX_BOUNCES; ++bounce)
+            {
+                size_t const base = wavefront_log_index(this, sample, bounce, start);
+
+                int packet_steps = 0;
+                uint32_t seen = 0;
+                int active = 0;
+
+                for (int lane = 0; lane < count; ++lane)
+                {
+                    int const steps = this->step_log[base + lane];
+                    if (steps < 0) continue;
+
+                    packet_steps = steps > packet_steps ? steps : packet_steps;
+                    stats.march_evaluations += (uint64_t)steps;
+                    seen |= 1U << this->material_log[base + lane];
+                    ++active;
+                }
+
+                if (active == 0) continue;
+
+                stats.rays += (uint64_t)active;
+                stats.march_lane_slots += (uint64_t)packet_steps * WAVEFRONT_SIMD_WIDTH;
+                ++stats.shade_packets;
+                stats.shade_material_runs += count_distinct_bits(seen);
+            }
+        }
+    }
+
+    return stats;
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+// decides when the render thread may start its next frame. the clock is
+// whatever the caller measures time in (QueryPerformanceCounter ticks in
+// main.c), so the policy can be driven by a simulated clock as well.
+// uses no crt functions so it can be built into the screensaver
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+    POWER_SOURCE_AC,
+    POWER_SOURCE_BATTERY,
+} PowerSource;
+
+// 0 in any of the fps fields means no cap from that rule
+typedef struct
+{
+    uint32_t target_fps;
+    uint32_t preview_fps;  // cap for the small preview in the screensaver dialog
+    uint32_t battery_fps;  // deep throttle while running on battery
+    bool vsync;
+} FramePacingSettings;
+
+typedef struct
+{
+    uint64_t interval_count;
+    int64_t mean_interval;  // ticks between frame starts
+    int64_t mean_jitter;    // mean distance of an interval from the target interval,
+                            // or from the interval before it when uncapped
+    int64_t max_jitter;
+} FramePacingStats;
+
+typedef struct
+{
+    FramePacingSettings settings;
+    int64_t ticks_per_second;
+    bool is_preview;
+    PowerSource power_source;
+
+    int64_t frame_interval; // 0 when uncapped
+    int64_t next_frame_time;
+    int64_t next_power_poll;
+
+    int64_t last_frame_time;
+    int64_t last_interval;  // 0 before the first one
+    uint64_t interval_count;
+    int64_t interval_sum;
+    int64_t jitter_sum;
+    int64_t max_jitter;
+} FramePacer;
+
+static uint32_t frame_pacer_min_fps(uint32_t const a, uint32_t const b)
+{
+    if (a == 0) return b;
+    if (b == 0) return a;
+    return a < b ? a : b;
+}
+
+static uint32_t frame_pacer_fps(FramePacer const *const this)
+{
+    uint32_t fps = this->settings.target_fps;
+
+    if (this->is_preview)
+    {
+        fps = frame_pacer_min_fps(fps, this->settings.preview_fps);
+    }
+
+    if (this->power_source == POWER_SOURCE_BATTERY)
+    {
+        fps = frame_pacer_min_fps(fps, this->settings.battery_fps);
+    }
+
+    return fps;
+}
+
+static void frame_pacer_update_interval(FramePacer *const this)
+{
+    uint32_t const fps = frame_pacer_fps(this);
+    this->frame_interval = fps == 0 ? 0 : this->ticks_per_second / fps;
+}
+
+static void frame_pacer_reset_stats(FramePacer *const this)
+{
+    this->last_interval = 0;
+    this->interval_count = 0;
+    this->interval_sum = 0;
+    this->jitter_sum = 0;
+    this->max_jitter = 0;
+}
+
+static void frame_pacer_init(FramePacer *const this,
+                             FramePacingSettings const settings,
+                             int64_t const ticks_per_second,
+                             bool const is_preview,
+                             int64_t const now)
+{
+    this->settings = settings;
+    this->ticks_per_second = ticks_per_second;
+    this->is_preview = is_preview;
+    this->power_source = POWER_SOURCE_AC;
+    this->next_frame_time = now;
+    this->next_power_poll = now;
+    this->last_frame_time = -1;
+
+    frame_pacer_reset_stats(this);
+    frame_pacer_update_interval(this);
+}
+
+// the power source is polled about once a second, not every frame
+static bool frame_pacer_should_poll_power(FramePacer *const this, int64_t const now)
+{
+    if (now < this->next_power_poll) return false;
+
+    this->next_power_poll = now + this->ticks_per_second;
+    return true;
+}
+
+static void frame_pacer_set_power_source(FramePacer *const this, PowerSource const power_source)
+{
+    if (this->power_source == power_source) return;
+
+    this->power_source = power_source;
+    frame_pacer_update_interval(this);
+}
+
+// the sync interval to pass to Present
+static uint32_t frame_pacer_sync_interval(FramePacer const *const this)
+{
+    return this->settings.vsync ? 1 : 0;
+}
+
+// how long to sleep before the next frame may start, 0 to start right away
+static int64_t frame_pacer_wait_ticks(FramePacer const *const this, int64_t const now)
+{
+    if (this->frame_interval == 0 || now >= this->next_frame_time) return 0;
+    return this->next_frame_time - now;
+}
+
+// call when a frame starts, schedules the next one and records the interval
+static void frame_pacer_frame_started(FramePacer *const this, int64_t const now)
+{
+    if (this->last_frame_time >= 0)
+    {
+        int64_t const interval = now - this->last_frame_time;
+        int64_t const expected = this->frame_interval != 0 ? this->frame_interval :
+                                 this->last_interval != 0 ? this->last_interval : interval;
+        int64_t const jitter = interval > expected ? interval - expected : expected - interval;
+
+        ++this->interval_count;
+        this->interval_sum += interval;
+        this->jitter_sum += jitter;
+        this->max_jitter = jitter > this->max_jitter ? jitter : this->max_jitter;
+        this->last_interval = interval;
+    }
+
+    this->last_frame_time = now;
+
+    // keep to the schedule, unless we fell a whole frame behind, then
+    // restart it from now instead of rendering a burst to catch up
+    this->next_frame_time += this->frame_interval;
+    if (this->next_frame_time <= now)
+    {
+        this->next_frame_time = now + this->frame_interval;
+    }
+}
+
+static FramePacingStats frame_pacer_stats(FramePacer const *const this)
+{
+    FramePacingStats stats = {.interval_count = this->interval_count};
+    if (this->interval_count == 0) return stats;
+
+    stats.mean_interval = this->interval_sum / (int64_t)this->interval_count;
+    stats.mean_jitter = this->jitter_sum / (int64_t)this->interval_count;
+    stats.max_jitter = this->max_jitter;
+    return stats;
+}
+
+#endif
@@ -18,25 +18,46 @@ static
 static
 #include "post_pixel_shader.h"
 
+static
+#include "reconstruct_pixel_shader.h"
+
+static
+#include "generate_pixel_shader.h"
+
+static
+#include "upscale_pixel_shader.h"
+
 static
 #include "vertex_shader.h"
 #endif
 
+#include "frame_pacing.h"
+#include "runtime.h"
+#include "quality_tuner.h"
+#include "shader_cache.h"
+#include "window_state.h"
+
 #if defined(_MSC_VER) && !defined(__clang__)
 #define REAL_MSVC
 #endif
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
 #ifdef REAL_MSVC
-#pragma function(memset)
+#pragma function(memset, memcpy)
 #endif
+RUNTIME_NO_BUILTIN
 void *memset(void *dest, int c, size_t count)
 {
-    char *bytes = (char *)dest;
-    while (count-- != 0)
-    {
-        *bytes++ = (char)c;
-    }
-    return dest;
+    return runtime_memset(dest, c, count);
+}
+
+RUNTIME_NO_BUILTIN
+void *memcpy(void *dest, void const *source, size_t count)
+{
+    return runtime_memcpy(dest, source, count);
 }
 
 static int iabs(int const value) { return value < 0 ? -value : value; }
@@ -45,6 +66,8 @@ extern int _fltused;
 int _fltused;
 
 #define WAKE_THRESHOLD 4
+// posted by the render thread with a heap allocated title, the pump sets and frees it
+#define WM_APP_PACING_TITLE (WM_APP + 0)
 #define BLACK_WINDOW_CLASS L"black_window_class"
 #define ARRAY_COUNT(...) (sizeof((__VA_ARGS__)) / sizeof(*(__VA_ARGS__)))
 
@@ -55,9 +78,48 @@ typedef __declspec(align(16)) struct
     float aspect_ratio;
     float timer;
     float pixel_width;
+    uint32_t frame_index;
+    uint32_t checkerboard_pattern;
+    uint32_t checkerboard_filter;
+    uint32_t history_valid;
+    uint32_t total_samples;
+    uint32_t max_bounces;
+    uint32_t max_steps;
+    float source_timer;
+    float older_timer;
+    uint32_t older_valid;
+    float lod_cone;
 } ShaderConstants;
 #pragma pack(pop)
 
+// values match the constants in shaders.hlsl
+typedef enum
+{
+    CHECKERBOARD_OFF,
+    CHECKERBOARD_CHECKER,
+    CHECKERBOARD_ROWS,
+} CheckerboardPattern;
+
+typedef enum
+{
+    RECONSTRUCT_SPATIAL,
+    RECONSTRUCT_TEMPORAL_CLAMP,
+} ReconstructFilter;
+
+// what to do on frames without a usable previous frame
+typedef enum
+{
+    FALLBACK_SPATIAL,
+    FALLBACK_FULL_FRAME,
+} CheckerboardFallback;
+
+typedef struct
+{
+    CheckerboardPattern pattern;
+    ReconstructFilter filter;
+    CheckerboardFallback fallback;
+} CheckerboardSettings;
+
 typedef enum
 {
     PREVIEW_MODE,
@@ -87,13 +149,58 @@ typedef struct
     ID3D11VertexShader *vertex_shader;
     ID3D11PixelShader *pixel_shader;
     ID3D11PixelShader *post_pixel_shader;
+    ID3D11PixelShader *reconstruct_pixel_shader;
+    ID3D11PixelShader *generate_pixel_shader;
+    ID3D11PixelShader *upscale_pixel_shader;
     
     ID3D11Buffer *constant_buffer;
 
-    RenderTexture render_textures[2];
-    ID3D11SamplerState *render_texture_sampler;
+    // color, gbuffer (normal, depth and material) and, with checkerboard
+    // rendering, the reconstructed color and gbuffer. frame generation adds a
+    // color and gbuffer pair for the older traced frame and one for the
+    // generated frame
+    RenderTexture render_textures[8];
+    int render_texture_count;
+
+    // the post filtered frame at the render resolution when that is smaller
+    // than the window, upscale_ps_main samples it linearly onto the window
+    RenderTexture post_texture;
+    ID3D11SamplerState *upscale_sampler;
+
+    // with frame generation the odd frames are warped from the traced ones
+    bool frame_generation;
+    uint32_t generation_frame;  // frames since the textures were created
+    float traced_timers[2];     // the timer each pair of traced textures was traced at
+
+    // with the level of detail the march hits at an epsilon that grows with distance
+    bool level_of_detail;
+
+    CheckerboardSettings checkerboard;
+    uint32_t frame_index;
+    bool history_valid;
+
+    // the render textures are resolution_percent of the window size
+    QualitySettings quality;
+    int forced_quality_level;   // -1 lets the tuner pick
+    bool recalibrate_quality;
+    uint64_t adapter_hash;
+    int render_width;
+    int render_height;
 
     HANDLE frame_latency_waitable_object;
+
+    FramePacer frame_pacer;
+    HANDLE frame_timer;
+    ModeType mode;
+
+#ifndef RELEASE_BUILD
+    uint64_t shader_source_hash;
+#endif
+
+#ifdef SHADER_HOT_RELOAD
+    // compiled by the reload thread, swapped in by the render thread between frames
+    struct PixelShaderSet *volatile pending_pixel_shaders;
+#endif
     
     int width;
     int height;
@@ -110,6 +217,20 @@ static void get_client_size(HWND const window,
     *y = rect.bottom - rect.top;
 }
 
+// written by the message pump, polled by the render thread
+static WindowStateChannel window_state;
+
+// the window rendered to, the black windows on other screens share its window proc
+static HWND window_state_window;
+
+static void publish_window_size(HWND const window, WPARAM const wParam, LPARAM const lParam)
+{
+    if (window != window_state_window) return;
+    
+    window_state_set_size(&window_state, LOWORD(lParam), HIWORD(lParam));
+    window_state_set_visible(&window_state, wParam != SIZE_MINIMIZED);
+}
+
 __declspec(dllexport) unsigned long NvOptimusEnablement = 1;
 __declspec(dllexport) int AmdPowerXpressRequestHighPerformance = 1;
 
@@ -132,10 +253,25 @@ static LRESULT __stdcall WindowProc(HWND const window_handle, UINT const message
             break;
         }
 
+        case WM_SIZE:
+        {
+            publish_window_size(window_handle, wParam, lParam);
+            break;
+        }
+
+        case WM_APP_PACING_TITLE:
+        {
+            wchar_t *const title = (wchar_t *)lParam;
+            SetWindowTextW(window_handle, title);
+            HeapFree(GetProcessHeap(), 0, title);
+            break;
+        }
+
         case WM_QUIT:
         case WM_CLOSE:
         case WM_DESTROY:
         {
+            window_state_request_quit(&window_state);
             PostQuitMessage(0);
             break;
         }
@@ -155,10 +291,17 @@ static LRESULT __stdcall ChildWindowProc(HWND const hWnd, UINT const message,
 {
     switch (message)
     {        
+        case WM_SIZE:
+        {
+            publish_window_size(hWnd, wParam, lParam);
+            break;
+        }
+
         case WM_QUIT:
         case WM_CLOSE:
         case WM_DESTROY:
         {
+            window_state_request_quit(&window_state);
             PostQuitMessage(0);
             break;
         }
@@ -224,10 +367,17 @@ static LRESULT __stdcall ScreenSaverProc(HWND const hWnd, UINT const message,
             return TRUE;
         }
 
+        case WM_SIZE:
+        {
+            publish_window_size(hWnd, wParam, lParam);
+            break;
+        }
+
         case WM_QUIT:
         case WM_CLOSE:
         case WM_DESTROY:
         {
+            window_state_request_quit(&window_state);
             PostQuitMessage(0);
             break;
         }
@@ -261,6 +411,8 @@ static void state_create_window(State *const this,
     WNDPROC window_proc = &ScreenSaverProc;
     wchar_t const *window_title = NULL;
     DWORD window_extra_style = WS_EX_NOREDIRECTIONBITMAP;
+
+    this->mode = mode;
    
     switch (mode)
     {
@@ -323,18 +475,61 @@ static void state_create_window(State *const this,
     ShowWindow(this->window_handle, SW_SHOWDEFAULT);
 }
 
+#define RENDER_TEXTURE_RECONSTRUCTED_PAIR 2
+#define RENDER_TEXTURE_OLDER_PAIR 4
+#define RENDER_TEXTURE_GENERATED_PAIR 6
+
+// the reconstructed pair is only there with checkerboard rendering
+static bool state_has_render_texture(State const *const this, int const index)
+{
+    bool const reconstructed = index == RENDER_TEXTURE_RECONSTRUCTED_PAIR ||
+                               index == RENDER_TEXTURE_RECONSTRUCTED_PAIR + 1;
+    return !reconstructed || this->checkerboard.pattern != CHECKERBOARD_OFF;
+}
+
+// the first of the color and gbuffer pair the newest traced frame is in
+static int state_traced_pair(State const *const this)
+{
+    if (!this->frame_generation) return 0;
+    return (this->generation_frame / 2) % 2 == 0 ? 0 : RENDER_TEXTURE_OLDER_PAIR;
+}
+
+static bool state_generates_frame(State const *const this)
+{
+    return this->frame_generation && this->generation_frame % 2 != 0;
+}
+
 static void state_create_d3d_textures(State *const this)
 {
-    for (int i = 0; i < 2; ++i)
+    // hdr color and the packed gbuffer ps_main writes, both 4 bytes per pixel
+    DXGI_FORMAT const formats[ARRAY_COUNT(this->render_textures)] = {
+        DXGI_FORMAT_R11G11B10_FLOAT,
+        DXGI_FORMAT_R32_UINT,
+        DXGI_FORMAT_R11G11B10_FLOAT,
+        DXGI_FORMAT_R32_UINT,
+        DXGI_FORMAT_R11G11B10_FLOAT,
+        DXGI_FORMAT_R32_UINT,
+        DXGI_FORMAT_R11G11B10_FLOAT,
+        DXGI_FORMAT_R32_UINT,
+    };
+    
+    this->render_texture_count = this->frame_generation ? 8 :
+                                 this->checkerboard.pattern == CHECKERBOARD_OFF ? 2 : 4;
+    this->history_valid = false;
+    this->generation_frame = 0;
+
+    for (int i = 0; i < this->render_texture_count; ++i)
     {
+        if (!state_has_render_texture(this, i)) continue;
+        
         this->device->lpVtbl->CreateTexture2D(this->device,
                                               &(D3D11_TEXTURE2D_DESC)
                                               {
-                                                  .Width = this->width,
-                                                  .Height = this->height,
+                                                  .Width = this->render_width,
+                                                  .Height = this->render_height,
                                                   .MipLevels = 1,
                                                   .ArraySize = 1,
-                                                  .Format = DXGI_FORMAT_R8G8B8A8_UNORM,
+                                                  .Format = formats[i],
                                                   .SampleDesc.Count = 1,
                                                   .Usage = D3D11_USAGE_DEFAULT,
                                                   .BindFlags = (D3D11_BIND_RENDER_TARGET |
@@ -350,16 +545,344 @@ static void state_create_d3d_textures(State *const this)
                                               (ID3D11Resource*)this->render_textures[i].texture,
                                               NULL, &this->render_textures[i].texture_shader_view);
     }
+
+    if (this->render_width == this->width && this->render_height == this->height) return;
+
+    // the swap chain's format, the post pass writes the final colors
+    this->device->lpVtbl->CreateTexture2D(this->device,
+                                          &(D3D11_TEXTURE2D_DESC)
+                                          {
+                                              .Width = this->render_width,
+                                              .Height = this->render_height,
+                                              .MipLevels = 1,
+                                              .ArraySize = 1,
+                                              .Format = DXGI_FORMAT_R8G8B8A8_UNORM,
+                                              .SampleDesc.Count = 1,
+                                              .Usage = D3D11_USAGE_DEFAULT,
+                                              .BindFlags = (D3D11_BIND_RENDER_TARGET |
+                                                            D3D11_BIND_SHADER_RESOURCE),
+                                          }, NULL,
+                                          &this->post_texture.texture);
+
+    ID3D11Device_CreateRenderTargetView(this->device,
+                                        (ID3D11Resource*)this->post_texture.texture,
+                                        NULL, &this->post_texture.texture_view);
+
+    ID3D11Device_CreateShaderResourceView(this->device,
+                                          (ID3D11Resource*)this->post_texture.texture,
+                                          NULL, &this->post_texture.texture_shader_view);
 }
 
 static void state_destroy_d3d_textures(State *const this)
 {
-    for (int i = 0; i < 2; ++i)
+    for (int i = 0; i < this->render_texture_count; ++i)
     {
+        if (!state_has_render_texture(this, i)) continue;
+        
         ID3D11RenderTargetView_Release(this->render_textures[i].texture_view);
         ID3D11ShaderResourceView_Release(this->render_textures[i].texture_shader_view);
         ID3D11Texture2D_Release(this->render_textures[i].texture);
     }
+
+    // the render size may have changed already, so go by the texture
+    if (this->post_texture.texture == NULL) return;
+
+    ID3D11RenderTargetView_Release(this->post_texture.texture_view);
+    ID3D11ShaderResourceView_Release(this->post_texture.texture_shader_view);
+    ID3D11Texture2D_Release(this->post_texture.texture);
+    this->post_texture = (RenderTexture) {0};
+}
+
+// returns true when the render textures have to be recreated
+static bool state_update_render_size(State *const this)
+{
+    int const render_width = quality_scaled_size(this->width, &this->quality);
+    int const render_height = quality_scaled_size(this->height, &this->quality);
+    bool const changed = render_width != this->render_width ||
+                         render_height != this->render_height;
+
+    this->render_width = render_width;
+    this->render_height = render_height;
+    return changed;
+}
+
+static void state_set_viewport(State *const this, int const width, int const height)
+{
+    this->device_context->lpVtbl->RSSetViewports(this->device_context, 1,
+                                                 &(D3D11_VIEWPORT) {
+                                                     .Width = (float)width,
+                                                     .Height = (float)height,
+                                                     .MinDepth = 0.0f,
+                                                     .MaxDepth = 1.0f,
+                                                 });
+}
+
+#ifndef RELEASE_BUILD
+#define SHADER_SOURCE_PATH L"shaders.hlsl"
+#define SHADER_CACHE_DIRECTORY L"shader_cache"
+#define SHADER_CACHE_PATH_LENGTH (ARRAY_COUNT(SHADER_CACHE_DIRECTORY) + SHADER_CACHE_NAME_LENGTH)
+
+#define VERTEX_SHADER_FLAGS D3DCOMPILE_ENABLE_STRICTNESS
+#define PIXEL_SHADER_FLAGS (D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_OPTIMIZATION_LEVEL3)
+
+#define PIXEL_SHADER_COUNT 5
+
+static char const *const pixel_shader_entry_points[PIXEL_SHADER_COUNT] = {
+    "ps_main", "post_ps_main", "reconstruct_ps_main", "generate_ps_main", "upscale_ps_main",
+};
+
+static void state_get_pixel_shader_slots(State *const this,
+                                         ID3D11PixelShader **slots[PIXEL_SHADER_COUNT])
+{
+    slots[0] = &this->pixel_shader;
+    slots[1] = &this->post_pixel_shader;
+    slots[2] = &this->reconstruct_pixel_shader;
+    slots[3] = &this->generate_pixel_shader;
+    slots[4] = &this->upscale_pixel_shader;
+}
+
+typedef struct
+{
+    void *data;
+    size_t size;
+} FileData;
+
+static bool read_whole_file(wchar_t const *const path, FileData *const file)
+{
+    HANDLE const handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    
+    if (handle == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    bool success = GetFileSizeEx(handle, &size) && size.QuadPart < MAXDWORD;
+
+    // one extra byte so empty files still get a buffer
+    file->size = success ? (size_t)size.QuadPart : 0;
+    file->data = success ? HeapAlloc(GetProcessHeap(), 0, file->size + 1) : NULL;
+
+    DWORD bytes_read = 0;
+    success = file->data != NULL &&
+              ReadFile(handle, file->data, (DWORD)file->size, &bytes_read, NULL) &&
+              bytes_read == file->size;
+    
+    CloseHandle(handle);
+
+    if (!success && file->data != NULL)
+    {
+        HeapFree(GetProcessHeap(), 0, file->data);
+    }
+    
+    return success;
+}
+
+static void free_file(FileData *const file)
+{
+    HeapFree(GetProcessHeap(), 0, file->data);
+    file->data = NULL;
+}
+
+static void shader_cache_path(uint64_t const key, wchar_t path[SHADER_CACHE_PATH_LENGTH])
+{
+    wchar_t const directory[] = SHADER_CACHE_DIRECTORY L"\\";
+    
+    char name[SHADER_CACHE_NAME_LENGTH];
+    shader_cache_file_name(key, name);
+
+    size_t length = 0;
+    for (; directory[length] != L'\0'; ++length)
+    {
+        path[length] = directory[length];
+    }
+    
+    for (size_t i = 0; i < SHADER_CACHE_NAME_LENGTH; ++i)
+    {
+        path[length + i] = (wchar_t)name[i];
+    }
+}
+
+typedef struct
+{
+    ID3DBlob *blob;  // set when the shader was compiled
+    FileData file;   // set when the cache file was read
+    void const *data;
+    size_t size;
+} CompiledShader;
+
+typedef struct
+{
+    HWND window;
+    CompiledShader *shader;
+} ShaderCacheContext;
+
+static bool read_shader_cache_file(void *const context, uint64_t const key,
+                                   void const **const file_data, size_t *const file_size)
+{
+    CompiledShader *const shader = ((ShaderCacheContext *)context)->shader;
+
+    wchar_t path[SHADER_CACHE_PATH_LENGTH];
+    shader_cache_path(key, path);
+
+    if (!read_whole_file(path, &shader->file))
+    {
+        shader->file.data = NULL;
+        return false;
+    }
+
+    *file_data = shader->file.data;
+    *file_size = shader->file.size;
+    return true;
+}
+
+// shows the compiler errors on failure
+static bool compile_shader_source(void *const context, void const *const source,
+                                  size_t const source_size, char const *const entry_point,
+                                  char const *const target, uint32_t const flags,
+                                  void const **const blob, size_t *const blob_size)
+{
+    ShaderCacheContext *const cache = context;
+
+    ID3DBlob *error_blob = NULL;
+    HRESULT const result = D3DCompile(source, source_size, "shaders.hlsl", NULL,
+                                      D3D_COMPILE_STANDARD_FILE_INCLUDE,
+                                      entry_point, target, flags, 0,
+                                      &cache->shader->blob, &error_blob);
+    
+    if (FAILED(result))
+    {
+        MessageBoxA(cache->window,
+                    error_blob == NULL ? "" : ID3D10Blob_GetBufferPointer(error_blob),
+                    "error:", MB_OK);
+        
+        if (error_blob != NULL) ID3D10Blob_Release(error_blob);
+        cache->shader->blob = NULL;
+        return false;
+    }
+
+    // warnings
+    if (error_blob != NULL) ID3D10Blob_Release(error_blob);
+
+    *blob = ID3D10Blob_GetBufferPointer(cache->shader->blob);
+    *blob_size = ID3D10Blob_GetBufferSize(cache->shader->blob);
+    return true;
+}
+
+static void write_shader_cache_file(void *const context, uint64_t const key,
+                                    ShaderCacheHeader const *const header,
+                                    void const *const blob, size_t const blob_size)
+{
+    (void)context;
+
+    wchar_t path[SHADER_CACHE_PATH_LENGTH];
+    shader_cache_path(key, path);
+
+    CreateDirectoryW(SHADER_CACHE_DIRECTORY, NULL);
+    
+    HANDLE const handle = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                      FILE_ATTRIBUTE_NORMAL, NULL);
+    
+    if (handle == INVALID_HANDLE_VALUE) return;
+
+    // a partly written file fails shader_cache_validate and is recompiled
+    DWORD bytes_written;
+    WriteFile(handle, header, sizeof *header, &bytes_written, NULL);
+    WriteFile(handle, blob, (DWORD)blob_size, &bytes_written, NULL);
+    CloseHandle(handle);
+}
+
+// compiles an entry point of source, or loads it from the cache when the same
+// source was compiled before. release the result with compiled_shader_release
+static bool compile_shader_cached(HWND const window, FileData const *const source,
+                                  char const *const entry_point, char const *const target,
+                                  UINT const flags, CompiledShader *const shader)
+{
+    shader->blob = NULL;
+    shader->file.data = NULL;
+
+    ShaderCacheContext context = {window, shader};
+    ShaderCacheIo const io = {
+        .context = &context,
+        .read = read_shader_cache_file,
+        .compile = compile_shader_source,
+        .write = write_shader_cache_file,
+    };
+
+    ShaderCacheResult const result = shader_cache_compile(&io, source->data, source->size,
+                                                          entry_point, target, flags,
+                                                          &shader->data, &shader->size);
+    
+    if (result == SHADER_CACHE_FAILED)
+    {
+        if (shader->file.data != NULL) free_file(&shader->file);
+        return false;
+    }
+
+    return true;
+}
+
+static void compiled_shader_release(CompiledShader *const shader)
+{
+    if (shader->blob != NULL) ID3D10Blob_Release(shader->blob);
+    if (shader->file.data != NULL) free_file(&shader->file);
+}
+
+// creates every pixel shader from source, on failure none are left behind
+static bool state_compile_pixel_shaders(State *const this, FileData const *const source,
+                                        ID3D11PixelShader *shaders[PIXEL_SHADER_COUNT])
+{
+    for (int i = 0; i < PIXEL_SHADER_COUNT; ++i)
+    {
+        CompiledShader compiled;
+        if (!compile_shader_cached(this->window_handle, source,
+                                   pixel_shader_entry_points[i], "ps_5_0",
+                                   PIXEL_SHADER_FLAGS, &compiled))
+        {
+            while (i-- > 0) ID3D11PixelShader_Release(shaders[i]);
+            return false;
+        }
+
+        this->device->lpVtbl->CreatePixelShader(this->device,
+                                                compiled.data, compiled.size,
+                                                NULL, shaders + i);
+        
+        compiled_shader_release(&compiled);
+    }
+
+    return true;
+}
+#endif
+
+// IID_ID3D10Device, CheckInterfaceSupport only reports the user mode driver
+// version for direct3d 10 interfaces and d3d10.h is not included for one guid
+static GUID const driver_version_interface = {
+    0x9b7e4c0f, 0x342c, 0x4106, {0xa1, 0x9f, 0x4f, 0x27, 0x04, 0xf6, 0x89, 0xf0},
+};
+
+// identifies the gpu and its driver for the quality cache. only fields that
+// stay the same across reboots, the luid and the memory sizes are left out
+static uint64_t adapter_hash(IDXGIAdapter *const adapter)
+{
+    DXGI_ADAPTER_DESC desc = {0};
+    LARGE_INTEGER driver_version = {0};
+    adapter->lpVtbl->GetDesc(adapter, &desc);
+    adapter->lpVtbl->CheckInterfaceSupport(adapter, &driver_version_interface, &driver_version);
+
+    size_t description_length = 0;
+    while (description_length < ARRAY_COUNT(desc.Description) &&
+           desc.Description[description_length] != L'\0')
+    {
+        ++description_length;
+    }
+
+    uint64_t hash = SHADER_CACHE_HASH_SEED;
+    hash = shader_cache_hash(hash, &desc.VendorId, sizeof desc.VendorId);
+    hash = shader_cache_hash(hash, &desc.DeviceId, sizeof desc.DeviceId);
+    hash = shader_cache_hash(hash, &desc.SubSysId, sizeof desc.SubSysId);
+    hash = shader_cache_hash(hash, &desc.Revision, sizeof desc.Revision);
+    hash = shader_cache_hash(hash, desc.Description,
+                             description_length * sizeof *desc.Description);
+    hash = shader_cache_hash(hash, &driver_version, sizeof driver_version);
+    return hash;
 }
 
 static void state_setup_d3d(State *const this, bool is_windowed)
@@ -387,6 +910,8 @@ static void state_setup_d3d(State *const this, bool is_windowed)
         
         IDXGIAdapter *dxgi_adapter;
         dxgi_device->lpVtbl->GetAdapter(dxgi_device, &dxgi_adapter);
+
+        this->adapter_hash = adapter_hash(dxgi_adapter);
         
         dxgi_adapter->lpVtbl->GetParent(dxgi_adapter,
                                         &IID_IDXGIFactory2,
@@ -448,76 +973,49 @@ static void state_setup_d3d(State *const this, bool is_windowed)
     frame_buffer->lpVtbl->Release(frame_buffer);
 
 #ifndef RELEASE_BUILD
-    HRESULT result;
-    ID3DBlob *error_blob;
-    ID3DBlob *vertex_shader_blob;
-    
-    result = D3DCompileFromFile(L"shaders.hlsl", NULL,
-                                D3D_COMPILE_STANDARD_FILE_INCLUDE,
-                                "vs_main", "vs_5_0", D3DCOMPILE_ENABLE_STRICTNESS, 0,
-                                &vertex_shader_blob, &error_blob);
-    
-    if (FAILED(result))
+    FileData source;
+    if (!read_whole_file(SHADER_SOURCE_PATH, &source))
     {
-        MessageBoxA(this->window_handle,
-                    error_blob->lpVtbl->GetBufferPointer(error_blob), "error:", MB_OK);
+        MessageBoxA(this->window_handle, "could not read shaders.hlsl", "error:", MB_OK);
         ExitProcess(1);
     }
-#endif
 
-#ifndef RELEASE_BUILD
-    void *const vertex_shader_blob_buffer_pointer =
-        vertex_shader_blob->lpVtbl->GetBufferPointer(vertex_shader_blob);
-    
-    size_t const vertex_shader_blob_buffer_size =
-        vertex_shader_blob->lpVtbl->GetBufferSize(vertex_shader_blob);
+    this->shader_source_hash = shader_cache_hash(SHADER_CACHE_HASH_SEED,
+                                                 source.data, source.size);
+
+    CompiledShader vertex_shader;
+    if (!compile_shader_cached(this->window_handle, &source, "vs_main", "vs_5_0",
+                               VERTEX_SHADER_FLAGS, &vertex_shader))
+    {
+        ExitProcess(1);
+    }
     
     this->device->lpVtbl->CreateVertexShader(this->device,
-                                             vertex_shader_blob_buffer_pointer,
-                                             vertex_shader_blob_buffer_size,
+                                             vertex_shader.data, vertex_shader.size,
                                              NULL, &this->vertex_shader);
+
+    compiled_shader_release(&vertex_shader);
+
+    ID3D11PixelShader *pixel_shaders[PIXEL_SHADER_COUNT];
+    if (!state_compile_pixel_shaders(this, &source, pixel_shaders))
+    {
+        ExitProcess(1);
+    }
+
+    ID3D11PixelShader **pixel_shader_slots[PIXEL_SHADER_COUNT];
+    state_get_pixel_shader_slots(this, pixel_shader_slots);
+    
+    for (int i = 0; i < PIXEL_SHADER_COUNT; ++i)
+    {
+        *pixel_shader_slots[i] = pixel_shaders[i];
+    }
+
+    free_file(&source);
 #else
     this->device->lpVtbl->CreateVertexShader(this->device,
                                              g_vs_main, sizeof g_vs_main,
                                              NULL, &this->vertex_shader);
-#endif
-        
-#ifndef RELEASE_BUILD
-
-#define COMPILE_PIXEL_SHADER(entry_point, shader)                       \
-    do                                                                  \
-    {                                                                   \
-                                                                        \
-        ID3DBlob *shader_blob;                                          \
-        result =  D3DCompileFromFile(L"shaders.hlsl", NULL,             \
-                                     D3D_COMPILE_STANDARD_FILE_INCLUDE, \
-                                     entry_point, "ps_5_0",             \
-                                     D3DCOMPILE_ENABLE_STRICTNESS |     \
-                                     D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, \
-                                     &shader_blob, &error_blob);        \
-                                                                        \
-        if (FAILED(result))                                             \
-        {                                                               \
-            MessageBoxA(this->window_handle,                            \
-                        ID3D10Blob_GetBufferPointer(error_blob),        \
-                        "error:", MB_OK);                               \
-            ExitProcess(1);                                             \
-        }                                                               \
-                                                                        \
-        void *const data = ID3D10Blob_GetBufferPointer(shader_blob);    \
-        size_t const size = ID3D10Blob_GetBufferSize(shader_blob);      \
-                                                                        \
-        this->device->lpVtbl->CreatePixelShader(this->device,           \
-                                                data, (DWORD)size,      \
-                                                NULL, &shader);         \
-                                                                        \
-        ID3D10Blob_Release(shader_blob);                                \
-    } while(false)
     
-    COMPILE_PIXEL_SHADER("ps_main", this->pixel_shader);
-    COMPILE_PIXEL_SHADER("post_ps_main", this->post_pixel_shader);
-    
-#else
     this->device->lpVtbl->CreatePixelShader(this->device,
                                             g_ps_main, sizeof g_ps_main,
                                             NULL, &this->pixel_shader);
@@ -526,10 +1024,21 @@ static void state_setup_d3d(State *const this, bool is_windowed)
                                             g_post_ps_main,
                                             sizeof g_post_ps_main,
                                             NULL, &this->post_pixel_shader);
-#endif
- 
-#ifndef RELEASE_BUILD
-    vertex_shader_blob->lpVtbl->Release(vertex_shader_blob);
+
+    this->device->lpVtbl->CreatePixelShader(this->device,
+                                            g_reconstruct_ps_main,
+                                            sizeof g_reconstruct_ps_main,
+                                            NULL, &this->reconstruct_pixel_shader);
+
+    this->device->lpVtbl->CreatePixelShader(this->device,
+                                            g_generate_ps_main,
+                                            sizeof g_generate_ps_main,
+                                            NULL, &this->generate_pixel_shader);
+
+    this->device->lpVtbl->CreatePixelShader(this->device,
+                                            g_upscale_ps_main,
+                                            sizeof g_upscale_ps_main,
+                                            NULL, &this->upscale_pixel_shader);
 #endif
     
     this->device->lpVtbl->CreateBuffer(this->device,
@@ -540,7 +1049,6 @@ static void state_setup_d3d(State *const this, bool is_windowed)
                                            .CPUAccessFlags = D3D11_CPU_ACCESS_WRITE
                                        }, NULL, &this->constant_buffer);
 
-    state_create_d3d_textures(this);
     ID3D11Device_CreateSamplerState(this->device,
                                     (&(D3D11_SAMPLER_DESC)
                                      {
@@ -548,17 +1056,13 @@ static void state_setup_d3d(State *const this, bool is_windowed)
                                          .AddressU = D3D11_TEXTURE_ADDRESS_CLAMP,
                                          .AddressV = D3D11_TEXTURE_ADDRESS_CLAMP,
                                          .AddressW = D3D11_TEXTURE_ADDRESS_CLAMP,
-                                     }), &this->render_texture_sampler);
+                                     }), &this->upscale_sampler);
 
+    state_update_render_size(this);
+    state_create_d3d_textures(this);
     
     // set the size of the portion of the window that we can draw to
-    this->device_context->lpVtbl->RSSetViewports(this->device_context, 1,
-                                                 &(D3D11_VIEWPORT) {
-                                                     .Width = (float)this->width,
-                                                     .Height = (float)this->height,
-                                                     .MinDepth = 0.0f,
-                                                     .MaxDepth = 1.0f,
-                                                 });
+    state_set_viewport(this, this->width, this->height);
 }
 
 static void state_handle_resize(State *const this,
@@ -578,6 +1082,7 @@ static void state_handle_resize(State *const this,
 
     ID3D11DeviceContext_ClearState(this->device_context);
     
+    state_update_render_size(this);
     state_destroy_d3d_textures(this);
     state_create_d3d_textures(this);
     
@@ -601,27 +1106,77 @@ static void state_handle_resize(State *const this,
     window_buffer->lpVtbl->Release(window_buffer);
 
     // set the size of the portion of the window that we can draw to
-    this->device_context->lpVtbl->RSSetViewports(this->device_context, 1,
-                                                 &(D3D11_VIEWPORT) {
-                                                     .Width = (float)this->width,
-                                                     .Height = (float)this->height,
-                                                     .MinDepth = 0.0f,
-                                                     .MaxDepth = 1.0f,
-                                                 });
+    state_set_viewport(this, this->width, this->height);
 }
 
 
-static void state_draw(State *const this)
+// hit epsilon per unit marched and per pixel row, SCENE_LOD_PIXEL_FRACTION of
+// the 2 tan(30 degrees) footprint of ps_main's field of view, see scene_lod_cone
+#define LOD_CONE_PER_ROW (0.25f * 1.1547005f)
+
+static void state_update_constants(State *const this, float const timer)
+{
+    D3D11_MAPPED_SUBRESOURCE mapped_subresource;
+    this->device_context->lpVtbl->Map(this->device_context,
+                                      (ID3D11Resource *)this->constant_buffer, 0,
+                                      D3D11_MAP_WRITE_DISCARD, 0, &mapped_subresource);
+    
+    ShaderConstants *const shader_constants = mapped_subresource.pData;
+    
+    shader_constants->aspect_ratio = (float)this->render_height / (float)this->render_width;
+    shader_constants->timer = timer;
+    shader_constants->pixel_width = 1.0f / (float)this->render_height;
+    shader_constants->frame_index = this->frame_index;
+    shader_constants->checkerboard_pattern = this->checkerboard.pattern;
+    shader_constants->checkerboard_filter = this->checkerboard.filter;
+    shader_constants->history_valid = this->history_valid;
+    shader_constants->total_samples = this->quality.total_samples;
+    shader_constants->max_bounces = this->quality.max_bounces;
+    shader_constants->max_steps = this->quality.max_steps;
+    shader_constants->lod_cone = this->level_of_detail ?
+                                 LOD_CONE_PER_ROW / (float)this->render_height : 0.0f;
+
+    if (this->frame_generation)
+    {
+        int const newest = (this->generation_frame / 2) % 2;
+        if (!state_generates_frame(this)) this->traced_timers[newest] = timer;
+
+        shader_constants->source_timer = this->traced_timers[newest];
+        shader_constants->older_timer = this->traced_timers[newest ^ 1];
+        shader_constants->older_valid = this->generation_frame >= 3;
+    }
+
+    // without a previous frame to reconstruct from trace everything
+    if (!this->history_valid &&
+        this->checkerboard.fallback == FALLBACK_FULL_FRAME)
+    {
+        shader_constants->checkerboard_pattern = CHECKERBOARD_OFF;
+    }
+    
+    this->device_context->lpVtbl->Unmap(this->device_context,
+                                        (ID3D11Resource *)this->constant_buffer, 0);
+}
+
+// traces, reconstructs and post processes a frame into the back buffer
+static void state_render(State *const this)
 {
     // clear background color to black
     this->device_context->lpVtbl->ClearRenderTargetView(this->device_context,
                                                         this->frame_buffer_view,
                                                         (float[4]) {[3] = 1.0f});
 
+    // the frame is traced and filtered at the render resolution, only the
+    // upscale covers the window
+    state_set_viewport(this, this->render_width, this->render_height);
+
+    bool const generated = state_generates_frame(this);
+    int const traced_pair = state_traced_pair(this);
+    int const output_pair = generated ? RENDER_TEXTURE_GENERATED_PAIR : traced_pair;
+
     ID3D11DeviceContext_OMSetRenderTargets(this->device_context, 2,
                                            ((ID3D11RenderTargetView*[]) {
-                                               this->render_textures[0].texture_view,
-                                               this->render_textures[1].texture_view
+                                               this->render_textures[output_pair].texture_view,
+                                               this->render_textures[output_pair + 1].texture_view
                                            }), NULL);
     
     this->device_context->lpVtbl->IASetPrimitiveTopology(this->device_context,
@@ -631,11 +1186,28 @@ static void state_draw(State *const this)
                                               this->vertex_shader, NULL, 0);
     
     this->device_context->lpVtbl->PSSetShader(this->device_context,
+                                              generated ?
+                                              this->generate_pixel_shader :
                                               this->pixel_shader, NULL, 0);
     
     this->device_context->lpVtbl->PSSetConstantBuffers(this->device_context, 0,
                                                        1, &this->constant_buffer);
-    
+
+    // warp from the newest traced frame, the older one fills what it did not see
+    if (generated)
+    {
+        int const older_pair = traced_pair ^ RENDER_TEXTURE_OLDER_PAIR;
+        
+        ID3D11DeviceContext_PSSetShaderResources(this->device_context, 0, 4,
+                                                 ((ID3D11ShaderResourceView*[])
+                                                 {
+                                                     this->render_textures[traced_pair].texture_shader_view,
+                                                     this->render_textures[traced_pair + 1].texture_shader_view,
+                                                     this->render_textures[older_pair].texture_shader_view,
+                                                     this->render_textures[older_pair + 1].texture_shader_view,
+                                                 }));
+    }
+    
     // draw the shaders
     this->device_context->lpVtbl->Draw(this->device_context, 4, 0);
 
@@ -643,23 +1215,64 @@ static void state_draw(State *const this)
     this->device_context->lpVtbl->OMSetRenderTargets(this->device_context, 2,
                                                      (ID3D11RenderTargetView*[2]){0},
                                                      NULL);
+
+    if (generated)
+    {
+        ID3D11DeviceContext_PSSetShaderResources(this->device_context, 0, 4,
+                                                 (ID3D11ShaderResourceView*[4]){0});
+    }
+
+    int post_pair = output_pair;
+    
+    // fill in the pixels the checkerboard skipped, the traced textures are
+    // left alone so they can serve as next frame's history
+    if (this->checkerboard.pattern != CHECKERBOARD_OFF)
+    {
+        post_pair = RENDER_TEXTURE_RECONSTRUCTED_PAIR;
+
+        ID3D11DeviceContext_OMSetRenderTargets(this->device_context, 2,
+                                               ((ID3D11RenderTargetView*[]) {
+                                                   this->render_textures[post_pair].texture_view,
+                                                   this->render_textures[post_pair + 1].texture_view
+                                               }), NULL);
+
+        this->device_context->lpVtbl->PSSetShader(this->device_context,
+                                                  this->reconstruct_pixel_shader, NULL, 0);
+
+        ID3D11DeviceContext_PSSetShaderResources(this->device_context, 0, 2,
+                                                 ((ID3D11ShaderResourceView*[])
+                                                 {
+                                                     this->render_textures[output_pair].texture_shader_view,
+                                                     this->render_textures[output_pair + 1].texture_shader_view,
+                                                 }));
+
+        this->device_context->lpVtbl->Draw(this->device_context, 4, 0);
+
+        this->device_context->lpVtbl->OMSetRenderTargets(this->device_context, 2,
+                                                         (ID3D11RenderTargetView*[2]){0},
+                                                         NULL);
+
+        ID3D11DeviceContext_PSSetShaderResources(this->device_context, 0, 2,
+                                                 (ID3D11ShaderResourceView*[2]){0});
+    }
     
-    // bind swapchain render target
+    // filter straight into the swapchain render target when the frame is
+    // traced at the window size, otherwise into post_texture
+    bool const upscale = this->post_texture.texture != NULL;
     this->device_context->lpVtbl->OMSetRenderTargets(this->device_context, 1,
+                                                     upscale ?
+                                                     &this->post_texture.texture_view :
                                                      &this->frame_buffer_view,
                                                      NULL);
    
     this->device_context->lpVtbl->PSSetShader(this->device_context,
                                               this->post_pixel_shader, NULL, 0);
 
-    this->device_context->lpVtbl->PSSetSamplers(this->device_context, 0, 1,
-                                                &this->render_texture_sampler);
-    
     ID3D11DeviceContext_PSSetShaderResources(this->device_context, 0, 2,
                                              ((ID3D11ShaderResourceView*[])
                                              {
-                                                 this->render_textures[0].texture_shader_view,
-                                                 this->render_textures[1].texture_shader_view,
+                                                 this->render_textures[post_pair].texture_shader_view,
+                                                 this->render_textures[post_pair + 1].texture_shader_view,
                                              }));
     
     // draw the shaders
@@ -667,158 +1280,458 @@ static void state_draw(State *const this)
 
     ID3D11DeviceContext_PSSetShaderResources(this->device_context, 0, 2,
                                              (ID3D11ShaderResourceView*[2]){0});
+
+    if (!upscale) return;
+
+    // stretch the filtered frame over the window with the linear sampler
+    this->device_context->lpVtbl->OMSetRenderTargets(this->device_context, 1,
+                                                     &this->frame_buffer_view,
+                                                     NULL);
+
+    state_set_viewport(this, this->width, this->height);
+
+    this->device_context->lpVtbl->PSSetShader(this->device_context,
+                                              this->upscale_pixel_shader, NULL, 0);
+
+    this->device_context->lpVtbl->PSSetSamplers(this->device_context, 0, 1,
+                                                &this->upscale_sampler);
+
+    ID3D11DeviceContext_PSSetShaderResources(this->device_context, 0, 1,
+                                             &this->post_texture.texture_shader_view);
+
+    this->device_context->lpVtbl->Draw(this->device_context, 4, 0);
+
+    ID3D11DeviceContext_PSSetShaderResources(this->device_context, 0, 1,
+                                             (ID3D11ShaderResourceView*[1]){0});
+}
+
+static void state_draw(State *const this)
+{
+    state_render(this);
     
     // swap the front/back buffer
-    this->swap_chain->lpVtbl->Present(this->swap_chain, 0, 0);
+    this->swap_chain->lpVtbl->Present(this->swap_chain,
+                                      frame_pacer_sync_interval(&this->frame_pacer), 0);
 }
 
-#ifdef SHADER_HOT_RELOAD
-static bool compare_file_times(FILETIME const a, FILETIME const b)
+// calibration renders at a fixed time so every level traces the same scene
+#define QUALITY_CALIBRATION_TIMER 1.5f
+#define QUALITY_CACHE_FILE_NAME L"\\direct3d_screensaver_quality.bin"
+
+static void state_apply_quality(State *const this, QualitySettings const settings)
+{
+    this->quality = settings;
+    if (!state_update_render_size(this)) return;
+
+    ID3D11DeviceContext_ClearState(this->device_context);
+    state_destroy_d3d_textures(this);
+    state_create_d3d_textures(this);
+}
+
+// the build is identified by its shaders
+static uint64_t state_build_id(State const *const this)
 {
-    return
-        a.dwLowDateTime == b.dwLowDateTime &&
-        a.dwHighDateTime == b.dwHighDateTime;
+#ifdef RELEASE_BUILD
+    (void)this;
+    uint64_t hash = shader_cache_hash(SHADER_CACHE_HASH_SEED, g_ps_main, sizeof g_ps_main);
+    hash = shader_cache_hash(hash, g_post_ps_main, sizeof g_post_ps_main);
+    hash = shader_cache_hash(hash, g_reconstruct_ps_main, sizeof g_reconstruct_ps_main);
+    hash = shader_cache_hash(hash, g_generate_ps_main, sizeof g_generate_ps_main);
+    return shader_cache_hash(hash, g_upscale_ps_main, sizeof g_upscale_ps_main);
+#else
+    return this->shader_source_hash;
+#endif
 }
 
-static void state_reload_shader(State *const this,
-                                WIN32_FILE_ATTRIBUTE_DATA *const old_file_attribute_data)
+// in the local app data directory, or the temp directory without one
+static bool quality_cache_path(wchar_t path[MAX_PATH])
 {
-    WIN32_FILE_ATTRIBUTE_DATA new_file_attribute_data;
-    GetFileAttributesExW(L"shaders.hlsl",
-                         GetFileExInfoStandard,
-                         &new_file_attribute_data);
-
-    // only reload the shader if the shader has been written to 
-    if (compare_file_times(new_file_attribute_data.ftLastWriteTime,
-                           old_file_attribute_data->ftLastWriteTime))
+    DWORD const space = MAX_PATH - ARRAY_COUNT(QUALITY_CACHE_FILE_NAME);
+    DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", path, space);
+    
+    if (length == 0 || length >= space)
     {
+        length = GetTempPathW(space, path);
+        if (length == 0 || length >= space) return false;
+
+        // the temp path already ends in a separator
+        --length;
+    }
+
+    wchar_t const name[] = QUALITY_CACHE_FILE_NAME;
+    for (size_t i = 0; i < ARRAY_COUNT(name); ++i)
+    {
+        path[length + i] = name[i];
+    }
+    
+    return true;
+}
+
+static bool read_quality_cache(uint64_t const key, int *const level)
+{
+    wchar_t path[MAX_PATH];
+    if (!quality_cache_path(path)) return false;
+    
+    HANDLE const handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    
+    if (handle == INVALID_HANDLE_VALUE) return false;
+
+    // one byte more than a record so a longer file is caught as well
+    unsigned char data[sizeof(QualityCacheRecord) + 1];
+    DWORD bytes_read = 0;
+    bool const success = ReadFile(handle, data, sizeof data, &bytes_read, NULL);
+    CloseHandle(handle);
+
+    return success && quality_cache_read(data, bytes_read, key, level);
+}
+
+static void write_quality_cache(uint64_t const key, int const level)
+{
+    wchar_t path[MAX_PATH];
+    if (!quality_cache_path(path)) return;
+    
+    HANDLE const handle = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                      FILE_ATTRIBUTE_NORMAL, NULL);
+    
+    if (handle == INVALID_HANDLE_VALUE) return;
+
+    // a partly written record has the wrong size and is measured again
+    QualityCacheRecord const record = quality_cache_record(key, level);
+    
+    DWORD bytes_written;
+    WriteFile(handle, &record, sizeof record, &bytes_written, NULL);
+    CloseHandle(handle);
+}
+
+// renders frames for the levels the tuner asks for without presenting them,
+// an event query tells when the gpu is done with a frame
+static int state_calibrate_quality(State *const this, int64_t const target_ticks)
+{
+    ID3D11Query *query;
+    if (FAILED(ID3D11Device_CreateQuery(this->device,
+                                        &(D3D11_QUERY_DESC) {.Query = D3D11_QUERY_EVENT},
+                                        &query)))
+    {
+        return 0;
+    }
+
+    QualityTuner tuner;
+    quality_tuner_init(&tuner, target_ticks, 1, 3);
+
+    while (!quality_tuner_done(&tuner))
+    {
+        // every frame measured is a traced one
+        state_apply_quality(this, quality_tuner_settings(&tuner));
+        this->generation_frame = 0;
+        state_update_constants(this, QUALITY_CALIBRATION_TIMER);
+
+        int64_t const start = runtime_clock_ticks();
+        
+        state_render(this);
+        ID3D11DeviceContext_End(this->device_context, (ID3D11Asynchronous *)query);
+
+        // GetData flushes the queued commands and returns S_FALSE until they finished
+        while (ID3D11DeviceContext_GetData(this->device_context, (ID3D11Asynchronous *)query,
+                                           NULL, 0, 0) == S_FALSE)
+        {
+            Sleep(0);
+        }
+
+        quality_tuner_frame(&tuner, runtime_clock_ticks() - start);
+    }
+
+    ID3D11Query_Release(query);
+    return tuner.level;
+}
+
+// uses the level cached for this gpu, build, window size and frame rate, or
+// measures one. the target is the frame interval of the pacer, 60 fps uncapped.
+// with frame generation too: a traced frame still has to be presented within one
+// interval, budgeting two would leave every traced frame late
+static void state_choose_quality(State *const this, int64_t const ticks_per_second)
+{
+    if (this->forced_quality_level >= 0)
+    {
+        int const level = this->forced_quality_level < QUALITY_LEVEL_COUNT ?
+                          this->forced_quality_level : QUALITY_LEVEL_COUNT - 1;
+        
+        state_apply_quality(this, quality_levels[level]);
         return;
     }
     
-    ID3D11PixelShader **pixel_shaders[] =
+    int64_t const frame_ticks = this->frame_pacer.frame_interval != 0 ?
+                                this->frame_pacer.frame_interval : ticks_per_second / 60;
+
+    uint64_t const key = quality_cache_key(&this->adapter_hash, sizeof this->adapter_hash,
+                                           state_build_id(this), this->width, this->height,
+                                           frame_ticks * 1000000 / ticks_per_second);
+
+    int level;
+    if (this->recalibrate_quality || !read_quality_cache(key, &level))
     {
-        &this->pixel_shader,
-        &this->post_pixel_shader
-    };
+        level = state_calibrate_quality(this, frame_ticks);
+        write_quality_cache(key, level);
+    }
+
+    state_apply_quality(this, quality_levels[level]);
+}
+
+#ifdef SHADER_HOT_RELOAD
+typedef struct PixelShaderSet
+{
+    ID3D11PixelShader *shaders[PIXEL_SHADER_COUNT];
+} PixelShaderSet;
+
+static void pixel_shader_set_destroy(PixelShaderSet *const set)
+{
+    for (int i = 0; i < PIXEL_SHADER_COUNT; ++i)
+    {
+        ID3D11PixelShader_Release(set->shaders[i]);
+    }
+
+    HeapFree(GetProcessHeap(), 0, set);
+}
+
+// called by the render thread between frames so a frame never mixes old and new shaders
+static void state_swap_pending_shaders(State *const this)
+{
+    PixelShaderSet *const set =
+        InterlockedExchangePointer((void *volatile *)&this->pending_pixel_shaders, NULL);
     
-    char const *pixel_shader_entrys[] = {
-        "ps_main", "post_ps_main",
-    };
+    if (set == NULL) return;
+
+    ID3D11PixelShader **slots[PIXEL_SHADER_COUNT];
+    state_get_pixel_shader_slots(this, slots);
+
+    for (int i = 0; i < PIXEL_SHADER_COUNT; ++i)
+    {
+        ID3D11PixelShader_Release(*slots[i]);
+        *slots[i] = set->shaders[i];
+    }
+
+    HeapFree(GetProcessHeap(), 0, set);
+}
+
+static void state_compile_reloaded_shaders(State *const this, FileData const *const source)
+{
+    PixelShaderSet *const set = HeapAlloc(GetProcessHeap(), 0, sizeof *set);
+    if (set == NULL) return;
+
+    // on a compile error the message box has been shown, keep the old shaders
+    if (!state_compile_pixel_shaders(this, source, set->shaders))
+    {
+        HeapFree(GetProcessHeap(), 0, set);
+        return;
+    }
+
+    // a set the render thread has not picked up yet is outdated now
+    PixelShaderSet *const old_set =
+        InterlockedExchangePointer((void *volatile *)&this->pending_pixel_shaders, set);
     
-    ID3DBlob *error_blob = NULL;
-    ID3DBlob *pixel_shader_blobs[2] = {0};
+    if (old_set != NULL)
+    {
+        pixel_shader_set_destroy(old_set);
+    }
+}
+
+// waits for change notifications on the working directory and recompiles the
+// pixel shaders off the render thread when the content of shaders.hlsl changed
+static DWORD __stdcall shader_reload_thread(void *const context)
+{
+    State *const state = context;
+
+    int64_t const frequency = runtime_clock_frequency();
 
-    for(size_t i = 0;;)
+    HANDLE const change_notification =
+        FindFirstChangeNotificationW(L".", FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE);
+    
+    if (change_notification == INVALID_HANDLE_VALUE) return 1;
+
+    // notifications are considered settled after 100 milliseconds of quiet
+    ShaderWatch watch;
+    shader_watch_init(&watch, state->shader_source_hash, frequency / 10);
+
+    for (;;)
     {
-        HRESULT result = D3DCompileFromFile(L"shaders.hlsl", NULL,
-                                            D3D_COMPILE_STANDARD_FILE_INCLUDE,
-                                            pixel_shader_entrys[i], "ps_5_0",
-                                            D3DCOMPILE_ENABLE_STRICTNESS |
-                                            D3DCOMPILE_OPTIMIZATION_LEVEL3, 0,
-                                            pixel_shader_blobs + i, &error_blob);
-        // if the file is in use try again
-        if ((result & 0x0000FFFF) == ERROR_SHARING_VIOLATION)
+        int64_t const timeout_ticks = shader_watch_timeout(&watch, runtime_clock_ticks());
+        DWORD const timeout = timeout_ticks < 0 ?
+                              INFINITE :
+                              (DWORD)(timeout_ticks * 1000 / frequency) + 1;
+
+        if (WaitForSingleObject(change_notification, timeout) == WAIT_OBJECT_0)
         {
+            shader_watch_notify(&watch, runtime_clock_ticks());
+            FindNextChangeNotification(change_notification);
             continue;
         }
-        
-        else if (FAILED(result))
+
+        int64_t const now = runtime_clock_ticks();
+        if (!shader_watch_should_read(&watch, now)) continue;
+
+        // the editor may still be holding the file, try again once it settles
+        FileData source;
+        if (!read_whole_file(SHADER_SOURCE_PATH, &source))
         {
-            MessageBoxA(this->window_handle,
-                        error_blob == NULL ?
-                        "" : error_blob->lpVtbl->GetBufferPointer(error_blob),
-                        "error:", MB_OK);
-            
-            error_blob->lpVtbl->Release(error_blob);
-        
-            goto leave;
+            shader_watch_read_failed(&watch, now);
+            continue;
         }
+
+        uint64_t const source_hash =
+            shader_cache_hash(SHADER_CACHE_HASH_SEED, source.data, source.size);
         
-        (*pixel_shaders[i])->lpVtbl->Release(*pixel_shaders[i]);
-        this->device->lpVtbl->CreatePixelShader(this->device,
-                                                pixel_shader_blobs[i]->lpVtbl->
-                                                GetBufferPointer(pixel_shader_blobs[i]),
-                                                pixel_shader_blobs[i]->lpVtbl->
-                                                GetBufferSize(pixel_shader_blobs[i]),
-                                                NULL, pixel_shaders[i]);
+        if (shader_watch_source_read(&watch, source_hash))
+        {
+            state_compile_reloaded_shaders(state, &source);
+        }
 
-        pixel_shader_blobs[i]->lpVtbl->Release(pixel_shader_blobs[i]);
+        free_file(&source);
+    }
+}
+#endif
 
+static void sleep_ticks(HANDLE const timer, int64_t const ticks,
+                        int64_t const ticks_per_second)
+{
+    // relative due times are negative and in 100 nanosecond units
+    LARGE_INTEGER const due_time = {
+        .QuadPart = -(ticks * 10000000 / ticks_per_second),
+    };
+    
+    SetWaitableTimer(timer, &due_time, 0, NULL, NULL, FALSE);
+    WaitForSingleObject(timer, INFINITE);
+}
 
-        if (++i >= ARRAY_COUNT(pixel_shaders)) break;
+static void state_pace_frame(State *const this, int64_t *const current_counter,
+                             int64_t const ticks_per_second)
+{
+    FramePacer *const pacer = &this->frame_pacer;
+    
+    if (frame_pacer_should_poll_power(pacer, *current_counter))
+    {
+        SYSTEM_POWER_STATUS power_status;
+        if (GetSystemPowerStatus(&power_status))
+        {
+            frame_pacer_set_power_source(pacer, power_status.ACLineStatus == 0 ?
+                                                POWER_SOURCE_BATTERY : POWER_SOURCE_AC);
+        }
     }
-leave:
-    old_file_attribute_data->ftLastWriteTime = new_file_attribute_data.ftLastWriteTime;
+
+    int64_t const wait_ticks = frame_pacer_wait_ticks(pacer, *current_counter);
+    if (wait_ticks > 0)
+    {
+        sleep_ticks(this->frame_timer, wait_ticks, ticks_per_second);
+        *current_counter = runtime_clock_ticks();
+    }
+    
+    frame_pacer_frame_started(pacer, *current_counter);
+}
+
+// shows the achieved frame rate and jitter in the title of a normal window.
+// SetWindowTextW waits for the window's thread, which is stuck waiting for
+// this one on shutdown, so the title is posted to the message pump instead
+static void state_report_pacing(State *const this, int64_t const ticks_per_second)
+{
+    FramePacingStats const stats = frame_pacer_stats(&this->frame_pacer);
+    if (this->mode != WINDOW_MODE || stats.mean_interval == 0) return;
+
+    // wsprintfW writes at most 1024 characters
+    wchar_t *const title = HeapAlloc(GetProcessHeap(), 0, 1024 * sizeof *title);
+    if (title != NULL)
+    {
+        wsprintfW(title, L"normal window - %d fps, jitter %d us (max %d us)",
+                  (int)(ticks_per_second / stats.mean_interval),
+                  (int)(stats.mean_jitter * 1000000 / ticks_per_second),
+                  (int)(stats.max_jitter * 1000000 / ticks_per_second));
+
+        if (!PostMessageW(this->window_handle, WM_APP_PACING_TITLE, 0, (LPARAM)title))
+        {
+            HeapFree(GetProcessHeap(), 0, title);
+        }
+    }
+
+    frame_pacer_reset_stats(&this->frame_pacer);
 }
-#endif
 
 static DWORD __stdcall render_thread(void *const context)
 {
     State *const state = context;
 
-    LARGE_INTEGER performance_frequency;
-    QueryPerformanceFrequency(&performance_frequency);
+    int64_t const performance_frequency = runtime_clock_frequency();
+    int64_t const start_counter = runtime_clock_ticks();
 
-    LARGE_INTEGER start_counter;
-    QueryPerformanceCounter(&start_counter);
+    state->frame_timer = CreateWaitableTimerExW(NULL, NULL,
+                                                CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                                TIMER_ALL_ACCESS);
+
+    // high resolution timers need windows 10 1803
+    if (state->frame_timer == NULL)
+    {
+        state->frame_timer = CreateWaitableTimerW(NULL, FALSE, NULL);
+    }
+
+    frame_pacer_init(&state->frame_pacer, state->frame_pacer.settings,
+                     performance_frequency, state->mode == PREVIEW_MODE,
+                     start_counter);
+
+    state_choose_quality(state, performance_frequency);
+
+    int64_t next_report = start_counter + performance_frequency;
+
+    uint32_t window_sequence = 0;
+    WindowSnapshot window = {
+        .width = state->width,
+        .height = state->height,
+        .visible = true,
+    };
 
-#ifdef SHADER_HOT_RELOAD
-    WIN32_FILE_ATTRIBUTE_DATA old_file_attribute_data;
-    GetFileAttributesExW(L"shaders.hlsl",
-                         GetFileExInfoStandard,
-                         &old_file_attribute_data);
-#endif
     
     for(;;)
     {
-        LARGE_INTEGER current_counter;
-        QueryPerformanceCounter(&current_counter);
-        
-        int64_t const counter_duration =
-            current_counter.QuadPart - start_counter.QuadPart; 
-        
-        float const current_time =
-            (float)((double)counter_duration / (double)performance_frequency.QuadPart);
+        int64_t current_counter = runtime_clock_ticks();
+        state_pace_frame(state, &current_counter, performance_frequency);
 
-        
-        // update shader constants
+        if (current_counter >= next_report)
         {
-            
-            D3D11_MAPPED_SUBRESOURCE mapped_subresource;
-            state->device_context->lpVtbl->Map(state->device_context,
-                                               (ID3D11Resource *)state->constant_buffer, 0,
-                                               D3D11_MAP_WRITE_DISCARD, 0, &mapped_subresource);
-            
-            ShaderConstants *const shader_constants = mapped_subresource.pData;
-            
-            shader_constants->aspect_ratio = (float)state->height / (float)state->width;
-            shader_constants->timer = current_time;
-            shader_constants->pixel_width = 1.0f / (float)state->height;
-            
-            state->device_context->lpVtbl->Unmap(state->device_context,
-                                                 (ID3D11Resource *)
-                                                 state->constant_buffer, 0);
+            state_report_pacing(state, performance_frequency);
+            next_report = current_counter + performance_frequency;
         }
-
         
-        while(WaitForSingleObject(state->frame_latency_waitable_object, 0) == WAIT_TIMEOUT)
+        float const current_time =
+            (float)runtime_clock_seconds(current_counter - start_counter, performance_frequency);
+
+        // resize first so the constants and history state match the textures
+        if (window_state_poll(&window_state, &window_sequence, &window))
         {
+            if (window.quit_requested) return 0;
+            
+            state_handle_resize(state, window.width, window.height);
         }
 
+        // nothing to draw into while minimized
+        if (!window.visible)
         {
-            RECT rect;
-            GetClientRect(state->window_handle, &rect);
-
-            state_handle_resize(state,
-                                rect.right - rect.left,
-                                rect.bottom - rect.top);
+            sleep_ticks(state->frame_timer, performance_frequency / 10,
+                        performance_frequency);
+            continue;
         }
         
-        state_draw(state);
+        state_update_constants(state, current_time);
+
         
+        // block instead of spinning until the swap chain can take another frame
+        WaitForSingleObjectEx(state->frame_latency_waitable_object, 1000, TRUE);
+
 #ifdef SHADER_HOT_RELOAD
-        state_reload_shader(state, &old_file_attribute_data);
+        state_swap_pending_shaders(state);
 #endif
+
+        state_draw(state);
+
+        ++state->frame_index;
+        ++state->generation_frame;
+        state->history_valid = true;
+        
     }
 }
 
@@ -897,6 +1810,24 @@ void entry(void)
     bool have_fps_overlay = false;
 #endif
     
+    FramePacingSettings frame_pacing = {
+        .target_fps = 60,
+        .preview_fps = 15,
+        .battery_fps = 10,
+        .vsync = true,
+    };
+    
+    CheckerboardSettings checkerboard = {
+        .pattern = CHECKERBOARD_OFF,
+        .filter = RECONSTRUCT_TEMPORAL_CLAMP,
+        .fallback = FALLBACK_FULL_FRAME,
+    };
+    
+    int quality_level = -1;
+    bool recalibrate_quality = false;
+    bool frame_generation = false;
+    bool level_of_detail = false;
+    
     uint32_t argument_param = 0;
     ModeType mode = NOTHING_MODE;
     for (int i = 1; i < argc; ++i)
@@ -955,6 +1886,92 @@ void entry(void)
                 break;
             }
 
+            // -l<fps> caps the frame rate, 0 leaves it uncapped
+            case L'l':
+            case L'L':
+            {
+                if (argument[1] >= L'0' && argument[1] <= L'9')
+                {
+                    frame_pacing.target_fps = parse_u32(argument + 1);
+                }
+                
+                break;
+            }
+
+            case L'v':
+            case L'V':
+            {
+                if ((argument[1] == L'0' || argument[1] == L'1') &&
+                    argument[2] == L'\0')
+                {
+                    frame_pacing.vsync = argument[1] - L'0' != 0;
+                }
+                
+                break;
+            }
+
+            // -k<pattern>[<filter>[<fallback>]], each a single digit
+            case L'k':
+            case L'K':
+            {
+                if (argument[1] >= L'0' && argument[1] <= L'2')
+                {
+                    checkerboard.pattern = argument[1] - L'0';
+                    
+                    if (argument[2] == L'0' || argument[2] == L'1')
+                    {
+                        checkerboard.filter = argument[2] - L'0';
+                        
+                        if (argument[3] == L'0' || argument[3] == L'1')
+                        {
+                            checkerboard.fallback = argument[3] - L'0';
+                        }
+                    }
+                }
+                
+                break;
+            }
+
+            // -q measures the quality level again, -q<level> skips the tuner
+            case L'q':
+            case L'Q':
+            {
+                if (argument[1] >= L'0' && argument[1] <= L'9')
+                {
+                    quality_level = (int)parse_u32(argument + 1);
+                }
+                else if (argument[1] == L'\0')
+                {
+                    recalibrate_quality = true;
+                }
+                
+                break;
+            }
+
+            // -g traces every other frame and generates the ones in between
+            case L'g':
+            case L'G':
+            {
+                if (argument[1] == L'\0')
+                {
+                    frame_generation = true;
+                }
+                
+                break;
+            }
+
+            // -d marches with the level of detail
+            case L'd':
+            case L'D':
+            {
+                if (argument[1] == L'\0')
+                {
+                    level_of_detail = true;
+                }
+                
+                break;
+            }
+
 #ifndef NO_FPS_OVERLAY
             case 'f':
             case 'F':
@@ -998,8 +2015,33 @@ void entry(void)
  
     }
 
-    State state = {0}; 
+    State state = {
+        .checkerboard = checkerboard,
+        .frame_pacer.settings = frame_pacing,
+        .quality = quality_levels[0],
+        .forced_quality_level = quality_level,
+        .recalibrate_quality = recalibrate_quality,
+        .frame_generation = frame_generation,
+        .level_of_detail = level_of_detail,
+    };
+
+    // the checkerboard reconstructs from the previous displayed frame, which
+    // would be a generated one
+    if (frame_generation)
+    {
+        state.checkerboard.pattern = CHECKERBOARD_OFF;
+    }
+    
     state_create_window(&state, 900, 600, mode, argument_param);
+
+    // sizes from WM_SIZE are published from here on
+    window_state_window = state.window_handle;
+    window_state_publish(&window_state, &(WindowSnapshot) {
+                             .width = state.width,
+                             .height = state.height,
+                             .visible = true,
+                         });
+    
     state_setup_d3d(&state, mode != FULLSCREEN_MODE);
 
 #ifndef NO_FPS_OVERLAY
@@ -1010,25 +2052,23 @@ void entry(void)
 #endif
         
     // create a separate render thread so the rendering is not blocked by the Message Pump
-    CreateThread(NULL, 0, &render_thread, &state, 0, NULL);
+    HANDLE const render_thread_handle = CreateThread(NULL, 0, &render_thread, &state, 0, NULL);
+
+#ifdef SHADER_HOT_RELOAD
+    CreateThread(NULL, 0, &shader_reload_thread, &state, 0, NULL);
+#endif
     
-    // start the message pump
-    for (;;)
+    // start the message pump, GetMessageW sleeps until there is a message
+    MSG message;
+    while (GetMessageW(&message, NULL, 0, 0) > 0)
     {
-        MSG message;
-        if (PeekMessageW(&message, NULL, 0, 0, PM_REMOVE))
-        {
-            TranslateMessage(&message);
-            DispatchMessageW(&message);
-            
-            if (message.message == WM_QUIT)
-            {
-                break;
-            }
-            
-            continue;
-        }
+        TranslateMessage(&message);
+        DispatchMessageW(&message);
     }
+
+    // let the render thread finish its frame instead of exiting under it
+    window_state_request_quit(&window_state);
+    WaitForSingleObject(render_thread_handle, 1000);
     
     ExitProcess(0);
 }
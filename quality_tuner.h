@@ -0,0 +1,219 @@
+#ifndef QUALITY_TUNER_H
+#define QUALITY_TUNER_H
+
+// picks the quality level for the machine at startup. the levels run from
+// the best to the cheapest, each one cheaper to render than the one before,
+// so the best level that renders within the target frame time is found by a
+// binary search that measures a handful of levels. the caller renders the
+// frames at whatever level quality_tuner_settings returns and reports how
+// long each took, the clock is the caller's as in frame_pacing.h. the chosen
+// level is kept in a small cache record keyed by hardware and build so later
+// launches skip the measurements, reading and writing the file is left to
+// the caller. uses no crt functions so it can be built into the screensaver
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shader_cache.h"
+
+// bump when the levels or the way they are measured change to drop old records
+#define QUALITY_CACHE_VERSION 1
+#define QUALITY_CACHE_MAGIC 0x4e555451 // "QTUN"
+
+#define QUALITY_TUNER_MAX_FRAMES 16
+
+typedef struct
+{
+    uint32_t total_samples;
+    uint32_t max_bounces;
+    uint32_t max_steps;
+    uint32_t resolution_percent;   // of the window size in each direction
+} QualitySettings;
+
+// the first level is what every machine rendered before the tuner
+static QualitySettings const quality_levels[] = {
+    {3, 4, 100, 100},
+    {2, 4, 100, 100},
+    {2, 3, 100, 100},
+    {1, 3, 100, 100},
+    {1, 2, 80, 100},
+    {1, 2, 80, 75},
+    {1, 2, 64, 50},
+    {1, 1, 64, 50},
+};
+
+#define QUALITY_LEVEL_COUNT ((int)(sizeof quality_levels / sizeof *quality_levels))
+
+typedef struct
+{
+    int64_t target_ticks;       // frame time a level has to stay within
+    uint32_t warmup_frames;     // rendered at a new level before measuring
+    uint32_t measured_frames;
+
+    // the answer is in [low, high], high is known to fit unless it is the last level
+    int low;
+    int high;
+    int level;                  // being measured, the answer once done
+    bool done;
+
+    uint32_t frame;
+    int64_t samples[QUALITY_TUNER_MAX_FRAMES];
+    int64_t level_ticks[QUALITY_LEVEL_COUNT];   // median frame time, 0 if not measured
+    uint32_t measured_levels;
+} QualityTuner;
+
+static void quality_tuner_init(QualityTuner *const this, int64_t const target_ticks,
+                               uint32_t const warmup_frames, uint32_t measured_frames)
+{
+    if (measured_frames == 0) measured_frames = 1;
+    if (measured_frames > QUALITY_TUNER_MAX_FRAMES) measured_frames = QUALITY_TUNER_MAX_FRAMES;
+
+    this->target_ticks = target_ticks;
+    this->warmup_frames = warmup_frames;
+    this->measured_frames = measured_frames;
+    this->low = 0;
+    this->high = QUALITY_LEVEL_COUNT - 1;
+    this->level = (this->low + this->high) / 2;
+    this->done = false;
+    this->frame = 0;
+    this->measured_levels = 0;
+
+    for (int i = 0; i < QUALITY_LEVEL_COUNT; ++i)
+    {
+        this->level_ticks[i] = 0;
+    }
+}
+
+// the level to render the next frame at, or the chosen one once done
+static QualitySettings quality_tuner_settings(QualityTuner const *const this)
+{
+    return quality_levels[this->level];
+}
+
+static bool quality_tuner_done(QualityTuner const *const this)
+{
+    return this->done;
+}
+
+// the median is robust against a frame that was preempted or hit a page fault
+static int64_t quality_tuner_median(int64_t *const samples, uint32_t const count)
+{
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        int64_t const value = samples[i];
+        uint32_t j = i;
+        for (; j > 0 && samples[j - 1] > value; --j)
+        {
+            samples[j] = samples[j - 1];
+        }
+        samples[j] = value;
+    }
+
+    return samples[count / 2];
+}
+
+// report the frame time of a frame rendered at quality_tuner_settings
+static void quality_tuner_frame(QualityTuner *const this, int64_t const frame_ticks)
+{
+    if (this->done) return;
+
+    uint32_t const frame = this->frame++;
+    if (frame < this->warmup_frames) return;
+
+    this->samples[frame - this->warmup_frames] = frame_ticks;
+    if (this->frame < this->warmup_frames + this->measured_frames) return;
+
+    int64_t const ticks = quality_tuner_median(this->samples, this->measured_frames);
+    this->level_ticks[this->level] = ticks;
+    ++this->measured_levels;
+
+    if (ticks <= this->target_ticks)
+    {
+        this->high = this->level;
+    }
+    else
+    {
+        this->low = this->level + 1;
+    }
+
+    this->frame = 0;
+
+    // the last level is used even when it is too slow, there is nothing cheaper
+    if (this->low >= this->high)
+    {
+        this->level = this->high;
+        this->done = true;
+        return;
+    }
+
+    this->level = (this->low + this->high) / 2;
+}
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t level;
+    QualitySettings settings;
+} QualityCacheRecord;
+
+// hardware_id and build_id are whatever identifies them to the caller, the
+// output size and target are part of the key since the answer depends on them
+static uint64_t quality_cache_key(void const *const hardware_id, size_t const hardware_id_size,
+                                  uint64_t const build_id, int32_t const width,
+                                  int32_t const height, int64_t const target_microseconds)
+{
+    uint64_t hash = shader_cache_hash(SHADER_CACHE_HASH_SEED, hardware_id, hardware_id_size);
+    hash = shader_cache_hash(hash, &build_id, sizeof build_id);
+    hash = shader_cache_hash(hash, &width, sizeof width);
+    hash = shader_cache_hash(hash, &height, sizeof height);
+    return shader_cache_hash(hash, &target_microseconds, sizeof target_microseconds);
+}
+
+static QualityCacheRecord quality_cache_record(uint64_t const key, int const level)
+{
+    return (QualityCacheRecord) {
+        .magic = QUALITY_CACHE_MAGIC,
+        .version = QUALITY_CACHE_VERSION,
+        .key = key,
+        .level = (uint32_t)level,
+        .settings = quality_levels[level],
+    };
+}
+
+// false unless the bytes are a record for key written with the current levels
+static bool quality_cache_read(void const *const data, size_t const size, uint64_t const key,
+                               int *const level)
+{
+    if (size != sizeof(QualityCacheRecord)) return false;
+
+    QualityCacheRecord const *const record = data;
+    if (record->magic != QUALITY_CACHE_MAGIC || record->version != QUALITY_CACHE_VERSION ||
+        record->key != key || record->level >= (uint32_t)QUALITY_LEVEL_COUNT)
+    {
+        return false;
+    }
+
+    QualitySettings const *const settings = quality_levels + record->level;
+    if (record->settings.total_samples != settings->total_samples ||
+        record->settings.max_bounces != settings->max_bounces ||
+        record->settings.max_steps != settings->max_steps ||
+        record->settings.resolution_percent != settings->resolution_percent)
+    {
+        return false;
+    }
+
+    *level = (int)record->level;
+    return true;
+}
+
+// the size a level renders at for a window, at least one pixel
+static int32_t quality_scaled_size(int32_t const size, QualitySettings const *const settings)
+{
+    int32_t const scaled = (int32_t)((int64_t)size * settings->resolution_percent / 100);
+    return scaled > 0 ? scaled : 1;
+}
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+// the small runtime the screensaver links instead of the crt: memset and
+// memcpy that write 16 bytes at a time with sse2 (a machine word elsewhere),
+// a linear arena for data that only lives for a frame and a monotonic clock
+// over QueryPerformanceCounter or clock_gettime. uses no crt functions so it
+// can be built into the screensaver, the cpu port checks and benchmarks it
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RUNTIME_SSE2
+#include <emmintrin.h>
+#endif
+
+// the loops below look like memset and memcpy to the optimizer, which would
+// turn them back into calls to the functions they implement
+#if defined(__clang__)
+#define RUNTIME_NO_BUILTIN __attribute__((no_builtin("memset", "memcpy")))
+#elif defined(__GNUC__)
+#define RUNTIME_NO_BUILTIN __attribute__((optimize("no-tree-loop-distribute-patterns")))
+#else
+#define RUNTIME_NO_BUILTIN
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+typedef uintptr_t __attribute__((may_alias)) RuntimeWord;
+#else
+typedef uintptr_t RuntimeWord;
+#endif
+
+RUNTIME_NO_BUILTIN
+static void *runtime_memset(void *const dest, int const value, size_t count)
+{
+    unsigned char *bytes = dest;
+    unsigned char const byte = (unsigned char)value;
+
+#ifdef RUNTIME_SSE2
+    if (count >= 16)
+    {
+        // unaligned blocks at both ends, aligned blocks in between overlap them
+        __m128i const block = _mm_set1_epi8((char)byte);
+        unsigned char *const end = bytes + count;
+
+        _mm_storeu_si128((__m128i *)bytes, block);
+        _mm_storeu_si128((__m128i *)(end - 16), block);
+
+        bytes = (unsigned char *)(((uintptr_t)bytes + 16) & ~(uintptr_t)15);
+        for (; end - bytes >= 64; bytes += 64)
+        {
+            _mm_store_si128((__m128i *)bytes + 0, block);
+            _mm_store_si128((__m128i *)bytes + 1, block);
+            _mm_store_si128((__m128i *)bytes + 2, block);
+            _mm_store_si128((__m128i *)bytes + 3, block);
+        }
+
+        for (; end - bytes >= 16; bytes += 16)
+        {
+            _mm_store_si128((__m128i *)bytes, block);
+        }
+
+        return dest;
+    }
+#else
+    if (count >= sizeof(RuntimeWord))
+    {
+        // bytes up to the first aligned word, then whole words
+        while ((uintptr_t)bytes % sizeof(RuntimeWord) != 0)
+        {
+            *bytes++ = byte;
+            --count;
+        }
+
+        RuntimeWord const word = (RuntimeWord)-1 / 0xff * byte;
+        for (; count >= sizeof word; count -= sizeof word, bytes += sizeof word)
+        {
+            *(RuntimeWord *)bytes = word;
+        }
+    }
+#endif
+
+    while (count-- != 0)
+    {
+        *bytes++ = byte;
+    }
+
+    return dest;
+}
+
+RUNTIME_NO_BUILTIN
+static void *runtime_memcpy(void *const dest, void const *const source, size_t count)
+{
+    unsigned char *to = dest;
+    unsigned char const *from = source;
+
+#ifdef RUNTIME_SSE2
+    if (count >= 16)
+    {
+        // like memset, the loads are unaligned unless source and dest share an alignment
+        unsigned char *const end = to + count;
+
+        _mm_storeu_si128((__m128i *)to, _mm_loadu_si128((__m128i const *)from));
+        _mm_storeu_si128((__m128i *)(end - 16),
+                         _mm_loadu_si128((__m128i const *)(from + count - 16)));
+
+        size_t const head = 16 - (uintptr_t)to % 16;
+        to += head;
+        from += head;
+
+        for (; end - to >= 64; to += 64, from += 64)
+        {
+            __m128i const a = _mm_loadu_si128((__m128i const *)from + 0);
+            __m128i const b = _mm_loadu_si128((__m128i const *)from + 1);
+            __m128i const c = _mm_loadu_si128((__m128i const *)from + 2);
+            __m128i const d = _mm_loadu_si128((__m128i const *)from + 3);
+            _mm_store_si128((__m128i *)to + 0, a);
+            _mm_store_si128((__m128i *)to + 1, b);
+            _mm_store_si128((__m128i *)to + 2, c);
+            _mm_store_si128((__m128i *)to + 3, d);
+        }
+
+        for (; end - to >= 16; to += 16, from += 16)
+        {
+            _mm_store_si128((__m128i *)to, _mm_loadu_si128((__m128i const *)from));
+        }
+
+        return dest;
+    }
+#else
+    // words only when source and dest share an alignment, the rest bytewise
+    if (count >= sizeof(RuntimeWord) &&
+        (uintptr_t)to % sizeof(RuntimeWord) == (uintptr_t)from % sizeof(RuntimeWord))
+    {
+        while ((uintptr_t)to % sizeof(RuntimeWord) != 0)
+        {
+            *to++ = *from++;
+            --count;
+        }
+
+        for (; count >= sizeof(RuntimeWord); count -= sizeof(RuntimeWord))
+        {
+            *(RuntimeWord *)to = *(RuntimeWord const *)from;
+            to += sizeof(RuntimeWord);
+            from += sizeof(RuntimeWord);
+        }
+    }
+#endif
+
+    while (count-- != 0)
+    {
+        *to++ = *from++;
+    }
+
+    return dest;
+}
+
+// a linear allocator over memory owned by the caller. allocations are freed
+// all at once by runtime_arena_reset at the end of a frame, or back to a
+// mark taken earlier for data that only lives for part of a frame
+typedef struct
+{
+    unsigned char *base;
+    size_t capacity;
+    size_t used;
+    size_t peak;    // most bytes in use at once since init
+} RuntimeArena;
+
+static void runtime_arena_init(RuntimeArena *const this, void *const memory, size_t const capacity)
+{
+    this->base = memory;
+    this->capacity = capacity;
+    this->used = 0;
+    this->peak = 0;
+}
+
+// alignment must be a power of two, returns NULL and leaves the arena as it
+// was when the allocation does not fit
+static void *runtime_arena_push(RuntimeArena *const this, size_t const size, size_t const alignment)
+{
+    uintptr_t const address = (uintptr_t)this->base + this->used;
+    size_t const padding = (size_t)(-address & (alignment - 1));
+
+    if (padding > this->capacity - this->used ||
+        size > this->capacity - this->used - padding)
+    {
+        return NULL;
+    }
+
+    void *const result = this->base + this->used + padding;
+    this->used += padding + size;
+    this->peak = this->used > this->peak ? this->used : this->peak;
+    return result;
+}
+
+static void *runtime_arena_push_zero(RuntimeArena *const this, size_t const size,
+                                     size_t const alignment)
+{
+    void *const result = runtime_arena_push(this, size, alignment);
+    return result != NULL ? runtime_memset(result, 0, size) : NULL;
+}
+
+#define RUNTIME_ARENA_PUSH_ARRAY(arena, type, count) \
+    ((type *)runtime_arena_push((arena), sizeof(type) * (count), _Alignof(type)))
+
+static size_t runtime_arena_mark(RuntimeArena const *const this)
+{
+    return this->used;
+}
+
+static void runtime_arena_rewind(RuntimeArena *const this, size_t const mark)
+{
+    if (mark <= this->used) this->used = mark;
+}
+
+static void runtime_arena_reset(RuntimeArena *const this)
+{
+    this->used = 0;
+}
+
+// ticks of a monotonic clock, the frequency does not change while running
+static int64_t runtime_clock_frequency(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return frequency.QuadPart;
+#else
+    return 1000000000;
+#endif
+}
+
+static int64_t runtime_clock_ticks(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+}
+
+static double runtime_clock_seconds(int64_t const ticks, int64_t const frequency)
+{
+    return (double)ticks / (double)frequency;
+}
+
+// the clock in seconds, for timing code that doesn't keep the frequency around
+static double runtime_clock_now(void)
+{
+    return runtime_clock_seconds(runtime_clock_ticks(), runtime_clock_frequency());
+}
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+// platform independent part of shader hot reload: content hashes, the
+// on-disk cache format for compiled blobs and the logic that turns file
+// change notifications into recompiles. file access, notifications and the
+// compiler itself are left to the caller, main.c uses win32 and d3dcompiler.
+// uses no crt functions so it can be built into the screensaver
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// bump when the layout or the compiler settings change to drop old entries
+#define SHADER_CACHE_VERSION 1
+#define SHADER_CACHE_MAGIC 0x43444853 // "SHDC"
+
+// 16 hex digits, ".cso" and the terminator
+#define SHADER_CACHE_NAME_LENGTH 21
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t blob_size;
+} ShaderCacheHeader;
+
+// fnv-1a, chain calls to hash several pieces
+static uint64_t shader_cache_hash(uint64_t hash, void const *const data, size_t const size)
+{
+    uint8_t const *const bytes = data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+#define SHADER_CACHE_HASH_SEED 0xcbf29ce484222325ULL
+
+static size_t shader_cache_string_length(char const *const string)
+{
+    size_t length = 0;
+    while (string[length] != '\0') ++length;
+    return length;
+}
+
+// everything that changes the compiled blob goes into its key
+static uint64_t shader_cache_key(void const *const source, size_t const source_size,
+                                 char const *const entry_point, char const *const target,
+                                 uint32_t const flags)
+{
+    uint32_t const version = SHADER_CACHE_VERSION;
+
+    uint64_t hash = SHADER_CACHE_HASH_SEED;
+    hash = shader_cache_hash(hash, &version, sizeof version);
+    hash = shader_cache_hash(hash, source, source_size);
+
+    // include the terminators so "ab" + "c" and "a" + "bc" differ
+    hash = shader_cache_hash(hash, entry_point, shader_cache_string_length(entry_point) + 1);
+    hash = shader_cache_hash(hash, target, shader_cache_string_length(target) + 1);
+    hash = shader_cache_hash(hash, &flags, sizeof flags);
+    return hash;
+}
+
+static void shader_cache_file_name(uint64_t const key, char name[SHADER_CACHE_NAME_LENGTH])
+{
+    static char const digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < 16; ++i)
+    {
+        name[i] = digits[(key >> (60 - i * 4)) & 0xf];
+    }
+
+    name[16] = '.';
+    name[17] = 'c';
+    name[18] = 's';
+    name[19] = 'o';
+    name[20] = '\0';
+}
+
+static void shader_cache_make_header(uint64_t const key, size_t const blob_size,
+                                     ShaderCacheHeader *const header)
+{
+    header->magic = SHADER_CACHE_MAGIC;
+    header->version = SHADER_CACHE_VERSION;
+    header->key = key;
+    header->blob_size = blob_size;
+}
+
+// checks a cache file read from disk, rejecting truncated, foreign or stale files
+static bool shader_cache_validate(void const *const file_data, size_t const file_size,
+                                  uint64_t const key,
+                                  void const **const blob, size_t *const blob_size)
+{
+    if (file_size < sizeof(ShaderCacheHeader)) return false;
+
+    ShaderCacheHeader const *const header = file_data;
+    if (header->magic != SHADER_CACHE_MAGIC ||
+        header->version != SHADER_CACHE_VERSION ||
+        header->key != key ||
+        header->blob_size != file_size - sizeof(ShaderCacheHeader))
+    {
+        return false;
+    }
+
+    *blob = header + 1;
+    *blob_size = (size_t)header->blob_size;
+    return true;
+}
+
+typedef enum
+{
+    SHADER_CACHE_FAILED,   // the compiler rejected the source
+    SHADER_CACHE_HIT,
+    SHADER_CACHE_COMPILED,
+} ShaderCacheResult;
+
+// file access and the compiler for shader_cache_compile. buffers handed out by
+// read and compile belong to the caller and must outlive the returned blob
+typedef struct
+{
+    void *context;
+
+    // reads the cache file of key, false when there is none or it can't be read
+    bool (*read)(void *context, uint64_t key, void const **file_data, size_t *file_size);
+
+    // false on compiler errors, which the callback reports itself
+    bool (*compile)(void *context, void const *source, size_t source_size,
+                    char const *entry_point, char const *target, uint32_t flags,
+                    void const **blob, size_t *blob_size);
+
+    // stores header followed by the blob as the cache file of key, failures are ignored
+    void (*write)(void *context, uint64_t key, ShaderCacheHeader const *header,
+                  void const *blob, size_t blob_size);
+} ShaderCacheIo;
+
+// takes an entry point of source from the cache, or compiles it and stores the
+// result. a cache file that fails shader_cache_validate is simply overwritten
+static ShaderCacheResult shader_cache_compile(ShaderCacheIo const *const io,
+                                              void const *const source, size_t const source_size,
+                                              char const *const entry_point,
+                                              char const *const target, uint32_t const flags,
+                                              void const **const blob, size_t *const blob_size)
+{
+    uint64_t const key = shader_cache_key(source, source_size, entry_point, target, flags);
+
+    void const *file_data;
+    size_t file_size;
+    if (io->read(io->context, key, &file_data, &file_size) &&
+        shader_cache_validate(file_data, file_size, key, blob, blob_size))
+    {
+        return SHADER_CACHE_HIT;
+    }
+
+    if (!io->compile(io->context, source, source_size, entry_point, target, flags,
+                     blob, blob_size))
+    {
+        return SHADER_CACHE_FAILED;
+    }
+
+    ShaderCacheHeader header;
+    shader_cache_make_header(key, *blob_size, &header);
+    io->write(io->context, key, &header, *blob, *blob_size);
+    return SHADER_CACHE_COMPILED;
+}
+
+// turns bursts of change notifications into single source reads: editors
+// often write a file in several steps or keep it locked for a moment, so
+// the source is read once notifications have been quiet for settle_ticks and
+// only recompiled when its content actually changed
+typedef struct
+{
+    uint64_t source_hash;   // hash of the source last handed to the compiler
+    int64_t settle_ticks;
+    int64_t read_at;        // when to read the source, -1 when nothing is pending
+} ShaderWatch;
+
+static void shader_watch_init(ShaderWatch *const this, uint64_t const source_hash,
+                              int64_t const settle_ticks)
+{
+    this->source_hash = source_hash;
+    this->settle_ticks = settle_ticks;
+    this->read_at = -1;
+}
+
+static void shader_watch_notify(ShaderWatch *const this, int64_t const now)
+{
+    this->read_at = now + this->settle_ticks;
+}
+
+// how long the watcher may block waiting for the next notification, -1 for ever
+static int64_t shader_watch_timeout(ShaderWatch const *const this, int64_t const now)
+{
+    if (this->read_at < 0) return -1;
+    return this->read_at > now ? this->read_at - now : 0;
+}
+
+static bool shader_watch_should_read(ShaderWatch const *const this, int64_t const now)
+{
+    return this->read_at >= 0 && now >= this->read_at;
+}
+
+// the file could not be read, most likely because it is still locked, try again later
+static void shader_watch_read_failed(ShaderWatch *const this, int64_t const now)
+{
+    this->read_at = now + this->settle_ticks;
+}
+
+// call with the hash of the source that was read, true when it needs compiling
+static bool shader_watch_source_read(ShaderWatch *const this, uint64_t const source_hash)
+{
+    this->read_at = -1;
+    if (source_hash == this->source_hash) return false;
+
+    this->source_hash = source_hash;
+    return true;
+}
+
+#endif
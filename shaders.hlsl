@@ -3,6 +3,41 @@ cbuffer constants : register (b0)
     float aspect_ratio;
     float timer;
     float pixel_width;
+    uint frame_index;
+    uint checkerboard_pattern;
+    uint checkerboard_filter;
+    uint history_valid;
+
+    // picked at startup by the quality tuner
+    uint total_samples;
+    uint max_bounces;
+    uint max_steps;
+
+    // for generate_ps_main, the timers the two traced frames were traced at
+    float source_timer;
+    float older_timer;
+    uint older_valid;
+
+    // hit epsilon per unit a primary ray marches, 0 keeps full detail
+    float lod_cone;
+}
+
+static const uint CHECKERBOARD_OFF = 0;
+static const uint CHECKERBOARD_CHECKER = 1;
+static const uint CHECKERBOARD_ROWS = 2;
+
+static const uint RECONSTRUCT_SPATIAL = 0;
+static const uint RECONSTRUCT_TEMPORAL_CLAMP = 1;
+
+// which pixels ps_main traces this frame, the others keep last frame's value
+bool checkerboard_is_traced(uint2 pixel)
+{
+    switch (checkerboard_pattern)
+    {
+        case CHECKERBOARD_CHECKER: return ((pixel.x + pixel.y + frame_index) & 1) == 0;
+        case CHECKERBOARD_ROWS: return ((pixel.y + frame_index) & 1) == 0;
+        default: return true;
+    }
 }
 
 struct vs_out
@@ -53,10 +88,18 @@ float hash12(inout float2 uv)
     return float(n & 0x7fffffffU)/float(0x7fffffff);
 }
 
-static const int MAX_STEPS = 100;
 static const float MIN_DISTANCE = 0.001f;
 static const float MAX_DISTANCE = 8.0f;
 
+// level of detail, see cpu/scene.h
+static const float LOD_BOUNCE_SCALE = 4.0f;
+static const float LOD_MAX_EPSILON = 0.02f;
+static const float LOD_BOUND_MARGIN = 0.5f;
+static const float LOD_CELL_MARGIN = 0.05f;
+static const float PYLON_BEVEL = 0.005f;
+static const float PYLON_MAX_HEIGHT = 1.0f;
+static const float LOGO_RADIUS = 1.21f;
+
 struct Ray
 {
     float3 pos;
@@ -204,7 +247,7 @@ float hexagon_pylon(float2 p2, float pz, float r, float ht)
     p.xz = abs(p.xz);
     p.xz = float2(p.x * 0.866025f + p.z * 0.5f, p.z);
     
-    return length(max(abs(p) - b + 0.005f, 0.)) - 0.005f;
+    return length(max(abs(p) - b + PYLON_BEVEL, 0.)) - PYLON_BEVEL;
 }
 
 float2 hexagon_sdf(float2 p, float pH)
@@ -254,8 +297,37 @@ float2 hexagon_sdf(float2 p, float pH)
     
 }
 
-DistanceInfo distance_function(float3 pos)
+// hexagon_sdf for a ray that hits at epsilon with the pylon of the nearest cell,
+// any other pylon is at least as far as the edge of that cell, see cpu/scene.h
+float2 hexagon_sdf_far(float2 p, float pH, float epsilon)
+{
+    const float2 s = float2(.866025, 1);
+
+    float4 hC = floor(float4(p, p - float2(0, .5))/s.xyxy) + float4(0, 0, 0, .5);
+    float4 hC2 = floor(float4(p - float2(.5, .25), p - float2(.5, .75))/s.xyxy) +
+                 float4(.5, .25, .5, .75);
+
+    float4 h = float4(p - (hC.xy + .5)*s, p - (hC.zw + .5)*s);
+    float4 h2 = float4(p - (hC2.xy + .5)*s, p - (hC2.zw + .5)*s);
+
+    // the nearest of the four centers and its offset
+    h = dot(h.xy, h.xy) < dot(h.zw, h.zw) ? float4(h.xy, hC.xy) : float4(h.zw, hC.zw);
+    h2 = dot(h2.xy, h2.xy) < dot(h2.zw, h2.zw) ? float4(h2.xy, hC2.xy) : float4(h2.zw, hC2.zw);
+    h = dot(h.xy, h.xy) < dot(h2.xy, h2.xy) ? h : h2;
+
+    const float r = .25;
+    float2 a = abs(h.xy);
+    float others = max(r - max(a.x * 0.866025f + a.y * 0.5f, a.y), abs(pH) - PYLON_MAX_HEIGHT);
+    if (others < max(epsilon, LOD_CELL_MARGIN)) return hexagon_sdf(p, pH);
+
+    return float2(min(hexagon_pylon(h.xy, pH, r, hexagon_hash(h.zw)), others), 4.0f);
+}
+
+// distance_function for a ray that hits at epsilon, 0 is full detail. the
+// variants only ever return less than the full distance
+DistanceInfo distance_function_lod(float3 pos, float epsilon)
 {
+    bool lod = epsilon > 0.0f;
     float3 old_pos = pos;
 
     pos.y += .5f;
@@ -265,7 +337,11 @@ DistanceInfo distance_function(float3 pos)
 
     DistanceInfo distance;
     {
-        distance = make_distance_info(windows_logo_3d_sdf(pos, 0.1f));
+        // the bounding cylinder of the logo skips the atan2 and the wave
+        float logo_bound = max(length(pos.xy) - LOGO_RADIUS, abs(pos.z) - 0.1f);
+        distance = make_distance_info(lod && logo_bound > LOD_BOUND_MARGIN ?
+                                      float2(logo_bound, 0.0f) :
+                                      windows_logo_3d_sdf(pos, 0.1f));
     }
     
     {
@@ -287,7 +363,12 @@ DistanceInfo distance_function(float3 pos)
         old_pos.z += timer;
 
 
-        float2 hexagon_board = hexagon_sdf(old_pos.xz, -old_pos.y);
+        // above the tallest pylon the slab is enough, below it one cell is
+        float board_bound = abs(old_pos.y) - PYLON_MAX_HEIGHT;
+        float2 hexagon_board = lod && board_bound > LOD_BOUND_MARGIN ?
+            float2(board_bound, 4.0f) :
+            lod ? hexagon_sdf_far(old_pos.xz, -old_pos.y, epsilon) :
+                  hexagon_sdf(old_pos.xz, -old_pos.y);
         
         distance =
             combine_sdf(distance,
@@ -298,23 +379,32 @@ DistanceInfo distance_function(float3 pos)
     return distance;
 }
 
+DistanceInfo distance_function(float3 pos)
+{
+    return distance_function_lod(pos, 0.0f);
+}
+
 struct HitInfo
 {
     DistanceInfo distance;
     int step_count;
 };
 
-struct HitInfo ray_march(Ray ray)
+// the hit epsilon grows with the footprint of the ray, cone is its growth per
+// unit marched and 0 marches at full detail with MIN_DISTANCE
+struct HitInfo ray_march(Ray ray, float cone)
 {
     float distance_traveled = 0.0f;
     
     int i = 0;
-    for (;i < MAX_STEPS; ++i)
+    for (;i < int(max_steps); ++i)
     {
         float3 current_position =  ray.pos + distance_traveled * ray.dir;
-        DistanceInfo distance_to_closest = distance_function(current_position);
+        float epsilon = min(max(MIN_DISTANCE, distance_traveled * cone), LOD_MAX_EPSILON);
+        DistanceInfo distance_to_closest =
+            distance_function_lod(current_position, cone > 0.0f ? epsilon : 0.0f);
 
-        if (abs(distance_to_closest.data.x) < MIN_DISTANCE)
+        if (abs(distance_to_closest.data.x) < epsilon)
         {
             HitInfo hit_info;
             hit_info.distance =
@@ -368,16 +458,74 @@ float3 random_in_unit_sphere(inout float2 seed, float3 nor)
     return normalize((float3)(rx*uu + ry*vv + rz*nor));
 }
 
+// the second render target is DXGI_FORMAT_R32_UINT: bits 0-15 hold the
+// octahedral encoded normal, bits 16-27 the linear depth of the first hit
+// and bits 28-31 its material
+static const uint GBUFFER_DEPTH_BITS = 12;
+static const uint GBUFFER_MATERIAL_MISS = 15;
+
+// edge stopping of post_ps_main on the signed unit normal and the linear depth
+// of the first hit, tuned against a converged frame by cpu_render -gbuffer
+static const float POST_NORMAL_SHARPNESS = 0.05f;
+static const float POST_DEPTH_SHARPNESS = 0.5f;
+
+uint encode_octahedral_normal(float3 n)
+{
+    float length = abs(n.x) + abs(n.y) + abs(n.z);
+    n = length > 0.0f ? n / length : float3(0, 0, 1);
+
+    float2 e = n.z >= 0.0f ?
+               n.xy :
+               (1.0f - abs(n.yx)) * (n.xy >= 0.0f ? 1.0f : -1.0f);
+
+    uint2 q = uint2(saturate(e * 0.5f + 0.5f) * 255.0f + 0.5f);
+    return q.x | (q.y << 8);
+}
+
+float3 decode_octahedral_normal(uint bits)
+{
+    float2 e = float2(bits & 0xff, (bits >> 8) & 0xff) / 255.0f * 2.0f - 1.0f;
+
+    float3 n = float3(e, 1.0f - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.xy += n.xy >= 0.0f ? -t : t;
+
+    return normalize(n);
+}
+
+uint pack_gbuffer(float3 normal, float depth, uint material)
+{
+    const uint depth_max = (1 << GBUFFER_DEPTH_BITS) - 1;
+    uint depth_bits = uint(saturate(depth / MAX_DISTANCE) * float(depth_max) + 0.5f);
+
+    return encode_octahedral_normal(normal) | (depth_bits << 16) |
+           (min(material, GBUFFER_MATERIAL_MISS) << 28);
+}
+
+void unpack_gbuffer(uint bits, out float3 normal, out float depth, out uint material)
+{
+    const uint depth_max = (1 << GBUFFER_DEPTH_BITS) - 1;
+
+    normal = decode_octahedral_normal(bits & 0xffff);
+    depth = float((bits >> 16) & depth_max) / float(depth_max) * MAX_DISTANCE;
+    material = bits >> 28;
+}
+
 struct ps_out
 {
     float4 color : SV_Target0;
-    float4 normal : SV_Target1;
+    uint gbuffer : SV_Target1;
 };
 
 float pow2(float value) { return value * value; }
 
 ps_out ps_main(vs_out input)
 {
+    if (!checkerboard_is_traced(uint2(input.position.xy)))
+    {
+        discard;
+    }
+
     float2 coords = input.texture_coords;
 
     const float slider = 0.9f;
@@ -385,17 +533,17 @@ ps_out ps_main(vs_out input)
     float3 look_at = float3(0, .6 - slider, 2.85f);
     
     float2 seed = coords.xy;
-    const int total_samples = 3;
-    int max_bounces = 4;
     
-    ps_out result;
-    result.color = result.normal = 0.0f;
+    float4 color = 0.0f;
+    float3 normal = 0.0f;
+    float depth = MAX_DISTANCE;
+    uint material = GBUFFER_MATERIAL_MISS;
 
     float2 pixel_size =
         float2(1.0f / (1.0f / pixel_width * aspect_ratio), pixel_width);
 
     int j = 0;
-    for (; j < total_samples; ++j)
+    for (; j < int(total_samples); ++j)
     {
         float3 total_emission = 0.0f;
         float3 total_attenuation = 0.0f;
@@ -404,12 +552,13 @@ ps_out ps_main(vs_out input)
                               to_radians(60.0f),
                               coords + hash22(seed) * pixel_size);
 
-        for (int i = 0; i < max_bounces; ++i)
+        for (int i = 0; i < int(max_bounces); ++i)
         {
-            HitInfo hit_info = ray_march(ray);
+            // bounce rays only light the surface they leave, so they march coarser
+            HitInfo hit_info = ray_march(ray, i == 0 ? lod_cone : lod_cone * LOD_BOUNCE_SCALE);
         
             // we didn't hit anything draw a background
-            if (hit_info.step_count == MAX_STEPS ||
+            if (hit_info.step_count == int(max_steps) ||
                 hit_info.distance.data.x >= MAX_DISTANCE)
             {
                 if (i == 0) total_attenuation = 1.0f;
@@ -417,7 +566,7 @@ ps_out ps_main(vs_out input)
                 float3 background =
                     pow2(abs(ray.dir.y + 0.3f)  + hash12(seed) * 0.1f) * 0.25f;
                     
-                result.color += 
+                color += 
                     float4(background * total_attenuation, 0);
                     
                 break;
@@ -425,6 +574,12 @@ ps_out ps_main(vs_out input)
 
             float3 hit_position = ray.pos + hit_info.distance.data.x * ray.dir;
             float3 hit_normal = calculate_normal(hit_position);
+
+            if (i == 0 && j == 0)
+            {
+                depth = hit_info.distance.data.x;
+                material = uint(hit_info.distance.data.y);
+            }
             
             int hit_index = int(hit_info.distance.data.y);
             if (hit_index > 8)
@@ -432,8 +587,8 @@ ps_out ps_main(vs_out input)
                 const float3 strength = 0.9f;
                 total_emission = i == 0 ? strength : strength * total_attenuation;
 
-                result.color += float4(total_emission, 0);
-                result.normal += float4(hit_normal, 0);
+                color += float4(total_emission, 0);
+                normal += hit_normal;
                 break;
             }
             else
@@ -485,7 +640,7 @@ ps_out ps_main(vs_out input)
             
             if (i == 0 && j == 0)
             {
-                result.normal += float4(hit_normal, 0);
+                normal += hit_normal;
             }
 
             if (dot(total_attenuation, total_attenuation) < 0.01f)
@@ -495,62 +650,452 @@ ps_out ps_main(vs_out input)
         }
     }
 
-    result.color /= float(j == 0 ? 1 : j);
-    result.normal /= float(j == 0 ? 1 : j);
+    ps_out result;
+    result.color = color / float(j == 0 ? 1 : j);
+    result.gbuffer = pack_gbuffer(normal, depth, material);
         
     return result;
 }
 
 Texture2D color_texture : register(t0);
-Texture2D normal_texture : register(t1);
-SamplerState texture_sampler : register(s0);
+Texture2D<uint> gbuffer_texture : register(t1);
 
-float4 sample_color_texture(float2 pos)
+float4 load_color_texture(int2 pixel, int2 size)
 {
-    return color_texture.Sample(texture_sampler, pos);
+    return color_texture.Load(int3(clamp(pixel, 0, size - 1), 0));
 }
 
-float4 sample_normal_texture(float2 pos)
+// fills in the pixels ps_main skipped this frame from their traced neighbours
+// and, when there is one, the value traced for them last frame. their g-buffer
+// texel is last frame's as well, so they take the one of the traced neighbour
+// whose color is closest to the reconstructed one
+ps_out reconstruct_ps_main(vs_out input)
 {
-    return normal_texture.Sample(texture_sampler, pos);
+    int2 pixel = int2(input.position.xy);
+
+    uint2 dimensions;
+    color_texture.GetDimensions(dimensions.x, dimensions.y);
+    int2 size = int2(dimensions);
+
+    ps_out result;
+    result.color = load_color_texture(pixel, size);
+    result.gbuffer = gbuffer_texture.Load(int3(pixel, 0));
+    if (checkerboard_is_traced(uint2(pixel)))
+    {
+        return result;
+    }
+
+    int2 offsets[4] = {
+        int2(0, -1), int2(0, 1), int2(-1, 0), int2(1, 0),
+    };
+
+    float4 neighbours[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        neighbours[i] = load_color_texture(pixel + offsets[i], size);
+    }
+
+    // rows only have their vertical neighbours traced
+    int neighbour_count = checkerboard_pattern == CHECKERBOARD_ROWS ? 2 : 4;
+
+    float4 spatial = 0.0f;
+    float4 neighbour_min = neighbours[0];
+    float4 neighbour_max = neighbours[0];
+    for (int i = 0; i < neighbour_count; ++i)
+    {
+        spatial += neighbours[i];
+        neighbour_min = min(neighbour_min, neighbours[i]);
+        neighbour_max = max(neighbour_max, neighbours[i]);
+    }
+    spatial /= float(neighbour_count);
+
+    if (checkerboard_filter == RECONSTRUCT_TEMPORAL_CLAMP && history_valid != 0)
+    {
+        result.color = clamp(result.color, neighbour_min, neighbour_max);
+    }
+    else
+    {
+        result.color = spatial;
+    }
+
+    int closest = 0;
+    float closest_distance = 1e30f;
+    for (int i = 0; i < neighbour_count; ++i)
+    {
+        float3 difference = neighbours[i].rgb - result.color.rgb;
+        float distance = dot(difference, difference);
+        if (distance < closest_distance)
+        {
+            closest = i;
+            closest_distance = distance;
+        }
+    }
+
+    result.gbuffer = gbuffer_texture.Load(int3(clamp(pixel + offsets[closest], 0, size - 1), 0));
+    return result;
+}
+
+Texture2D older_color_texture : register(t2);
+Texture2D<uint> older_gbuffer_texture : register(t3);
+
+// a texel has to land within this many pixels of the output pixel
+static const float GENERATION_TOLERANCE = 1.0f;
+static const int GENERATION_ITERATIONS = 3;
+
+// where ps_main puts the camera
+static const float3 CAMERA_POSITION = float3(0, .8f - .9f, 3.4f);
+static const float3 CAMERA_LOOK_AT = float3(0, .6f - .9f, 2.85f);
+
+// the logo, the light and the hexagon board each move rigidly, the local
+// position of a point is what distance_function evaluates their sdfs at
+float3 logo_local(float3 pos, float time)
+{
+    pos.y += .5f;
+    pos.xy = mul(pos.xy, rotation_matrix(time));
+    pos.xz = mul(pos.xz, rotation_matrix(time));
+    pos.xz += .1f * sin(time);
+    return pos;
+}
+
+float3 logo_world(float3 local, float time)
+{
+    local.xz -= .1f * sin(time);
+    local.xz = mul(local.xz, rotation_matrix(-time));
+    local.xy = mul(local.xy, rotation_matrix(-time));
+    local.y -= .5f;
+    return local;
+}
+
+float3 light_local(float3 pos, float time)
+{
+    pos -= float3(0.0f, 2.0f, 0);
+    pos.xz = mul(pos.xz, rotation_matrix(-time));
+    return pos;
+}
+
+float3 light_world(float3 local, float time)
+{
+    local.xz = mul(local.xz, rotation_matrix(time));
+    local += float3(0.0f, 2.0f, 0);
+    return local;
+}
+
+float3 board_local(float3 pos, float time)
+{
+    pos.zy = mul(pos.zy, rotation_matrix(sin(time) * 0.3f));
+    pos.xz = mul(pos.xz, rotation_matrix(time * 0.5f));
+    pos.y += 2.3;
+    pos.z += time;
+    return pos;
+}
+
+float3 board_world(float3 local, float time)
+{
+    local.z -= time;
+    local.y -= 2.3;
+    local.xz = mul(local.xz, rotation_matrix(-time * 0.5f));
+    local.zy = mul(local.zy, rotation_matrix(-sin(time) * 0.3f));
+    return local;
+}
+
+// the height of the pylon nearest to a point on the board, hexagon_sdf picks it the same way
+float pylon_height(float2 p, float pH, float time)
+{
+    const float2 s = float2(.866025, 1);
+
+    float4 hC = floor(float4(p, p - float2(0, .5))/s.xyxy) + float4(0, 0, 0, .5);
+    float4 hC2 = floor(float4(p - float2(.5, .25), p - float2(.5, .75))/s.xyxy) +
+                 float4(.5, .25, .5, .75);
+
+    float2 cells[4] = {hC.xy, hC.zw, hC2.xy, hC2.zw};
+
+    float nearest = 1e30f;
+    float height = 0.0f;
+    for (int i = 0; i < 4; ++i)
+    {
+        float ht = dot(sin(cells[i] * 4.0f - cos(cells[i].yx * 1.4f) + time), 0.25f) + .5f;
+        float distance = hexagon_pylon(p - (cells[i] + .5f) * s, pH, .25f, ht);
+        if (distance < nearest)
+        {
+            nearest = distance;
+            height = ht;
+        }
+    }
+
+    return height;
+}
+
+// where the point hit on material at from_time is at to_time. the pylons
+// also grow and shrink, their points are scaled along the pylon with it
+float3 scene_motion(float3 pos, uint material, float from_time, float to_time)
+{
+    if (material < 4)
+    {
+        return logo_world(logo_local(pos, from_time), to_time);
+    }
+
+    if (material == 4)
+    {
+        float3 local = board_local(pos, from_time);
+
+        float from_height = pylon_height(local.xz, -local.y, from_time);
+        float to_height = pylon_height(local.xz, -local.y, to_time);
+        if (from_height > 0.01f) local.y *= to_height / from_height;
+
+        return board_world(local, to_time);
+    }
+
+    if (material == 9)
+    {
+        return light_world(light_local(pos, from_time), to_time);
+    }
+
+    return pos;
+}
+
+// the inverse of look_at_ray, the position on screen in pixels where pixel
+// (x, y) covers [x, x + 1) x [y, y + 1), false behind the camera
+bool project(float3 pos, float2 size, out float2 pixel)
+{
+    float3 view_direction = CAMERA_LOOK_AT - CAMERA_POSITION;
+    float3 u = normalize(cross(view_direction, float3(0, 1, 0)));
+    float3 v = normalize(cross(u, view_direction));
+
+    float view_plane_half_width = tan(to_radians(60.0f) / 2.0f);
+    float view_plane_half_height = view_plane_half_width * aspect_ratio;
+
+    float3 view_plane_bottom_left_point = CAMERA_LOOK_AT -
+                                          v * view_plane_half_height -
+                                          u * view_plane_half_width;
+
+    // where the line from the eye crosses the view plane through the look at point
+    float3 to_pos = pos - CAMERA_POSITION;
+    float along = dot(to_pos, view_direction);
+    float3 on_plane = CAMERA_POSITION +
+                      to_pos * (dot(view_direction, view_direction) / along) -
+                      view_plane_bottom_left_point;
+
+    float2 coords = float2(dot(on_plane, u) / (2.0f * view_plane_half_width),
+                           dot(on_plane, v) / (2.0f * view_plane_half_height));
+
+    pixel = float2(coords.x, 1.0f - coords.y) * size;
+    return along > 0.0f;
+}
+
+// pixels from the center of a texel traced at source_time to where it is at
+// timer, and its distance from the eye there
+float2 texel_motion(Texture2D<uint> gbuffer, int2 texel, int2 size, float source_time,
+                    out float depth)
+{
+    float3 normal;
+    float hit_depth;
+    uint material;
+    unpack_gbuffer(gbuffer.Load(int3(texel, 0)), normal, hit_depth, material);
+
+    // the background only depends on the ray direction, it stays where it is
+    depth = MAX_DISTANCE;
+    if (material == GBUFFER_MATERIAL_MISS)
+    {
+        return 0.0f;
+    }
+
+    float2 center = float2(texel) + 0.5f;
+    Ray ray = look_at_ray(CAMERA_POSITION, CAMERA_LOOK_AT, to_radians(60.0f),
+                          float2(center.x, float(size.y) - center.y) / float2(size));
+
+    float3 moved = scene_motion(ray.pos + ray.dir * hit_depth, material, source_time, timer);
+
+    // off behind the camera, never lands anywhere
+    float2 pixel;
+    if (!project(moved, float2(size), pixel))
+    {
+        return float2(2 * size.x, 0);
+    }
+
+    depth = min(length(moved - CAMERA_POSITION), MAX_DISTANCE);
+    return pixel - center;
+}
+
+// the motion of the nearest and the farthest texel around the pixel, objects
+// moving over it start the search from the first, revealed background the second
+void neighbour_motions(Texture2D<uint> gbuffer, int2 pixel, int2 size, float source_time,
+                       out float2 nearest, out float2 farthest)
+{
+    int2 nearest_texel = pixel;
+    int2 farthest_texel = pixel;
+    float nearest_depth = 1e30f;
+    float farthest_depth = -1e30f;
+
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            int2 texel = clamp(pixel + int2(x, y), 0, size - 1);
+
+            float3 normal;
+            float depth;
+            uint material;
+            unpack_gbuffer(gbuffer.Load(int3(texel, 0)), normal, depth, material);
+
+            if (depth < nearest_depth)
+            {
+                nearest_depth = depth;
+                nearest_texel = texel;
+            }
+
+            if (depth > farthest_depth)
+            {
+                farthest_depth = depth;
+                farthest_texel = texel;
+            }
+        }
+    }
+
+    float unused;
+    nearest = texel_motion(gbuffer, nearest_texel, size, source_time, unused);
+    farthest = texel_motion(gbuffer, farthest_texel, size, source_time, unused);
+}
+
+// searches from each guess of the motion for the texel that lands on the
+// pixel by fixed point iteration of texel = pixel - motion(texel), the
+// nearest of the texels found wins
+bool find_texel(Texture2D<uint> gbuffer, int2 pixel, int2 size, float source_time,
+                float2 guesses[2], out int2 found, out float found_depth)
+{
+    float2 center = float2(pixel) + 0.5f;
+
+    bool result = false;
+    found = pixel;
+    found_depth = 1e30f;
+
+    for (int g = 0; g < 2; ++g)
+    {
+        float2 motion = guesses[g];
+        int2 texel = pixel;
+        float depth = MAX_DISTANCE;
+
+        for (int i = 0; i < GENERATION_ITERATIONS; ++i)
+        {
+            texel = clamp(int2(floor(center - motion)), 0, size - 1);
+            motion = texel_motion(gbuffer, texel, size, source_time, depth);
+        }
+
+        float2 miss = float2(texel) + 0.5f + motion - center;
+        if (all(abs(miss) <= GENERATION_TOLERANCE) && depth < found_depth)
+        {
+            result = true;
+            found = texel;
+            found_depth = depth;
+        }
+    }
+
+    return result;
+}
+
+// the frames in between the traced ones, warped from the last traced frame
+// along the motion of what each texel hit. disocclusions come from the
+// frame traced before it, what neither saw from the background next to it.
+// the texels keep the color, normal and material they were traced with
+ps_out generate_ps_main(vs_out input)
+{
+    int2 pixel = int2(input.position.xy);
+
+    uint2 dimensions;
+    gbuffer_texture.GetDimensions(dimensions.x, dimensions.y);
+    int2 size = int2(dimensions);
+
+    float unused;
+    float2 guesses[2];
+    float2 farthest;
+    guesses[0] = texel_motion(gbuffer_texture, pixel, size, source_timer, unused);
+    neighbour_motions(gbuffer_texture, pixel, size, source_timer, guesses[1], farthest);
+
+    int2 texel;
+    float depth;
+    bool from_older = false;
+
+    if (!find_texel(gbuffer_texture, pixel, size, source_timer, guesses, texel, depth))
+    {
+        if (older_valid != 0)
+        {
+            float2 older_guesses[2];
+            float2 older_farthest;
+            older_guesses[0] = texel_motion(older_gbuffer_texture, pixel, size, older_timer, unused);
+            neighbour_motions(older_gbuffer_texture, pixel, size, older_timer,
+                              older_guesses[1], older_farthest);
+
+            from_older = find_texel(older_gbuffer_texture, pixel, size, older_timer,
+                                    older_guesses, texel, depth);
+        }
+
+        // whatever was behind the pixel moves like the background around it
+        if (!from_older)
+        {
+            texel = clamp(int2(floor(float2(pixel) + 0.5f - farthest)), 0, size - 1);
+            texel_motion(gbuffer_texture, texel, size, source_timer, depth);
+        }
+    }
+
+    float3 normal;
+    float traced_depth;
+    uint material;
+
+    ps_out result;
+    if (from_older)
+    {
+        result.color = older_color_texture.Load(int3(texel, 0));
+        unpack_gbuffer(older_gbuffer_texture.Load(int3(texel, 0)), normal, traced_depth, material);
+    }
+    else
+    {
+        result.color = color_texture.Load(int3(texel, 0));
+        unpack_gbuffer(gbuffer_texture.Load(int3(texel, 0)), normal, traced_depth, material);
+    }
+
+    result.gbuffer = pack_gbuffer(normal, depth, material);
+    return result;
 }
 
 // based on https://www.shadertoy.com/view/ldKBzG
 float4 post_ps_main(vs_out input) : SV_TARGET
 {
-    float2 coords = float2(input.texture_coords.x,
-                           1.0f - input.texture_coords.y);
+    // runs at the render resolution, upscale_ps_main stretches the result over the window
+    int2 pixel = int2(input.position.xy);
+
+    uint2 dimensions;
+    color_texture.GetDimensions(dimensions.x, dimensions.y);
+    int2 size = int2(dimensions);
     
-    float2 offset[25] = {
-        float2(-2,-2),
-        float2(-1,-2),
-        float2(0,-2),
-        float2(1,-2),
-        float2(2,-2),
+    int2 offset[25] = {
+        int2(-2,-2),
+        int2(-1,-2),
+        int2(0,-2),
+        int2(1,-2),
+        int2(2,-2),
     
-        float2(-2,-1),
-        float2(-1,-1),
-        float2(0,-1),
-        float2(1,-1),
-        float2(2,-1),
+        int2(-2,-1),
+        int2(-1,-1),
+        int2(0,-1),
+        int2(1,-1),
+        int2(2,-1),
     
-        float2(-2,0),
-        float2(-1,0),
-        float2(0,0),
-        float2(1,0),
-        float2(2,0),
+        int2(-2,0),
+        int2(-1,0),
+        int2(0,0),
+        int2(1,0),
+        int2(2,0),
     
-        float2(-2,1),
-        float2(-1,1),
-        float2(0,1),
-        float2(1,1),
-        float2(2,1),
+        int2(-2,1),
+        int2(-1,1),
+        int2(0,1),
+        int2(1,1),
+        int2(2,1),
     
-        float2(-2,2),
-        float2(-1,2),
-        float2(0,2),
-        float2(1,2),
-        float2(2,2),
+        int2(-2,2),
+        int2(-1,2),
+        int2(0,2),
+        int2(1,2),
+        int2(2,2),
     };
     
     float kernel[25] = {
@@ -585,33 +1130,54 @@ float4 post_ps_main(vs_out input) : SV_TARGET
         1.0f/256.0f,
     };
 
-    float4 sum = 0.0f;
+    float3 sum = 0.0f;
     float total_weight = 0.0f;
-    float4 center_color = sample_color_texture(coords);    
-    float4 center_normal = sample_normal_texture(coords);
-    float2 pixel_size =
-        float2(1.0f / (1.0f / pixel_width * aspect_ratio), pixel_width);
+    float3 center_color = load_color_texture(pixel, size).rgb;
+
+    float3 center_normal;
+    float center_depth;
+    uint center_material;
+    unpack_gbuffer(gbuffer_texture.Load(int3(pixel, 0)),
+                   center_normal, center_depth, center_material);
 
     for (int i = 0; i < 25; i += 1)
     {
-        float2 uv = coords + offset[i] * pixel_size;
+        int2 sample_pixel = clamp(pixel + offset[i], 0, size - 1);
 
-        float4 sample_color = sample_color_texture(uv);
-        float4 color_difference = center_color - sample_color;
+        float3 sample_color = color_texture.Load(int3(sample_pixel, 0)).rgb;
+        float3 color_difference = center_color - sample_color;
 
         float color_dist = dot(color_difference, color_difference);
         float color_weight = min(exp(-color_dist), 1.0f);
         
-        float4 sample_normal = sample_normal_texture(uv);
-        float4 normal_difference = center_normal - sample_normal;
+        float3 sample_normal;
+        float sample_depth;
+        uint sample_material;
+        unpack_gbuffer(gbuffer_texture.Load(int3(sample_pixel, 0)),
+                       sample_normal, sample_depth, sample_material);
+
+        float3 normal_difference = center_normal - sample_normal;
 
         float normal_dist = dot(normal_difference, normal_difference);
-        float normal_weight = min(exp(-normal_dist * 2.0f), 1.0f);
+        float normal_weight = min(exp(-normal_dist * POST_NORMAL_SHARPNESS), 1.0f);
+
+        float depth_weight = exp(-abs(center_depth - sample_depth) * POST_DEPTH_SHARPNESS);
 
-        float weight = normal_weight * color_weight;
+        float weight = normal_weight * color_weight * depth_weight;
         sum += sample_color * weight * kernel[i];
         total_weight += weight * kernel[i];        
     }
     
-    return pow(sum / total_weight, 1.0f / 2.2f); 
+    return float4(pow(sum / total_weight, 1.0f / 2.2f), 1.0f); 
+}
+
+// linear, clamped to the edges
+SamplerState upscale_sampler : register(s0);
+
+// stretches post_ps_main's output, bound as color_texture, over the window
+float4 upscale_ps_main(vs_out input) : SV_TARGET
+{
+    // texture_coords has y going up, texture space has it going down
+    float2 uv = float2(input.texture_coords.x, 1.0f - input.texture_coords.y);
+    return color_texture.Sample(upscale_sampler, uv);
 }
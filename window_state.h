@@ -0,0 +1,122 @@
+#ifndef WINDOW_STATE_H
+#define WINDOW_STATE_H
+
+// hands the window state from the message pump to the render thread. the
+// pump is the only writer and publishes snapshots under a sequence lock,
+// the render thread polls it once per frame: polling is a single atomic
+// load when nothing changed and never blocks or sees a half written
+// snapshot. uses c11 atomics and no crt functions so it can be built into
+// the screensaver, a zeroed channel is ready to use
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WINDOW_STATE_VISIBLE 0x1U
+#define WINDOW_STATE_QUIT 0x2U
+
+typedef struct
+{
+    int32_t width;
+    int32_t height;
+    bool visible;
+    bool quit_requested;
+} WindowSnapshot;
+
+typedef struct
+{
+    // odd while the writer is in the middle of publishing
+    _Atomic uint32_t sequence;
+
+    _Atomic int32_t width;
+    _Atomic int32_t height;
+    _Atomic uint32_t flags;
+
+    // last published snapshot, only touched by the writer
+    WindowSnapshot published;
+} WindowStateChannel;
+
+static void window_state_publish(WindowStateChannel *const this,
+                                 WindowSnapshot const *const snapshot)
+{
+    uint32_t const sequence = atomic_load_explicit(&this->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&this->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    uint32_t const flags = (snapshot->visible ? WINDOW_STATE_VISIBLE : 0) |
+                           (snapshot->quit_requested ? WINDOW_STATE_QUIT : 0);
+
+    atomic_store_explicit(&this->width, snapshot->width, memory_order_relaxed);
+    atomic_store_explicit(&this->height, snapshot->height, memory_order_relaxed);
+    atomic_store_explicit(&this->flags, flags, memory_order_relaxed);
+
+    atomic_store_explicit(&this->sequence, sequence + 2, memory_order_release);
+
+    this->published.width = snapshot->width;
+    this->published.height = snapshot->height;
+    this->published.visible = snapshot->visible;
+    this->published.quit_requested = snapshot->quit_requested;
+}
+
+// the helpers below are for the writer and skip publishing when nothing changed
+
+static void window_state_set_size(WindowStateChannel *const this,
+                                  int32_t const width, int32_t const height)
+{
+    if (this->published.width == width && this->published.height == height) return;
+
+    WindowSnapshot snapshot = this->published;
+    snapshot.width = width;
+    snapshot.height = height;
+    window_state_publish(this, &snapshot);
+}
+
+static void window_state_set_visible(WindowStateChannel *const this, bool const visible)
+{
+    if (this->published.visible == visible) return;
+
+    WindowSnapshot snapshot = this->published;
+    snapshot.visible = visible;
+    window_state_publish(this, &snapshot);
+}
+
+static void window_state_request_quit(WindowStateChannel *const this)
+{
+    if (this->published.quit_requested) return;
+
+    WindowSnapshot snapshot = this->published;
+    snapshot.quit_requested = true;
+    window_state_publish(this, &snapshot);
+}
+
+// for the reader: copies the latest snapshot and returns true when it was
+// published after the one last_sequence refers to. returns false when nothing
+// changed or the writer is busy, the change is then picked up by a later poll
+static bool window_state_poll(WindowStateChannel *const this,
+                              uint32_t *const last_sequence,
+                              WindowSnapshot *const snapshot)
+{
+    uint32_t const begin = atomic_load_explicit(&this->sequence, memory_order_acquire);
+    if (begin == *last_sequence || (begin & 1) != 0) return false;
+
+    int32_t const width = atomic_load_explicit(&this->width, memory_order_relaxed);
+    int32_t const height = atomic_load_explicit(&this->height, memory_order_relaxed);
+    uint32_t const flags = atomic_load_explicit(&this->flags, memory_order_relaxed);
+
+    // the loads above may not move below the second sequence load
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t const end = atomic_load_explicit(&this->sequence, memory_order_relaxed);
+
+    if (begin != end) return false;
+
+    snapshot->width = width;
+    snapshot->height = height;
+    snapshot->visible = (flags & WINDOW_STATE_VISIBLE) != 0;
+    snapshot->quit_requested = (flags & WINDOW_STATE_QUIT) != 0;
+
+    *last_sequence = begin;
+    return true;
+}
+
+#endif